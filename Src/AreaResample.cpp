@@ -0,0 +1,276 @@
+// AreaResample.cpp
+//
+// Area-average reduction of RGBA pictures. Every destination pixel is the average of the source pixels under it,
+// weighted by how much of each one it covers, so large reductions don't alias the way bilinear does. The source is
+// read once, straight into the final size, and large sources are split across threads by row. Used for thumbnails,
+// Save All, and the contact sheet.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <Foundation/tFundamentals.h>
+#include "AreaResample.h"
+#include "WorkerPool.h"
+using namespace tMath;
+
+
+namespace AreaResample
+{
+	// The run of source pixels covered by one destination pixel along one axis. The end pixels are usually only
+	// partly covered. Weights are in source pixels so a fully covered pixel has weight 1.
+	struct Span
+	{
+		int First;
+		int Last;								// Inclusive.
+		float FirstWeight;
+		float LastWeight;						// Only meaningful if Last > First.
+	};
+
+	// Sources with fewer pixels than this are reduced on the calling thread. Thread start-up would cost more than it
+	// saves. Larger ones are handed out RowsPerBand destination rows at a time.
+	const int ParallelThreshold					= 4096*1024;
+	const int RowsPerBand						= 16;
+
+	void ComputeSpans(std::vector<Span>&, int srcSize, int dstSize);
+	void ReduceRows
+	(
+		tPixel* dst, int dstStride, int dstW, int rowBegin, int rowEnd,
+		const tPixel* src, int srcW, const std::vector<Span>& cols, const std::vector<Span>& rows, float invArea
+	);
+	void ReduceRect(tPixel* dst, int dstStride, int dstW, int dstH, const tPixel* src, int srcW, int srcH);
+	inline void AddPremultiplied(float sum[4], const tPixel& pixel, float weight);
+}
+
+
+bool AreaResample::IsReduction(int srcW, int srcH, int dstW, int dstH)
+{
+	return (dstW <= srcW) && (dstH <= srcH);
+}
+
+
+void AreaResample::GetFitSize(int& fitW, int& fitH, int srcW, int srcH, int boxW, int boxH)
+{
+	float scaleX = float(boxW) / float(srcW);
+	float scaleY = float(boxH) / float(srcH);
+	if (scaleX < scaleY)
+	{
+		fitW = boxW;
+		fitH = tClamp(int(tRound(float(srcH)*scaleX)), 1, boxH);
+	}
+	else
+	{
+		fitH = boxH;
+		fitW = tClamp(int(tRound(float(srcW)*scaleY)), 1, boxW);
+	}
+}
+
+
+void AreaResample::ComputeSpans(std::vector<Span>& spans, int srcSize, int dstSize)
+{
+	// Doubles keep the span edges exact for very large sources.
+	spans.resize(dstSize);
+	double scale = double(srcSize) / double(dstSize);
+	for (int d = 0; d < dstSize; d++)
+	{
+		double begin = double(d) * scale;
+		double end = double(d+1) * scale;
+		Span& span = spans[d];
+		span.First = tClamp(int(std::floor(begin)), 0, srcSize-1);
+		span.Last = tClamp(int(std::ceil(end)) - 1, span.First, srcSize-1);
+		if (span.First == span.Last)
+		{
+			span.FirstWeight = float(end - begin);
+			span.LastWeight = 0.0f;
+		}
+		else
+		{
+			span.FirstWeight = float(double(span.First+1) - begin);
+			span.LastWeight = float(end - double(span.Last));
+		}
+	}
+}
+
+
+inline void AreaResample::AddPremultiplied(float sum[4], const tPixel& pixel, float weight)
+{
+	float wa = weight * float(pixel.A);
+	sum[0] += wa * float(pixel.R);
+	sum[1] += wa * float(pixel.G);
+	sum[2] += wa * float(pixel.B);
+	sum[3] += wa;
+}
+
+
+void AreaResample::ReduceRows
+(
+	tPixel* dst, int dstStride, int dstW, int rowBegin, int rowEnd,
+	const tPixel* src, int srcW, const std::vector<Span>& cols, const std::vector<Span>& rows, float invArea
+)
+{
+	// One row of float accumulators is all the state needed. Each source row under the destination row is folded in
+	// with its vertical weight. The four channel loops are written so the compiler can vectorize them.
+	std::vector<float> accum(dstW*4);
+	for (int dy = rowBegin; dy < rowEnd; dy++)
+	{
+		std::fill(accum.begin(), accum.end(), 0.0f);
+		const Span& row = rows[dy];
+		for (int sy = row.First; sy <= row.Last; sy++)
+		{
+			float wy = (sy == row.First) ? row.FirstWeight : ((sy == row.Last) ? row.LastWeight : 1.0f);
+			const tPixel* srcRow = src + int64(sy)*int64(srcW);
+			float* acc = accum.data();
+			for (int dx = 0; dx < dstW; dx++, acc += 4)
+			{
+				const Span& col = cols[dx];
+				float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				AddPremultiplied(sum, srcRow[col.First], col.FirstWeight);
+				for (int sx = col.First+1; sx < col.Last; sx++)
+					AddPremultiplied(sum, srcRow[sx], 1.0f);
+				if (col.Last > col.First)
+					AddPremultiplied(sum, srcRow[col.Last], col.LastWeight);
+
+				for (int c = 0; c < 4; c++)
+					acc[c] += wy * sum[c];
+			}
+		}
+
+		// Un-premultiply. The alpha sum is in units of source pixels times 255 so it is normalized by the area.
+		tPixel* dstRow = dst + int64(dy)*int64(dstStride);
+		const float* acc = accum.data();
+		for (int dx = 0; dx < dstW; dx++, acc += 4)
+		{
+			tPixel& out = dstRow[dx];
+			if (acc[3] <= 0.0f)
+			{
+				out.R = out.G = out.B = out.A = 0;
+				continue;
+			}
+
+			float invAlpha = 1.0f / acc[3];
+			out.R = uint8(tClamp(int(acc[0]*invAlpha + 0.5f), 0, 255));
+			out.G = uint8(tClamp(int(acc[1]*invAlpha + 0.5f), 0, 255));
+			out.B = uint8(tClamp(int(acc[2]*invAlpha + 0.5f), 0, 255));
+			out.A = uint8(tClamp(int(acc[3]*invArea + 0.5f), 0, 255));
+		}
+	}
+}
+
+
+void AreaResample::ReduceRect(tPixel* dst, int dstStride, int dstW, int dstH, const tPixel* src, int srcW, int srcH)
+{
+	std::vector<Span> cols;
+	std::vector<Span> rows;
+	ComputeSpans(cols, srcW, dstW);
+	ComputeSpans(rows, srcH, dstH);
+	float invArea = float((double(dstW) * double(dstH)) / (double(srcW) * double(srcH)));
+
+	if (int64(srcW)*int64(srcH) < ParallelThreshold)
+	{
+		ReduceRows(dst, dstStride, dstW, 0, dstH, src, srcW, cols, rows, invArea);
+		return;
+	}
+
+	// Destination rows never share a source row accumulator so the bands are independent.
+	int numBands = (dstH + RowsPerBand - 1) / RowsPerBand;
+	Viewer::ParallelFor
+	(
+		numBands,
+		[&](int band)
+		{
+			int rowBegin = band*RowsPerBand;
+			int rowEnd = tMin(rowBegin + RowsPerBand, dstH);
+			ReduceRows(dst, dstStride, dstW, rowBegin, rowEnd, src, srcW, cols, rows, invArea);
+		}
+	);
+}
+
+
+void AreaResample::Reduce(tPixel* dst, int dstW, int dstH, const tPixel* src, int srcW, int srcH)
+{
+	tAssert(dst && src && (dstW > 0) && (dstH > 0) && (srcW > 0) && (srcH > 0));
+	ReduceRect(dst, dstW, dstW, dstH, src, srcW, srcH);
+}
+
+
+void AreaResample::ReduceFit(tPixel* dst, int boxW, int boxH, const tPixel* src, int srcW, int srcH)
+{
+	tAssert(dst && src && (boxW > 0) && (boxH > 0) && (srcW > 0) && (srcH > 0));
+	int fitW, fitH;
+	GetFitSize(fitW, fitH, srcW, srcH, boxW, boxH);
+
+	// Only the letterbox border is cleared. The rest is written by the reduction.
+	int offsetX = (boxW - fitW) / 2;
+	int offsetY = (boxH - fitH) / 2;
+	for (int y = 0; y < boxH; y++)
+	{
+		tPixel* row = dst + int64(y)*int64(boxW);
+		if ((y < offsetY) || (y >= offsetY + fitH))
+		{
+			tStd::tMemset(row, 0, boxW*sizeof(tPixel));
+			continue;
+		}
+		tStd::tMemset(row, 0, offsetX*sizeof(tPixel));
+		tStd::tMemset(row + offsetX + fitW, 0, (boxW - offsetX - fitW)*sizeof(tPixel));
+	}
+
+	ReduceRect(dst + int64(offsetY)*int64(boxW) + offsetX, boxW, fitW, fitH, src, srcW, srcH);
+}
+
+
+void AreaResample::Resample
+(
+	tImage::tPicture& dst, const tImage::tPicture& src, int width, int height,
+	tImage::tResampleFilter filter, tImage::tResampleEdgeMode edgeMode
+)
+{
+	int srcW = src.GetWidth();
+	int srcH = src.GetHeight();
+	bool boxLike = (filter == tImage::tResampleFilter::Box) || (filter == tImage::tResampleFilter::Bilinear);
+	if (!boxLike || !IsReduction(srcW, srcH, width, height))
+	{
+		if (&dst != &src)
+			dst.Set(src);
+		if ((srcW != width) || (srcH != height))
+			dst.Resample(width, height, filter, edgeMode);
+		return;
+	}
+
+	// The source is fully read before dst is set so the two may be the same picture.
+	tPixel* pixels = new tPixel[width*height];
+	Reduce(pixels, width, height, src.GetPixelPointer(), srcW, srcH);
+	dst.Set(width, height, pixels, false);
+}
+
+
+void AreaResample::ResampleFit(tImage::tPicture& dst, const tImage::tPicture& src, int boxW, int boxH)
+{
+	int srcW = src.GetWidth();
+	int srcH = src.GetHeight();
+	int fitW, fitH;
+	GetFitSize(fitW, fitH, srcW, srcH, boxW, boxH);
+
+	// Small sources are enlarged bilinearly first. Placing them in the box is then a one to one copy.
+	tPixel* pixels = new tPixel[boxW*boxH];
+	if (IsReduction(srcW, srcH, fitW, fitH))
+	{
+		ReduceFit(pixels, boxW, boxH, src.GetPixelPointer(), srcW, srcH);
+	}
+	else
+	{
+		tImage::tPicture enlarged;
+		enlarged.Set(src);
+		enlarged.Resample(fitW, fitH, tImage::tResampleFilter::Bilinear);
+		ReduceFit(pixels, boxW, boxH, enlarged.GetPixelPointer(), fitW, fitH);
+	}
+	dst.Set(boxW, boxH, pixels, false);
+}
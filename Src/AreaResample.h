@@ -0,0 +1,48 @@
+// AreaResample.h
+//
+// Area-average reduction of RGBA pictures. Every destination pixel is the average of the source pixels under it,
+// weighted by how much of each one it covers, so large reductions don't alias the way bilinear does. The source is
+// read once, straight into the final size, and large sources are split across threads by row. Used for thumbnails,
+// Save All, and the contact sheet.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+#include <Math/tColour.h>
+#include <Image/tPicture.h>
+namespace AreaResample
+{
+	// True if the destination is no bigger than the source in either direction. An area average only makes sense
+	// for reductions. Enlarging should use one of the regular resample filters.
+	bool IsReduction(int srcW, int srcH, int dstW, int dstH);
+
+	// Fills the dstW*dstH destination. Colours are averaged premultiplied by alpha so transparent pixels don't bleed
+	// their colour into the result.
+	void Reduce(tPixel* dst, int dstW, int dstH, const tPixel* src, int srcW, int srcH);
+
+	// Like Reduce except the source aspect is kept. The result is centred in the boxW*boxH destination and the
+	// border is transparent. This is a fit followed by a centre crop, done in one pass.
+	void ReduceFit(tPixel* dst, int boxW, int boxH, const tPixel* src, int srcW, int srcH);
+
+	// Computes the size of the source when fitted inside the box keeping its aspect. Neither result is less than 1.
+	void GetFitSize(int& fitW, int& fitH, int srcW, int srcH, int boxW, int boxH);
+
+	// Picture versions. Reductions with the Box or Bilinear filter use the area average, which is what those filters
+	// are approximating. Other filters, and anything that enlarges, go through tPicture::Resample.
+	void Resample
+	(
+		tImage::tPicture& dst, const tImage::tPicture& src, int width, int height,
+		tImage::tResampleFilter = tImage::tResampleFilter::Bilinear,
+		tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp
+	);
+	void ResampleFit(tImage::tPicture& dst, const tImage::tPicture& src, int boxW, int boxH);
+}
@@ -0,0 +1,683 @@
+// BlockCodec.cpp
+//
+// CPU encoding and decoding of block compressed pixel data. BC1 (DXT1) and BC3 (DXT5) are used to keep cached
+// thumbnails small. Decoding additionally handles BC2 (DXT3) and the uncompressed 16, 24, and 32 bit formats found in
+// DDS files so they can be loaded without an OpenGL context. The decoders are table driven with no per-pixel branches
+// so they run quickly on the worker threads.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <vector>
+#include <Foundation/tFundamentals.h>
+#include "BlockCodec.h"
+#include "WorkerPool.h"
+using namespace tMath;
+using namespace tImage;
+
+
+namespace BlockCodec
+{
+	// Colour endpoints are stored as R5G6B5 with red in the high bits.
+	inline uint16 PackR5G6B5(int r, int g, int b)																		{ return uint16(((r*31 + 127)/255) << 11) | uint16(((g*63 + 127)/255) << 5) | uint16((b*31 + 127)/255); }
+	inline void UnpackR5G6B5(uint16 c, int& r, int& g, int& b)															{ r = (c >> 11) & 0x1F; g = (c >> 5) & 0x3F; b = c & 0x1F; r = (r << 3) | (r >> 2); g = (g << 2) | (g >> 4); b = (b << 3) | (b >> 2); }
+
+	void GatherBlock(tPixel block[16], const tPixel* src, int width, int height, int bx, int by);
+	void BuildColourPalette(tPixel palette[4], uint16 c0, uint16 c1, bool forceFourColour);
+	uint32 ChooseColourIndices(const tPixel block[16], const tPixel palette[4], bool threeColour, int& error);
+	void FitColourEndpoints(const tPixel block[16], bool punchThrough, float end0[3], float end1[3]);
+	void RefineColourEndpoints(const tPixel block[16], uint32 indices, float end0[3], float end1[3]);
+	void EncodeColourBlock(uint8* dst, const tPixel block[16], bool punchThrough);
+	void EncodeAlphaBlock(uint8* dst, const tPixel block[16]);
+	void DecodeColourBlock(tPixel block[16], const uint8* src, bool forceFourColour);
+	void DecodeAlphaBlock(tPixel block[16], const uint8* src);
+	void DecodeExplicitAlphaBlock(tPixel block[16], const uint8* src);
+	void DecodeBlocks(tPixel* dst, tImage::tPixelFormat, const uint8* src, int width, int height);
+	void DecodeLinear(tPixel* dst, tImage::tPixelFormat, const uint8* src, int width, int height);
+
+	// Expands 4, 5, and 6 bit channels to 8 bits by replicating the high bits into the low ones.
+	inline uint8 Expand4(int v)																							{ return uint8((v << 4) | v); }
+	inline uint8 Expand5(int v)																							{ return uint8((v << 3) | (v >> 2)); }
+	inline uint8 Expand6(int v)																							{ return uint8((v << 2) | (v >> 4)); }
+
+	// Images with fewer pixels in total than this are decoded on the calling thread. Bands are sized to be roughly
+	// BandPixels each.
+	const int ParallelThreshold					= 1024*1024;
+	const int BandPixels						= 256*1024;
+}
+
+
+bool BlockCodec::IsSupported(tPixelFormat format)
+{
+	return (format == tPixelFormat::BC1_DXT1) || (format == tPixelFormat::BC1_DXT1BA) || (format == tPixelFormat::BC3_DXT5);
+}
+
+
+bool BlockCodec::CanDecode(tPixelFormat format)
+{
+	return (GetBlockBytes(format) > 0) || (GetPixelBytes(format) > 0);
+}
+
+
+int BlockCodec::GetBlockBytes(tPixelFormat format)
+{
+	switch (format)
+	{
+		case tPixelFormat::BC1_DXT1:
+		case tPixelFormat::BC1_DXT1BA:
+			return 8;
+
+		case tPixelFormat::BC2_DXT3:
+		case tPixelFormat::BC3_DXT5:
+			return 16;
+
+		default:
+			return 0;
+	}
+}
+
+
+int BlockCodec::GetPixelBytes(tPixelFormat format)
+{
+	switch (format)
+	{
+		case tPixelFormat::G3B5R5G3:
+		case tPixelFormat::G4B4A4R4:
+		case tPixelFormat::G3B5A1R5G2:
+			return 2;
+
+		case tPixelFormat::R8G8B8:
+		case tPixelFormat::B8G8R8:
+			return 3;
+
+		case tPixelFormat::R8G8B8A8:
+		case tPixelFormat::B8G8R8A8:
+			return 4;
+
+		default:
+			return 0;
+	}
+}
+
+
+int BlockCodec::GetDataSize(tPixelFormat format, int width, int height)
+{
+	int pixelBytes = GetPixelBytes(format);
+	if (pixelBytes > 0)
+		return width * height * pixelBytes;
+
+	int blocksW = (width + 3) / 4;
+	int blocksH = (height + 3) / 4;
+	return blocksW * blocksH * GetBlockBytes(format);
+}
+
+
+tPixelFormat BlockCodec::ChooseFormat(const tPixel* pixels, int numPixels)
+{
+	bool opaque = true;
+	for (int p = 0; p < numPixels; p++)
+	{
+		uint8 a = pixels[p].A;
+		if ((a != 0) && (a != 255))
+			return tPixelFormat::BC3_DXT5;
+		opaque = opaque && (a == 255);
+	}
+
+	return opaque ? tPixelFormat::BC1_DXT1 : tPixelFormat::BC1_DXT1BA;
+}
+
+
+void BlockCodec::GatherBlock(tPixel block[16], const tPixel* src, int width, int height, int bx, int by)
+{
+	for (int y = 0; y < 4; y++)
+	{
+		int sy = tMin(by*4 + y, height - 1);
+		for (int x = 0; x < 4; x++)
+		{
+			int sx = tMin(bx*4 + x, width - 1);
+			block[y*4 + x] = src[sy*width + sx];
+		}
+	}
+}
+
+
+void BlockCodec::BuildColourPalette(tPixel palette[4], uint16 c0, uint16 c1, bool forceFourColour)
+{
+	int r0, g0, b0, r1, g1, b1;
+	UnpackR5G6B5(c0, r0, g0, b0);
+	UnpackR5G6B5(c1, r1, g1, b1);
+	palette[0].R = r0; palette[0].G = g0; palette[0].B = b0; palette[0].A = 255;
+	palette[1].R = r1; palette[1].G = g1; palette[1].B = b1; palette[1].A = 255;
+
+	if (forceFourColour || (c0 > c1))
+	{
+		palette[2].R = (2*r0 + r1)/3; palette[2].G = (2*g0 + g1)/3; palette[2].B = (2*b0 + b1)/3; palette[2].A = 255;
+		palette[3].R = (r0 + 2*r1)/3; palette[3].G = (g0 + 2*g1)/3; palette[3].B = (b0 + 2*b1)/3; palette[3].A = 255;
+	}
+	else
+	{
+		palette[2].R = (r0 + r1)/2; palette[2].G = (g0 + g1)/2; palette[2].B = (b0 + b1)/2; palette[2].A = 255;
+		palette[3].R = 0; palette[3].G = 0; palette[3].B = 0; palette[3].A = 0;
+	}
+}
+
+
+uint32 BlockCodec::ChooseColourIndices(const tPixel block[16], const tPixel palette[4], bool threeColour, int& error)
+{
+	// In three colour mode index 3 is reserved for transparent pixels and never used for opaque ones.
+	uint32 indices = 0;
+	error = 0;
+	int numCandidates = threeColour ? 3 : 4;
+	for (int p = 0; p < 16; p++)
+	{
+		const tPixel& pixel = block[p];
+		int best = 0;
+		if (threeColour && (pixel.A < 128))
+		{
+			best = 3;
+		}
+		else
+		{
+			int bestErr = 0x7FFFFFFF;
+			for (int c = 0; c < numCandidates; c++)
+			{
+				int dr = int(pixel.R) - int(palette[c].R);
+				int dg = int(pixel.G) - int(palette[c].G);
+				int db = int(pixel.B) - int(palette[c].B);
+				int err = dr*dr + dg*dg + db*db;
+				if (err < bestErr)
+				{
+					bestErr = err;
+					best = c;
+				}
+			}
+			error += bestErr;
+		}
+		indices |= uint32(best) << (p*2);
+	}
+
+	return indices;
+}
+
+
+void BlockCodec::FitColourEndpoints(const tPixel block[16], bool punchThrough, float end0[3], float end1[3])
+{
+	// Fit a line through the colours using their principal axis and take the extents along it. Transparent pixels
+	// don't contribute since their colour is never seen.
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	float minC[3] = { 255.0f, 255.0f, 255.0f };
+	float maxC[3] = { 0.0f, 0.0f, 0.0f };
+	int count = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		if (punchThrough && (block[p].A < 128))
+			continue;
+		float c[3] = { float(block[p].R), float(block[p].G), float(block[p].B) };
+		for (int e = 0; e < 3; e++)
+		{
+			mean[e] += c[e];
+			minC[e] = tMin(minC[e], c[e]);
+			maxC[e] = tMax(maxC[e], c[e]);
+		}
+		count++;
+	}
+
+	if (count == 0)
+	{
+		end0[0] = end0[1] = end0[2] = 0.0f;
+		end1[0] = end1[1] = end1[2] = 0.0f;
+		return;
+	}
+
+	for (int e = 0; e < 3; e++)
+		mean[e] /= float(count);
+
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int p = 0; p < 16; p++)
+	{
+		if (punchThrough && (block[p].A < 128))
+			continue;
+		float r = float(block[p].R) - mean[0];
+		float g = float(block[p].G) - mean[1];
+		float b = float(block[p].B) - mean[2];
+		cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+		cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+	}
+
+	// Power iteration starting from the bounding box diagonal converges in a few steps for 16 points.
+	float axis[3] = { maxC[0] - minC[0], maxC[1] - minC[1], maxC[2] - minC[2] };
+	for (int iter = 0; iter < 4; iter++)
+	{
+		float x = axis[0]*cov[0] + axis[1]*cov[1] + axis[2]*cov[2];
+		float y = axis[0]*cov[1] + axis[1]*cov[3] + axis[2]*cov[4];
+		float z = axis[0]*cov[2] + axis[1]*cov[4] + axis[2]*cov[5];
+		float len = tMax(tMax(tAbs(x), tAbs(y)), tAbs(z));
+		if (len < 1.0e-6f)
+			break;
+		axis[0] = x/len; axis[1] = y/len; axis[2] = z/len;
+	}
+
+	float lenSq = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+	if (lenSq < 1.0e-6f)
+	{
+		for (int e = 0; e < 3; e++)
+			end0[e] = end1[e] = mean[e];
+		return;
+	}
+
+	float minT = 1.0e30f, maxT = -1.0e30f;
+	for (int p = 0; p < 16; p++)
+	{
+		if (punchThrough && (block[p].A < 128))
+			continue;
+		float t =
+			(float(block[p].R) - mean[0])*axis[0] +
+			(float(block[p].G) - mean[1])*axis[1] +
+			(float(block[p].B) - mean[2])*axis[2];
+		minT = tMin(minT, t);
+		maxT = tMax(maxT, t);
+	}
+
+	// Pull the ends in slightly. The extremes are usually single outliers and the interpolated colours do better
+	// covering the bulk of the block.
+	float inset = (maxT - minT) / 16.0f;
+	minT = (minT + inset) / lenSq;
+	maxT = (maxT - inset) / lenSq;
+	for (int e = 0; e < 3; e++)
+	{
+		end0[e] = tClamp(mean[e] + axis[e]*maxT, 0.0f, 255.0f);
+		end1[e] = tClamp(mean[e] + axis[e]*minT, 0.0f, 255.0f);
+	}
+}
+
+
+void BlockCodec::RefineColourEndpoints(const tPixel block[16], uint32 indices, float end0[3], float end1[3])
+{
+	// Least squares solve for the two endpoints given the four colour mode weights of the chosen indices.
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f };
+	float bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (int p = 0; p < 16; p++)
+	{
+		float a = weights[(indices >> (p*2)) & 3];
+		float b = 1.0f - a;
+		float c[3] = { float(block[p].R), float(block[p].G), float(block[p].B) };
+		aa += a*a; bb += b*b; ab += a*b;
+		for (int e = 0; e < 3; e++)
+		{
+			ax[e] += a*c[e];
+			bx[e] += b*c[e];
+		}
+	}
+
+	float det = aa*bb - ab*ab;
+	if (tAbs(det) < 1.0e-6f)
+		return;
+
+	float invDet = 1.0f / det;
+	for (int e = 0; e < 3; e++)
+	{
+		end0[e] = tClamp((ax[e]*bb - bx[e]*ab) * invDet, 0.0f, 255.0f);
+		end1[e] = tClamp((bx[e]*aa - ax[e]*ab) * invDet, 0.0f, 255.0f);
+	}
+}
+
+
+void BlockCodec::EncodeColourBlock(uint8* dst, const tPixel block[16], bool punchThrough)
+{
+	bool anyTransparent = false;
+	if (punchThrough)
+		for (int p = 0; p < 16; p++)
+			anyTransparent = anyTransparent || (block[p].A < 128);
+
+	float end0[3], end1[3];
+	FitColourEndpoints(block, anyTransparent, end0, end1);
+	uint16 c0 = PackR5G6B5(int(end0[0] + 0.5f), int(end0[1] + 0.5f), int(end0[2] + 0.5f));
+	uint16 c1 = PackR5G6B5(int(end1[0] + 0.5f), int(end1[1] + 0.5f), int(end1[2] + 0.5f));
+
+	// Three colour mode is selected by c0 <= c1. It is only used when the block has transparent pixels.
+	tPixel palette[4];
+	uint32 indices = 0;
+	if (anyTransparent)
+	{
+		if (c0 > c1)
+			tStd::tSwap(c0, c1);
+		BuildColourPalette(palette, c0, c1, false);
+		int error;
+		indices = ChooseColourIndices(block, palette, true, error);
+	}
+	else
+	{
+		if (c0 < c1)
+			tStd::tSwap(c0, c1);
+		BuildColourPalette(palette, c0, c1, true);
+		int error;
+		indices = ChooseColourIndices(block, palette, c0 == c1, error);
+
+		// One refinement pass. Keep it only if it helps.
+		if (c0 != c1)
+		{
+			RefineColourEndpoints(block, indices, end0, end1);
+			uint16 r0 = PackR5G6B5(int(end0[0] + 0.5f), int(end0[1] + 0.5f), int(end0[2] + 0.5f));
+			uint16 r1 = PackR5G6B5(int(end1[0] + 0.5f), int(end1[1] + 0.5f), int(end1[2] + 0.5f));
+			if (r0 < r1)
+				tStd::tSwap(r0, r1);
+			if (r0 != r1)
+			{
+				tPixel refined[4];
+				BuildColourPalette(refined, r0, r1, true);
+				int refinedError;
+				uint32 refinedIndices = ChooseColourIndices(block, refined, false, refinedError);
+				if (refinedError < error)
+				{
+					c0 = r0;
+					c1 = r1;
+					indices = refinedIndices;
+				}
+			}
+		}
+	}
+
+	dst[0] = uint8(c0 & 0xFF); dst[1] = uint8(c0 >> 8);
+	dst[2] = uint8(c1 & 0xFF); dst[3] = uint8(c1 >> 8);
+	dst[4] = uint8(indices); dst[5] = uint8(indices >> 8); dst[6] = uint8(indices >> 16); dst[7] = uint8(indices >> 24);
+}
+
+
+void BlockCodec::EncodeAlphaBlock(uint8* dst, const tPixel block[16])
+{
+	int minA = 255, maxA = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		minA = tMin(minA, int(block[p].A));
+		maxA = tMax(maxA, int(block[p].A));
+	}
+
+	// Eight value mode (a0 > a1). Index 0 is a0, 1 is a1, and 2 to 7 step from a0 towards a1.
+	dst[0] = uint8(maxA);
+	dst[1] = uint8(minA);
+	uint64 bits = 0;
+	int range = maxA - minA;
+	if (range > 0)
+	{
+		for (int p = 0; p < 16; p++)
+		{
+			int t = ((int(block[p].A) - minA)*7 + range/2) / range;
+			int index = (t == 7) ? 0 : ((t == 0) ? 1 : (8 - t));
+			bits |= uint64(index) << (p*3);
+		}
+	}
+
+	for (int b = 0; b < 6; b++)
+		dst[2 + b] = uint8(bits >> (b*8));
+}
+
+
+void BlockCodec::DecodeColourBlock(tPixel block[16], const uint8* src, bool forceFourColour)
+{
+	uint16 c0 = uint16(src[0]) | (uint16(src[1]) << 8);
+	uint16 c1 = uint16(src[2]) | (uint16(src[3]) << 8);
+	uint32 indices = uint32(src[4]) | (uint32(src[5]) << 8) | (uint32(src[6]) << 16) | (uint32(src[7]) << 24);
+
+	tPixel palette[4];
+	BuildColourPalette(palette, c0, c1, forceFourColour);
+	for (int p = 0; p < 16; p++)
+		block[p] = palette[(indices >> (p*2)) & 3];
+}
+
+
+void BlockCodec::DecodeAlphaBlock(tPixel block[16], const uint8* src)
+{
+	int a0 = src[0];
+	int a1 = src[1];
+	uint8 palette[8];
+	palette[0] = uint8(a0);
+	palette[1] = uint8(a1);
+	if (a0 > a1)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i+1] = uint8(((7-i)*a0 + i*a1) / 7);
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			palette[i+1] = uint8(((5-i)*a0 + i*a1) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64 bits = 0;
+	for (int b = 0; b < 6; b++)
+		bits |= uint64(src[2 + b]) << (b*8);
+
+	for (int p = 0; p < 16; p++)
+		block[p].A = palette[(bits >> (p*3)) & 7];
+}
+
+
+bool BlockCodec::Encode(uint8* dst, tPixelFormat format, const tPixel* src, int width, int height)
+{
+	if (!IsSupported(format) || !dst || !src || (width <= 0) || (height <= 0))
+		return false;
+
+	int blocksW = (width + 3) / 4;
+	int blocksH = (height + 3) / 4;
+	int blockBytes = GetBlockBytes(format);
+	tPixel block[16];
+	for (int by = 0; by < blocksH; by++)
+	{
+		for (int bx = 0; bx < blocksW; bx++)
+		{
+			GatherBlock(block, src, width, height, bx, by);
+			uint8* out = dst + (by*blocksW + bx)*blockBytes;
+			switch (format)
+			{
+				case tPixelFormat::BC1_DXT1:
+					EncodeColourBlock(out, block, false);
+					break;
+
+				case tPixelFormat::BC1_DXT1BA:
+					EncodeColourBlock(out, block, true);
+					break;
+
+				case tPixelFormat::BC3_DXT5:
+					EncodeAlphaBlock(out, block);
+					EncodeColourBlock(out + 8, block, false);
+					break;
+
+				default:
+					break;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+void BlockCodec::DecodeExplicitAlphaBlock(tPixel block[16], const uint8* src)
+{
+	// BC2 stores a plain 4 bit alpha per pixel, two pixels per byte with the first in the low nibble.
+	for (int p = 0; p < 16; p++)
+		block[p].A = Expand4((src[p >> 1] >> ((p & 1)*4)) & 0x0F);
+}
+
+
+void BlockCodec::DecodeBlocks(tPixel* dst, tPixelFormat format, const uint8* src, int width, int height)
+{
+	int blocksW = (width + 3) / 4;
+	int blocksH = (height + 3) / 4;
+	int blockBytes = GetBlockBytes(format);
+	tPixel block[16];
+	for (int by = 0; by < blocksH; by++)
+	{
+		for (int bx = 0; bx < blocksW; bx++)
+		{
+			const uint8* in = src + (by*blocksW + bx)*blockBytes;
+			switch (format)
+			{
+				case tPixelFormat::BC1_DXT1:
+					// Without alpha the fourth colour of three colour mode is opaque black.
+					DecodeColourBlock(block, in, false);
+					for (int p = 0; p < 16; p++)
+						block[p].A = 255;
+					break;
+
+				case tPixelFormat::BC1_DXT1BA:
+					DecodeColourBlock(block, in, false);
+					break;
+
+				case tPixelFormat::BC2_DXT3:
+					DecodeColourBlock(block, in + 8, true);
+					DecodeExplicitAlphaBlock(block, in);
+					break;
+
+				case tPixelFormat::BC3_DXT5:
+					DecodeColourBlock(block, in + 8, true);
+					DecodeAlphaBlock(block, in);
+					break;
+
+				default:
+					break;
+			}
+
+			// Only the edge blocks need clipping.
+			int numX = tMin(4, width - bx*4);
+			int numY = tMin(4, height - by*4);
+			for (int y = 0; y < numY; y++)
+				for (int x = 0; x < numX; x++)
+					dst[(by*4 + y)*width + bx*4 + x] = block[y*4 + x];
+		}
+	}
+}
+
+
+void BlockCodec::DecodeLinear(tPixel* dst, tPixelFormat format, const uint8* src, int width, int height)
+{
+	// The 16 bit formats are little endian words. The names list the bits of the two bytes in memory order, so
+	// G3B5R5G3 is R5G6B5 with red in the high bits, and G3B5A1R5G2 and G4B4A4R4 are A1R5G5B5 and A4R4G4B4.
+	int numPixels = width * height;
+	switch (format)
+	{
+		case tPixelFormat::R8G8B8:
+			for (int p = 0; p < numPixels; p++, src += 3)
+			{
+				dst[p].R = src[0]; dst[p].G = src[1]; dst[p].B = src[2]; dst[p].A = 255;
+			}
+			break;
+
+		case tPixelFormat::R8G8B8A8:
+			tStd::tMemcpy(dst, src, numPixels*4);
+			break;
+
+		case tPixelFormat::B8G8R8:
+			for (int p = 0; p < numPixels; p++, src += 3)
+			{
+				dst[p].R = src[2]; dst[p].G = src[1]; dst[p].B = src[0]; dst[p].A = 255;
+			}
+			break;
+
+		case tPixelFormat::B8G8R8A8:
+			for (int p = 0; p < numPixels; p++, src += 4)
+			{
+				dst[p].R = src[2]; dst[p].G = src[1]; dst[p].B = src[0]; dst[p].A = src[3];
+			}
+			break;
+
+		case tPixelFormat::G3B5R5G3:
+			for (int p = 0; p < numPixels; p++, src += 2)
+			{
+				int c = int(src[0]) | (int(src[1]) << 8);
+				dst[p].R = Expand5((c >> 11) & 0x1F); dst[p].G = Expand6((c >> 5) & 0x3F); dst[p].B = Expand5(c & 0x1F); dst[p].A = 255;
+			}
+			break;
+
+		case tPixelFormat::G4B4A4R4:
+			for (int p = 0; p < numPixels; p++, src += 2)
+			{
+				int c = int(src[0]) | (int(src[1]) << 8);
+				dst[p].R = Expand4((c >> 8) & 0x0F); dst[p].G = Expand4((c >> 4) & 0x0F); dst[p].B = Expand4(c & 0x0F); dst[p].A = Expand4(c >> 12);
+			}
+			break;
+
+		case tPixelFormat::G3B5A1R5G2:
+			for (int p = 0; p < numPixels; p++, src += 2)
+			{
+				int c = int(src[0]) | (int(src[1]) << 8);
+				dst[p].R = Expand5((c >> 10) & 0x1F); dst[p].G = Expand5((c >> 5) & 0x1F); dst[p].B = Expand5(c & 0x1F); dst[p].A = (c & 0x8000) ? 255 : 0;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+bool BlockCodec::Decode(tPixel* dst, tPixelFormat format, const uint8* src, int width, int height)
+{
+	if (!CanDecode(format) || !dst || !src || (width <= 0) || (height <= 0))
+		return false;
+
+	if (GetBlockBytes(format) > 0)
+		DecodeBlocks(dst, format, src, width, height);
+	else
+		DecodeLinear(dst, format, src, width, height);
+
+	return true;
+}
+
+
+bool BlockCodec::DecodeMany(const DecodeItem* items, int numItems)
+{
+	struct Band
+	{
+		const DecodeItem* Item;
+		int Row;
+		int NumRows;
+	};
+
+	// Bands start on block boundaries so each one is a self contained image. Band data offsets are just the data size
+	// of the rows above them.
+	std::vector<Band> bands;
+	int64 totalPixels = 0;
+	for (int i = 0; i < numItems; i++)
+	{
+		const DecodeItem& item = items[i];
+		if (!CanDecode(item.Format) || !item.Dst || !item.Src || (item.Width <= 0) || (item.Height <= 0))
+			return false;
+
+		int bandRows = tMax((BandPixels / item.Width) & ~3, 4);
+		for (int row = 0; row < item.Height; row += bandRows)
+			bands.push_back({ &item, row, tMin(bandRows, item.Height - row) });
+		totalPixels += int64(item.Width) * int64(item.Height);
+	}
+
+	auto decodeBand = [](const Band& band)
+	{
+		const DecodeItem& item = *band.Item;
+		Decode
+		(
+			item.Dst + band.Row*item.Width, item.Format, item.Src + GetDataSize(item.Format, item.Width, band.Row),
+			item.Width, band.NumRows
+		);
+	};
+
+	if (totalPixels < ParallelThreshold)
+	{
+		for (const Band& band : bands)
+			decodeBand(band);
+		return true;
+	}
+
+	Viewer::ParallelFor(int(bands.size()), [&bands, &decodeBand](int b) { decodeBand(bands[b]); });
+	return true;
+}
@@ -0,0 +1,59 @@
+// BlockCodec.h
+//
+// CPU encoding and decoding of block compressed pixel data. BC1 (DXT1) and BC3 (DXT5) are used to keep cached
+// thumbnails small. Decoding additionally handles BC2 (DXT3) and the uncompressed 16, 24, and 32 bit formats found in
+// DDS files so they can be loaded without an OpenGL context. The decoders are table driven with no per-pixel branches
+// so they run quickly on the worker threads.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+#include <Image/tPixelFormat.h>
+#include <Math/tColour.h>
+namespace BlockCodec
+{
+	// Supported formats are BC1_DXT1 (opaque), BC1_DXT1BA (binary alpha), and BC3_DXT5 (full alpha). Widths and
+	// heights need not be multiples of 4. Edge blocks are padded by repeating the last row and column.
+	bool IsSupported(tImage::tPixelFormat);
+
+	// True for every supported format plus BC2_DXT3, R8G8B8, R8G8B8A8, B8G8R8, B8G8R8A8, G3B5R5G3 (565),
+	// G4B4A4R4 (4444), and G3B5A1R5G2 (1555). These are the formats the viewer can upload to OpenGL.
+	bool CanDecode(tImage::tPixelFormat);
+	int GetBlockBytes(tImage::tPixelFormat);								// 8 for BC1. 16 for BC2 and BC3. 0 otherwise.
+	int GetPixelBytes(tImage::tPixelFormat);								// 2, 3, or 4 for uncompressed. 0 otherwise.
+	int GetDataSize(tImage::tPixelFormat, int width, int height);
+
+	// Chooses the smallest format that represents the alpha of the supplied pixels. BC1_DXT1 if fully opaque,
+	// BC1_DXT1BA if every alpha is 0 or 255, and BC3_DXT5 otherwise.
+	tImage::tPixelFormat ChooseFormat(const tPixel* pixels, int numPixels);
+
+	// The destination must have room for GetDataSize bytes. Returns false for unsupported formats.
+	bool Encode(uint8* dst, tImage::tPixelFormat, const tPixel* src, int width, int height);
+
+	// The destination must have room for width*height pixels. Returns false for formats that can't be decoded. The
+	// pixel rows come out in the same order as the source rows, which is the order glGetTexImage returns them in.
+	bool Decode(tPixel* dst, tImage::tPixelFormat, const uint8* src, int width, int height);
+
+	struct DecodeItem
+	{
+		tPixel* Dst;
+		tImage::tPixelFormat Format;
+		const uint8* Src;
+		int Width;
+		int Height;
+	};
+
+	// Decodes a set of images, such as the mipmaps or cube faces of a DDS file. Large images are split into bands of
+	// block rows and the bands are spread over all cores. Returns false if any format can't be decoded, in which
+	// case nothing is written.
+	bool DecodeMany(const DecodeItem*, int numItems);
+}
@@ -18,6 +18,7 @@
 #include "OpenSaveDialogs.h"
 #include "TacentView.h"
 #include "Image.h"
+#include "AreaResample.h"
 using namespace tStd;
 using namespace tMath;
 using namespace tSystem;
@@ -251,20 +252,16 @@ void Viewer::SaveContactSheetTo
 
 		tImage::tPicture resampled;
 		if ((currImg->GetWidth() != frameWidth) || (currImg->GetHeight() != frameHeight))
-		{
-			resampled.Set(*currPic);
-			resampled.Resample(frameWidth, frameHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
-		}
+			AreaResample::Resample(resampled, *currPic, frameWidth, frameHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
 
-		// Copy resampled frame into place.
+		// Copy resampled frame into place a row at a time.
+		const tImage::tPicture* srcPic = resampled.IsValid() ? &resampled : currPic;
 		for (int y = 0; y < frameHeight; y++)
-			for (int x = 0; x < frameWidth; x++)
-				outPic.SetPixel
-				(
-					x + (ix*frameWidth),
-					y + ((numRows-1-iy)*frameHeight),
-					resampled.IsValid() ? resampled.GetPixel(x, y) : currPic->GetPixel(x, y)
-				);
+			tStd::tMemcpy
+			(
+				outPic.GetPixelPointer(ix*frameWidth, y + ((numRows-1-iy)*frameHeight)),
+				srcPic->GetPixelPointer(0, y), frameWidth*sizeof(tPixel)
+			);
 
 		currImg = currImg->Next();
 
@@ -289,20 +286,19 @@ void Viewer::SaveContactSheetTo
 	}
 	else
 	{
-		tImage::tPicture finalResampled(outPic);
-		finalResampled.Resample(finalWidth, finalHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+		// Resampled in place. The sheet isn't needed at its original size after this.
+		AreaResample::Resample(outPic, outPic, finalWidth, finalHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
 
 		if (Config.SaveFileType == 0)
-			finalResampled.SaveTGA(outFile, tgaFmt, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
+			outPic.SaveTGA(outFile, tgaFmt, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
 		else
-			finalResampled.Save(outFile, colourFmt, Config.SaveFileJpegQuality);
+			outPic.Save(outFile, colourFmt, Config.SaveFileJpegQuality);
 	}
 
 	// If we saved to the same dir we are currently viewing, reload
 	// and set the current image to the generated one.
 	if (ImagesDir.IsEqualCI( tGetDir(outFile) ))
 	{
-		Images.Clear();
 		PopulateImages();
 		SetCurrentImage(outFile);
 	}
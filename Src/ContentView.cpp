@@ -12,6 +12,7 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <vector>
 #include <System/tTime.h>
 #include <Math/tVector2.h>
 #include "imgui.h"
@@ -47,90 +48,164 @@ void Viewer::ShowContentViewDialog(bool* popen)
 	float extra = ImGui::GetWindowContentRegionMax().x - (float(numPerRow) * (Config.ThumbnailWidth + minSpacing));
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, tVector2(minSpacing + extra/float(numPerRow), minSpacing));
 	tVector2 thumbButtonSize(Config.ThumbnailWidth, Config.ThumbnailWidth*9.0f/16.0f); // 64 36, 32 18,
-	int thumbNum = 0;
-	int numGeneratedThumbs = 0;
+	float rowHeight = thumbButtonSize.y + 32.0f + minSpacing;
+
+	// Only the thumbnail level that best matches the size on screen, in framebuffer pixels, is requested.
+	int thumbLevel = Image::GetThumbLevel(Config.ThumbnailWidth * ImGui::GetIO().DisplayFramebufferScale.x);
+
+	// Images is a linked list so we keep a table of pointers to find the images in a row without walking the list. It
+	// is only rebuilt when the list changes. The range of images with outstanding thumbnail requests is forgotten at
+	// the same time since the images it refers to may be gone.
+	static std::vector<Image*> imageTable;
+	static uint64 imageTableGeneration = 0;
+	static int requestedBegin = 0;
+	static int requestedEnd = 0;
+	static int numGeneratedThumbs = 0;
 	static int numThumbsWhenSorted = 0;
-	for (Image* i = Images.First(); i; i = i->Next(), thumbNum++)
+	bool tableRebuilt = false;
+	if (imageTableGeneration != ImagesGeneration)
+	{
+		imageTable.clear();
+		imageTable.reserve(Images.GetNumItems());
+		for (Image* i = Images.First(); i; i = i->Next())
+			imageTable.push_back(i);
+		imageTableGeneration = ImagesGeneration;
+		requestedBegin = requestedEnd = 0;
+		tableRebuilt = true;
+	}
+	int numImages = int(imageTable.size());
+
+	// Counting finished thumbnails touches every image so it's only done every few frames.
+	if (tableRebuilt || (ImGui::GetFrameCount() % 16) == 0)
+	{
+		numGeneratedThumbs = 0;
+		for (Image* i : imageTable)
+			if (i->IsThumbnailAvailable())
+				numGeneratedThumbs++;
+	}
+
+	// The clipper positions the cursor at the first visible row so we only submit widgets for rows on screen. The
+	// cost per frame no longer depends on the number of images in the folder.
+	int numRows = (numImages + numPerRow - 1) / numPerRow;
+	int visibleBegin = numRows;
+	int visibleEnd = 0;
+	ImGuiListClipper clipper;
+	clipper.Begin(numRows, rowHeight);
+	while (clipper.Step())
 	{
-		tVector2 cursor = ImGui::GetCursorPos();
-		if ((thumbNum % numPerRow) == 0)
-			ImGui::SetCursorPos(tVector2(0.5f*extra/float(numPerRow), cursor.y));
-
-		ImGui::PushID(thumbNum);
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, tVector2::zero);
-		bool isCurr = (i == CurrImage);
-
-		// It's ok to call bind even if a request has not been made yet. Takes no time.
-		// Calling bind also frees up the worker threads when requests are fulfilled.
-		uint64 thumbnailTexID = i->BindThumbnail();
-		if (thumbnailTexID)
-			numGeneratedThumbs++;
-
-		// Unlike other widgets, BeginChild ALWAYS needs a corresponding EndChild, even if it's invisible.
-		bool visible = ImGui::BeginChild("ThumbItem", thumbButtonSize+tVector2(0.0, 32.0f), false, ImGuiWindowFlags_NoDecoration);
-		int maxNonVisibleThumbThreads = 3;
-		if (visible)
+		visibleBegin = tMin(visibleBegin, clipper.DisplayStart);
+		visibleEnd = tMax(visibleEnd, clipper.DisplayEnd);
+		for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
 		{
-			// Give priority to creating thumbnails for visible widgets. Later on, if no threads are active
-			// we request non-visible ones.
-			i->RequestThumbnail();
-			if (!thumbnailTexID)
-				thumbnailTexID = DefaultThumbnailImage.Bind();
-			if
-			(
-				thumbnailTexID &&
-				ImGui::ImageButton(ImTextureID(thumbnailTexID), thumbButtonSize, tVector2(0,1), tVector2(1,0), 0,
-				ColourBG, ColourEnabledTint)
-			)
+			for (int col = 0; col < numPerRow; col++)
 			{
-				CurrImage = i;
-				LoadCurrImage();
-			}
+				int thumbNum = row*numPerRow + col;
+				if (thumbNum >= numImages)
+					break;
 
-			tString filename = tSystem::tGetFileName(i->Filename);
-			ImGui::Text(filename.Chars());
-
-			tString ttStr;
-			if (i->CachePrimaryWidth && i->CachePrimaryHeight)
-				tsPrintf
-				(
-					ttStr, "%s\n%s\n%'d Bytes\nW:%'d\nH:%'d\nArea:%'d",
-					filename.Chars(),
-					tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(),
-					i->FileSizeB,
-					i->CachePrimaryWidth,
-					i->CachePrimaryHeight,
-					i->CachePrimaryArea
-				);
-			else
-				tsPrintf
-				(
-					ttStr, "%s\n%s\n%'d Bytes",
-					filename.Chars(),
-					tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(),
-					i->FileSizeB
-				);
-
-			ShowToolTip(ttStr.Chars());
-
-			// We use a separator to indicate the current item.
-			if (isCurr)
-				ImGui::Separator(2.0f);
-		}
+				Image* i = imageTable[thumbNum];
+				if (col == 0)
+					ImGui::SetCursorPos(tVector2(0.5f*extra/float(numPerRow), ImGui::GetCursorPos().y));
 
-		// Not visible. If we're not doing much, request non-visible thumbnail generation. For the
-		// offscreen ones we only do maxNonVisibleThumbThreads at a time.
-		else if (Image::GetThumbnailNumThreadsRunning() < maxNonVisibleThumbThreads)
-			i->RequestThumbnail();
+				ImGui::PushID(thumbNum);
+				ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, tVector2::zero);
+				bool isCurr = (i == CurrImage);
 
-		ImGui::EndChild();
-		ImGui::PopStyleVar();
+				// Unlike other widgets, BeginChild ALWAYS needs a corresponding EndChild, even if it's invisible.
+				bool visible = ImGui::BeginChild("ThumbItem", thumbButtonSize+tVector2(0.0, 32.0f), false, ImGuiWindowFlags_NoDecoration);
+				if (visible)
+				{
+					// Visible widgets get the highest priority lane. If the job for this item was queued while it
+					// was offscreen, this moves it ahead of the offscreen ones.
+					i->RequestThumbnail(WorkerPool::Priority::Visible, thumbLevel);
 
-		if ((thumbNum+1) % numPerRow)
-			ImGui::SameLine();
+					// It's ok to call bind even if a request has not been made yet. Takes no time. Thumbnails live
+					// in a few shared atlas textures so most buttons draw from the same texture. Only visible ones
+					// are bound so the rest age out of the atlas.
+					ThumbnailAtlas::Region region;
+					if (!i->BindThumbnail(region))
+						region.TexID = DefaultThumbnailImage.Bind();
+					if
+					(
+						region.TexID &&
+						ImGui::ImageButton(ImTextureID(region.TexID), thumbButtonSize, tVector2(region.U0, region.V1),
+						tVector2(region.U1, region.V0), 0, ColourBG, ColourEnabledTint)
+					)
+					{
+						CurrImage = i;
+						LoadCurrImage();
+					}
+
+					tString filename = tSystem::tGetFileName(i->Filename);
+					ImGui::Text(filename.Chars());
 
-		ImGui::PopID();
+					// The tooltip string is only built for the hovered item.
+					if (ImGui::IsItemHovered())
+					{
+						tString ttStr;
+						if (i->CachePrimaryWidth && i->CachePrimaryHeight)
+							tsPrintf
+							(
+								ttStr, "%s\n%s\n%'d Bytes\nW:%'d\nH:%'d\nArea:%'d",
+								filename.Chars(),
+								tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(),
+								i->FileSizeB,
+								i->CachePrimaryWidth,
+								i->CachePrimaryHeight,
+								i->CachePrimaryArea
+							);
+						else
+							tsPrintf
+							(
+								ttStr, "%s\n%s\n%'d Bytes",
+								filename.Chars(),
+								tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(),
+								i->FileSizeB
+							);
+
+						ShowToolTip(ttStr.Chars());
+					}
+
+					// We use a separator to indicate the current item.
+					if (isCurr)
+						ImGui::Separator(2.0f);
+				}
+
+				// Not visible. Offscreen requests are only serviced when there is no visible work left. If the user
+				// scrolled away before a visible job started it gets demoted here.
+				else
+					i->RequestThumbnail(WorkerPool::Priority::Offscreen, thumbLevel);
+
+				ImGui::EndChild();
+				ImGui::PopStyleVar();
+
+				// The last item in a row must not call SameLine so the cursor moves down by exactly one row height.
+				if ((col+1 < numPerRow) && (thumbNum+1 < numImages))
+					ImGui::SameLine();
+
+				ImGui::PopID();
+			}
+		}
 	}
+	if (visibleBegin > visibleEnd)
+		visibleBegin = visibleEnd;
+
+	// Rows a screen above and below the visible ones are prefetched at offscreen priority so they're usually ready by
+	// the time they scroll into view. Anything that falls out of this range has its request cancelled if it's still
+	// queued so the workers aren't busy with thumbnails nobody is going to see.
+	int prefetchRows = tMax(visibleEnd - visibleBegin, 1);
+	int newBegin = tClampMin(visibleBegin - prefetchRows, 0) * numPerRow;
+	int newEnd = tMin((visibleEnd + prefetchRows) * numPerRow, numImages);
+	for (int t = newBegin; t < newEnd; t++)
+		if ((t < visibleBegin*numPerRow) || (t >= visibleEnd*numPerRow))
+			imageTable[t]->RequestThumbnail(WorkerPool::Priority::Offscreen, thumbLevel);
+
+	for (int t = requestedBegin; t < requestedEnd; t++)
+		if ((t < newBegin) || (t >= newEnd))
+			imageTable[t]->UnrequestThumbnail();
+	requestedBegin = newBegin;
+	requestedEnd = newEnd;
+
 	ImGui::PopStyleVar();
 	ImGui::EndChild();
 
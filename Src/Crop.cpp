@@ -273,7 +273,7 @@ void Viewer::CropWidget::DrawHandles()
 
 void Viewer::ShowCropPopup(const tVector4& lrtb, const tVector2& uvmarg, const tVector2& uvoffset)
 {
-	if (!CurrImage)
+	if (!CurrImage || !CurrImage->IsLoaded())
 	{
 		CropMode = false;
 		return;
@@ -0,0 +1,31 @@
+// FrameCodec.h
+//
+// Fast lossless compression of RGBA frames. Used to keep the frames of long animations in memory at a fraction of
+// their decoded size so only the few around the one being shown need to be decoded. Each frame is compressed on its
+// own so any frame can be decoded without the others. The scheme is a byte-oriented run, palette, and small-delta
+// coder in the style of QOI. It gets most of the way to a general purpose compressor on typical animations and both
+// directions run at several hundred megabytes a second on one core.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Math/tColour.h>
+namespace FrameCodec
+{
+	// Replaces the contents of dst with the compressed pixels. The pixel count is not stored, the caller keeps it.
+	void Encode(std::vector<uint8>& dst, const tPixel* src, int numPixels);
+
+	// The destination must have room for numPixels pixels. Returns false if the data is damaged or does not hold
+	// exactly numPixels pixels, in which case the destination contents are undefined.
+	bool Decode(tPixel* dst, int numPixels, const uint8* src, int64 numBytes);
+}
@@ -13,32 +13,124 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #include <mutex>
+#include <new>
 #include <chrono>
+#include <cctype>
 #include <glad/glad.h>
-#include <GLFW/glfw3.h>				// Include glfw3.h after our OpenGL definitions.
 #include <Foundation/tHash.h>
 #include <Foundation/tFundamentals.h>
 #include <Image/tTexture.h>
 #include <System/tFile.h>
 #include <System/tTime.h>
 #include <System/tMachine.h>
-#include <System/tChunk.h>
 #include "Image.h"
 #include "Settings.h"
+#include "ThumbnailCache.h"
+#include "BlockCodec.h"
+#include "AreaResample.h"
+#include "MappedFile.h"
+#include "FrameCodec.h"
+#include "LoadStats.h"
+
+// Tacent decodes jpg, webp, tiff and exr with these libraries. CMake defines the VIEWER_ flags below for the ones it
+// finds in Tacent's Image module, so the headers and libraries are the ones Tacent builds. With them jpg and webp can
+// be decoded at a reduced size, the pages of a tiff are decoded in parallel, and exr files keep their linear pixels
+// for Retonemap. Otherwise Load always uses the Tacent loaders.
+#ifdef VIEWER_SCALED_JPG
+#include <turbojpeg.h>
+#endif
+#ifdef VIEWER_SCALED_WEBP
+#include <webp/decode.h>
+#endif
+#ifdef VIEWER_PARALLEL_TIFF
+#include <tiffio.h>
+#endif
+#ifdef VIEWER_LINEAR_EXR
+#include <ImfRgbaFile.h>
+#include <ImfMultiPartInputFile.h>
+#endif
 using namespace tStd;
 using namespace tSystem;
 using namespace tImage;
 using namespace tMath;
 using namespace Viewer;
-int Image::ThumbnailNumThreadsRunning = 0;
 tString Image::ThumbCacheDir;
 namespace Viewer { extern Settings Config; }
 
 
 const uint32 Image::ThumbChunkInfoID	= 0x0B000000;
-const int Image::ThumbWidth				= 256;
-const int Image::ThumbHeight			= 144;
+const int Image::ThumbWidth				= 512;
+const int Image::ThumbHeight			= 288;
 const int Image::ThumbMinDispWidth		= 64;
+const int Image::ThumbLevelWidths[Image::NumThumbLevels] = { 64, 128, 256, 512 };
+
+
+namespace Viewer
+{
+	// A thumbnail record in the thumbnail cache is this header followed immediately by the pixel data. The header is
+	// never compressed so the primary dimensions can be read without decoding anything.
+	struct ThumbRecordHeader
+	{
+		uint32 ChunkID;				// Always Image::ThumbChunkInfoID.
+		int32 PrimaryWidth;
+		int32 PrimaryHeight;
+		int32 PrimaryArea;
+		int32 Width;
+		int32 Height;
+		uint32 PixelFormat;			// A tPixelFormat. BC1 or BC3 block compressed.
+		uint32 DataSize;
+	};
+
+	#ifdef VIEWER_PARALLEL_TIFF
+	// Lets libtiff read straight from the file mapping. Every thread opens its own handle on its own stream since a
+	// TIFF handle can only be used by one thread. The map procs mean strips are read in place rather than copied.
+	struct TIFFStream
+	{
+		const uint8* Data;
+		int64 Size;
+		int64 Pos;
+	};
+
+	tmsize_t TIFFStreamRead(thandle_t handle, void* dst, tmsize_t numBytes)
+	{
+		TIFFStream& stream = *(TIFFStream*)handle;
+		int64 num = tMath::tClamp(int64(numBytes), int64(0), stream.Size - stream.Pos);
+		tStd::tMemcpy(dst, stream.Data + stream.Pos, int(num));
+		stream.Pos += num;
+		return tmsize_t(num);
+	}
+
+	tmsize_t TIFFStreamWrite(thandle_t, void*, tmsize_t)																{ return 0; }
+	int TIFFStreamClose(thandle_t)																						{ return 0; }
+	toff_t TIFFStreamSize(thandle_t handle)																				{ return toff_t(((TIFFStream*)handle)->Size); }
+	void TIFFStreamUnmap(thandle_t, void*, toff_t)																		{ }
+
+	toff_t TIFFStreamSeek(thandle_t handle, toff_t offset, int whence)
+	{
+		TIFFStream& stream = *(TIFFStream*)handle;
+		int64 base = (whence == SEEK_CUR) ? stream.Pos : ((whence == SEEK_END) ? stream.Size : 0);
+		stream.Pos = tMath::tClamp(base + int64(offset), int64(0), stream.Size);
+		return toff_t(stream.Pos);
+	}
+
+	int TIFFStreamMap(thandle_t handle, void** base, toff_t* size)
+	{
+		TIFFStream& stream = *(TIFFStream*)handle;
+		*base = (void*)stream.Data;
+		*size = toff_t(stream.Size);
+		return 1;
+	}
+
+	TIFF* OpenTIFFStream(TIFFStream& stream)
+	{
+		return TIFFClientOpen
+		(
+			"Viewer", "r", thandle_t(&stream),
+			TIFFStreamRead, TIFFStreamWrite, TIFFStreamSeek, TIFFStreamClose, TIFFStreamSize, TIFFStreamMap, TIFFStreamUnmap
+		);
+	}
+	#endif
+}
 
 
 Image::Image() :
@@ -82,21 +174,18 @@ Image::Image(const tSystem::tFileInfo& fileInfo) :
 
 Image::~Image()
 {
-	// If we're being destroyed before the thumbnail thread is done, we have to wait because that thread
-	// accesses the thumbnail picture of this object... so 'this' must be valid.
-	if (ThumbnailThread.joinable())
-		ThumbnailThread.join();
+	// If we're being destroyed before the thumbnail job is done we cancel it. If it's already running we have to wait
+	// because the job accesses the thumbnail picture of this object... so 'this' must be valid. Images are deleted
+	// when changing folders, so most of the time the job is still queued and cancelling is immediate.
+	Workers.Abandon(ThumbnailJob);
 
-	// It is important that the thread count decrements if necessary since Images can be deleted
-	// when changing folders. The threads need to be available to do more work in a new folder.
-	if (ThumbnailRequested && ThumbnailThreadRunning)
-	{
-		ThumbnailNumThreadsRunning--;
-		tiClampMin(ThumbnailNumThreadsRunning, 0);
-	}
+	// A load job never touches this object so there is no need to wait for one.
+	CancelLoad();
 
 	// Free GPU image mem and texture IDs.
 	Unload(true);
+	ImgCache.Remove(this);
+	ThumbAtlas.Free(ThumbnailHandle);
 }
 
 
@@ -107,22 +196,548 @@ void Image::ResetLoadParams()
 }
 
 
-bool Image::Load(const tString& filename)
+bool Image::Load(const tString& filename, int fitWidth, int fitHeight)
 {
 	if (filename.IsEmpty())
 		return false;
 
+	// The size and modification time are filled in by Load.
 	Filename = filename;
 	Filetype = tGetFileType(Filename);
+	return Load(fitWidth, fitHeight);
+}
 
-	tSystem::tFileInfo info;
-	if (tSystem::tGetFileInfo(info, filename))
+
+bool Image::IsAnimatedPNG(const uint8* data, int64 numBytes)
+{
+	// Every chunk is a 4 byte big-endian length, a 4 byte type, the data, and a 4 byte crc. An apng has an acTL chunk
+	// and it must come before the first IDAT.
+	int64 pos = 8;
+	while (pos + 8 <= numBytes)
 	{
-		FileModTime = info.ModificationTime;
-		FileSizeB = info.FileSize;
+		uint32 length = (uint32(data[pos]) << 24) | (uint32(data[pos+1]) << 16) | (uint32(data[pos+2]) << 8) | uint32(data[pos+3]);
+		const uint8* type = data + pos + 4;
+		if (tStd::tMemcmp(type, "acTL", 4) == 0)
+			return true;
+		if (tStd::tMemcmp(type, "IDAT", 4) == 0)
+			return false;
+		pos += int64(length) + 12;
+	}
+
+	return false;
+}
+
+
+bool Image::LoadScaledJPG(const uint8* data, int64 numBytes, int fitWidth, int fitHeight)
+{
+	#ifdef VIEWER_SCALED_JPG
+	tjhandle decoder = tjInitDecompress();
+	if (!decoder)
+		return false;
+
+	// Cmyk jpgs can't be decoded to rgba. They go through the regular loader.
+	int width = 0, height = 0, subsamp = 0, colourSpace = 0;
+	unsigned long size = (unsigned long)numBytes;
+	if
+	(
+		(tjDecompressHeader3(decoder, data, size, &width, &height, &subsamp, &colourSpace) != 0) ||
+		(colourSpace == TJCS_CMYK) || (colourSpace == TJCS_YCCK)
+	)
+	{
+		tjDestroy(decoder);
+		return false;
+	}
+
+	// The DCT can only scale by a fixed set of factors (n/8). Pick the one giving the fewest pixels that still fills
+	// the fit box in one direction, so fitting the result never enlarges it.
+	int numFactors = 0;
+	tjscalingfactor* factors = tjGetScalingFactors(&numFactors);
+	int scaledW = width;
+	int scaledH = height;
+	for (int f = 0; f < numFactors; f++)
+	{
+		int w = TJSCALED(width, factors[f]);
+		int h = TJSCALED(height, factors[f]);
+		if (((w >= fitWidth) || (h >= fitHeight)) && (int64(w)*int64(h) < int64(scaledW)*int64(scaledH)))
+		{
+			scaledW = w;
+			scaledH = h;
+		}
+	}
+
+	// The exif thumbnail wins if it is smaller still and isn't letterboxed to a different aspect. Most are 160x120 so
+	// they only help the smaller fit sizes.
+	const uint8* src = data;
+	unsigned long srcSize = size;
+	const uint8* exif = nullptr;
+	int64 exifBytes = 0;
+	if (FindExifThumbnail(data, numBytes, exif, exifBytes))
+	{
+		int exifW = 0, exifH = 0, exifSubsamp = 0, exifColourSpace = 0;
+		bool usable =
+			(tjDecompressHeader3(decoder, exif, (unsigned long)exifBytes, &exifW, &exifH, &exifSubsamp, &exifColourSpace) == 0) &&
+			(exifColourSpace != TJCS_CMYK) && (exifColourSpace != TJCS_YCCK) &&
+			Fills(exifW, exifH, fitWidth, fitHeight) && SameAspect(width, height, exifW, exifH) &&
+			(int64(exifW)*int64(exifH) < int64(scaledW)*int64(scaledH));
+		if (usable)
+		{
+			src = exif;
+			srcSize = (unsigned long)exifBytes;
+			scaledW = exifW;
+			scaledH = exifH;
+		}
+	}
+
+	if ((src == data) && (scaledW == width) && (scaledH == height))
+	{
+		tjDestroy(decoder);
+		return false;
+	}
+
+	// Bottom-up rgba is the tPicture layout so the decoder writes straight into the picture's pixels.
+	tPixel* pixels = new tPixel[scaledW*scaledH];
+	int result = tjDecompress2(decoder, src, srcSize, (unsigned char*)pixels, scaledW, 0, scaledH, TJPF_RGBA, TJFLAG_BOTTOMUP);
+	bool failed = (result != 0) && (Config.StrictLoading || (tjGetErrorCode(decoder) == TJERR_FATAL));
+	tjDestroy(decoder);
+	if (failed)
+	{
+		delete[] pixels;
+		return false;
+	}
+
+	Pictures.Append(new tPicture(scaledW, scaledH, pixels, false));
+	Info.SrcPixelFormat = tPixelFormat::R8G8B8;
+	Info.SrcWidth = width;
+	Info.SrcHeight = height;
+	return true;
+
+	#else
+	return false;
+	#endif
+}
+
+
+bool Image::LoadScaledWEBP(const uint8* data, int64 numBytes, int fitWidth, int fitHeight)
+{
+	#ifdef VIEWER_SCALED_WEBP
+	// Animations are left to the regular loader since every frame is wanted.
+	WebPDecoderConfig config;
+	if (!WebPInitDecoderConfig(&config) || (WebPGetFeatures(data, size_t(numBytes), &config.input) != VP8_STATUS_OK))
+		return false;
+	if (config.input.has_animation)
+		return false;
+
+	// The webp rescaler can produce any size so we ask for exactly the fitted size.
+	int width = config.input.width;
+	int height = config.input.height;
+	int scaledW, scaledH;
+	AreaResample::GetFitSize(scaledW, scaledH, width, height, fitWidth, fitHeight);
+	if (!AreaResample::IsReduction(width, height, scaledW, scaledH) || ((scaledW == width) && (scaledH == height)))
+		return false;
+
+	tPixel* pixels = new tPixel[scaledW*scaledH];
+	config.options.use_scaling = 1;
+	config.options.scaled_width = scaledW;
+	config.options.scaled_height = scaledH;
+	config.options.flip = 1;
+	config.output.colorspace = MODE_RGBA;
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba = (uint8_t*)pixels;
+	config.output.u.RGBA.stride = scaledW * int(sizeof(tPixel));
+	config.output.u.RGBA.size = size_t(scaledW) * size_t(scaledH) * sizeof(tPixel);
+	VP8StatusCode status = WebPDecode(data, size_t(numBytes), &config);
+	WebPFreeDecBuffer(&config.output);
+	if (status != VP8_STATUS_OK)
+	{
+		delete[] pixels;
+		return false;
+	}
+
+	Pictures.Append(new tPicture(scaledW, scaledH, pixels, false));
+	Info.SrcPixelFormat = config.input.has_alpha ? tPixelFormat::R8G8B8A8 : tPixelFormat::R8G8B8;
+	Info.SrcWidth = width;
+	Info.SrcHeight = height;
+	return true;
+
+	#else
+	return false;
+	#endif
+}
+
+
+bool Image::LoadPagesTIFF(const uint8* data, int64 numBytes, int fitWidth, int fitHeight)
+{
+	#ifdef VIEWER_PARALLEL_TIFF
+	struct Page
+	{
+		int Width;
+		int Height;
+		toff_t Offset;							// Of the page's directory. Decoding threads go straight to it.
+		tPixelFormat Format;
+		tPixel* Pixels;
+	};
+
+	// Walking the directories only reads the headers so it is quick even for hundreds of pages.
+	std::vector<Page> pages;
+	TIFFStream stream = { data, numBytes, 0 };
+	TIFF* tiff = OpenTIFFStream(stream);
+	if (!tiff)
+		return false;
+	bool byTacent = false;
+	do
+	{
+		uint32 width = 0, height = 0;
+		TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+		TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+		if ((width > 0x7FFFFFFF) || (height > 0x7FFFFFFF))
+			width = height = 0;
+
+		// Everything is decoded to RGBA, but the format reported is the one in the file. Only 8 bit rgb is known by a
+		// tPixelFormat. Other layouts leave the format invalid and the file goes to the Tacent loader.
+		uint16 bitsPerSample = 0, samplesPerPixel = 0, photometric = 0, sampleFormat = 0;
+		TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+		TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+		TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat);
+		TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+		tPixelFormat format = tPixelFormat::Invalid;
+		if ((bitsPerSample == 8) && (sampleFormat == SAMPLEFORMAT_UINT) && (photometric == PHOTOMETRIC_RGB))
+		{
+			if (samplesPerPixel == 3)
+				format = tPixelFormat::R8G8B8;
+			else if (samplesPerPixel == 4)
+				format = tPixelFormat::R8G8B8A8;
+		}
+		pages.push_back({ int(width), int(height), TIFFCurrentDirOffset(tiff), format, nullptr });
+
+		// Tacent names itself in the software tag of the files it writes.
+		char* software = nullptr;
+		const char* name = "tacent";
+		if ((TIFFGetField(tiff, TIFFTAG_SOFTWARE, &software) == 1) && software)
+		{
+			for (const char* c = software; *c && !byTacent; c++)
+			{
+				int n = 0;
+				while (name[n] && (std::tolower((unsigned char)c[n]) == name[n]))
+					n++;
+				byTacent = (name[n] == '\0');
+			}
+		}
+	} while (TIFFReadDirectory(tiff));
+	TIFFClose(tiff);
+
+	if ((pages.size() < 2) || byTacent)
+		return false;
+
+	// A picture's pixels are indexed with an int, so bigger pages are left to the Tacent loader to reject.
+	const int64 maxPixels = 0x7FFFFFFF / int64(sizeof(tPixel));
+	for (const Page& page : pages)
+		if ((page.Width <= 0) || (page.Height <= 0) || (int64(page.Width)*int64(page.Height) > maxPixels))
+			return false;
+
+	// The same choice KeepFitPicture makes, but before decoding anything.
+	int numPages = int(pages.size());
+	int largest = 0;
+	for (int p = 1; p < numPages; p++)
+		if (int64(pages[p].Width)*pages[p].Height > int64(pages[largest].Width)*pages[largest].Height)
+			largest = p;
+	if (pages[largest].Format == tPixelFormat::Invalid)
+		return false;
+
+	int only = -1;
+	if ((fitWidth > 0) && (fitHeight > 0))
+	{
+		only = largest;
+		for (int p = 0; p < numPages; p++)
+		{
+			int w = pages[p].Width;
+			int h = pages[p].Height;
+			bool smaller = int64(w)*h < int64(pages[only].Width)*pages[only].Height;
+			if (SameAspect(pages[largest].Width, pages[largest].Height, w, h) && Fills(w, h, fitWidth, fitHeight) && smaller)
+				only = p;
+		}
+	}
+
+	// Every page gets its own handle since a handle can only be used by one thread. Opening one only reads the first
+	// directory, and it goes to the page's directory by the offset found above. Selecting it by index would walk the
+	// chain from the start for every page.
+	std::atomic<bool> failed(false);
+	auto decode = [&](int p)
+	{
+		if (failed || IsLoadCancelled())
+			return;
+
+		TIFFStream pageStream = { data, numBytes, 0 };
+		TIFF* pageTiff = OpenTIFFStream(pageStream);
+		if (!pageTiff)
+		{
+			failed = true;
+			return;
+		}
+
+		// The raster is packed ABGR words. The Get macros unpack them the same way on any byte order.
+		Page& page = pages[p];
+		int64 numPixels = int64(page.Width) * int64(page.Height);
+		page.Pixels = new (std::nothrow) tPixel[numPixels];
+		uint32* raster = (uint32*)page.Pixels;
+		if (!raster || !TIFFSetSubDirectory(pageTiff, page.Offset) || !TIFFReadRGBAImageOriented(pageTiff, page.Width, page.Height, raster, ORIENTATION_BOTLEFT, 0))
+		{
+			failed = true;
+			TIFFClose(pageTiff);
+			return;
+		}
+
+		// libtiff premultiplies unassociated alpha on the way to RGBA. We want it straight again.
+		uint16 numExtra = 0;
+		uint16* extra = nullptr;
+		TIFFGetField(pageTiff, TIFFTAG_EXTRASAMPLES, &numExtra, &extra);
+		bool straight = (numExtra > 0) && extra && (extra[0] == EXTRASAMPLE_UNASSALPHA);
+		for (int64 i = 0; i < numPixels; i++)
+		{
+			uint32 abgr = raster[i];
+			tPixel& pixel = page.Pixels[i];
+			pixel.R = uint8(TIFFGetR(abgr));
+			pixel.G = uint8(TIFFGetG(abgr));
+			pixel.B = uint8(TIFFGetB(abgr));
+			pixel.A = uint8(TIFFGetA(abgr));
+			if (straight && (pixel.A > 0) && (pixel.A < 255))
+			{
+				int half = pixel.A / 2;
+				pixel.R = uint8(tMin((pixel.R*255 + half) / pixel.A, 255));
+				pixel.G = uint8(tMin((pixel.G*255 + half) / pixel.A, 255));
+				pixel.B = uint8(tMin((pixel.B*255 + half) / pixel.A, 255));
+			}
+		}
+		TIFFClose(pageTiff);
+	};
+
+	if (only != -1)
+		decode(only);
+	else
+		ParallelFor(numPages, decode);
+
+	// Something libtiff can't turn into RGBA goes to the regular loader, which may do better or report it properly.
+	if (failed || IsLoadCancelled())
+	{
+		for (Page& page : pages)
+			delete[] page.Pixels;
+		return false;
 	}
 
-	return Load();
+	for (Page& page : pages)
+		if (page.Pixels)
+			Pictures.Append(new tPicture(page.Width, page.Height, page.Pixels, false));
+
+	Info.SrcPixelFormat = pages[largest].Format;
+	if (only != -1)
+	{
+		Info.SrcWidth = pages[largest].Width;
+		Info.SrcHeight = pages[largest].Height;
+	}
+	return true;
+
+	#else
+	return false;
+	#endif
+}
+
+
+bool Image::LoadLinearHDR(const uint8* data, int64 numBytes)
+{
+	if (!Tonemap::DecodeRGBE(ToneSource, data, numBytes))
+		return false;
+
+	int width = ToneSource.Width;
+	int height = ToneSource.Height;
+	tPixel* pixels = new tPixel[width*height];
+	Tonemap::Apply(pixels, ToneSource, LoadParams);
+	Pictures.Append(new tPicture(width, height, pixels, false));
+	Info.SrcPixelFormat = tPixelFormat::RADIANCE;
+	return true;
+}
+
+
+bool Image::LoadLinearEXR()
+{
+	#ifdef VIEWER_LINEAR_EXR
+	try
+	{
+		// Files with several parts load as several frames. That is left to tImageEXR.
+		{
+			Imf::MultiPartInputFile multiPart(Filename.Chars());
+			if (multiPart.parts() != 1)
+				return false;
+		}
+
+		Imf::RgbaInputFile exr(Filename.Chars(), tSystem::tGetNumCores());
+		const Imath::Box2i& window = exr.dataWindow();
+		int width = window.max.x - window.min.x + 1;
+		int height = window.max.y - window.min.y + 1;
+		if ((width <= 0) || (height <= 0))
+			return false;
+
+		// The frame buffer is addressed in data window coordinates, which need not start at zero.
+		std::vector<Imf::Rgba> rows(size_t(width)*size_t(height));
+		ptrdiff_t origin = ptrdiff_t(window.min.x) + ptrdiff_t(window.min.y)*width;
+		exr.setFrameBuffer(rows.data() - origin, 1, width);
+		exr.readPixels(window.min.y, window.max.y);
+
+		// Exr rows are top-down. An Rgba is four halfs, which is the layout of a Half source.
+		static_assert(sizeof(Imf::Rgba) == 8, "Rgba must be four packed halfs.");
+		ToneSource.Format = Tonemap::Encoding::Half;
+		ToneSource.Width = width;
+		ToneSource.Height = height;
+		ToneSource.Data.resize(rows.size()*sizeof(Imf::Rgba));
+		size_t rowBytes = size_t(width)*sizeof(Imf::Rgba);
+		for (int y = 0; y < height; y++)
+			tStd::tMemcpy(ToneSource.Data.data() + size_t(height-1-y)*rowBytes, &rows[size_t(y)*width], int(rowBytes));
+		Tonemap::ComputeFog(ToneSource);
+	}
+	catch (...)
+	{
+		ToneSource.Clear();
+		return false;
+	}
+
+	int width = ToneSource.Width;
+	int height = ToneSource.Height;
+	tPixel* pixels = new tPixel[width*height];
+	Tonemap::Apply(pixels, ToneSource, LoadParams);
+	Pictures.Append(new tPicture(width, height, pixels, false));
+	Info.SrcPixelFormat = tPixelFormat::OPENEXR;
+	return true;
+
+	#else
+	return false;
+	#endif
+}
+
+
+void Image::Retonemap()
+{
+	tPicture* picture = Pictures.First();
+	bool matches = picture && (picture->GetWidth() == ToneSource.Width) && (picture->GetHeight() == ToneSource.Height);
+	if (!ToneSource.IsValid() || !matches)
+		return;
+
+	ToneMipsStale = true;
+	ToneChangedTime = tSystem::tGetTime();
+
+	// Tiled pictures are read by the level build on a worker, so their pixels are only redone by Bind once the params
+	// settle. The old overview and tiles are drawn until then.
+	if (Tiles.GetPicture() == picture)
+	{
+		ToneTilesStale = true;
+		return;
+	}
+
+	Tonemap::Apply(picture->GetPixelPointer(), ToneSource, LoadParams);
+	if (picture->TextureID == 0)
+		return;
+
+	// Only the top level is current. Sampling just that until Bind rebuilds the mipmaps keeps the old ones from
+	// showing when zoomed out.
+	int width = picture->GetWidth();
+	int height = picture->GetHeight();
+	glBindTexture(GL_TEXTURE_2D, picture->TextureID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, picture->GetPixelPointer());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+}
+
+
+bool Image::FindExifThumbnail(const uint8* data, int64 numBytes, const uint8*& thumb, int64& thumbBytes)
+{
+	// Walk the markers up to the start of the scan looking for an APP1 block that starts with "Exif\0\0".
+	int64 pos = 2;
+	const uint8* tiff = nullptr;
+	int64 tiffBytes = 0;
+	while (pos + 4 <= numBytes)
+	{
+		if (data[pos] != 0xFF)
+			return false;
+		uint8 marker = data[pos+1];
+		int64 length = (int64(data[pos+2]) << 8) | int64(data[pos+3]);
+		if ((marker == 0xDA) || (pos + 2 + length > numBytes))
+			return false;
+
+		if ((marker == 0xE1) && (length >= 8) && (tStd::tMemcmp(data + pos + 4, "Exif\0\0", 6) == 0))
+		{
+			tiff = data + pos + 10;
+			tiffBytes = length - 8;
+			break;
+		}
+		pos += 2 + length;
+	}
+	if (!tiff || (tiffBytes < 8))
+		return false;
+
+	// The exif block is a little tiff. IFD0 describes the main image and the IFD after it describes the thumbnail.
+	bool intel = (tiff[0] == 'I');
+	auto read16 = [tiff, intel](int64 at) -> uint32
+	{
+		return intel ? (uint32(tiff[at]) | (uint32(tiff[at+1]) << 8)) : ((uint32(tiff[at]) << 8) | uint32(tiff[at+1]));
+	};
+	auto read32 = [&read16, intel](int64 at) -> uint32
+	{
+		return intel ? (read16(at) | (read16(at+2) << 16)) : ((read16(at) << 16) | read16(at+2));
+	};
+
+	int64 ifd0 = read32(4);
+	if (ifd0 + 2 > tiffBytes)
+		return false;
+	int64 ifd1Link = ifd0 + 2 + int64(read16(ifd0))*12;
+	if (ifd1Link + 4 > tiffBytes)
+		return false;
+	int64 ifd1 = read32(ifd1Link);
+	if ((ifd1 == 0) || (ifd1 + 2 > tiffBytes))
+		return false;
+
+	int64 offset = 0;
+	int64 length = 0;
+	int numEntries = int(read16(ifd1));
+	for (int e = 0; e < numEntries; e++)
+	{
+		int64 entry = ifd1 + 2 + int64(e)*12;
+		if (entry + 12 > tiffBytes)
+			return false;
+		uint32 tag = read16(entry);
+		if (tag == 0x0201)
+			offset = read32(entry + 8);
+		else if (tag == 0x0202)
+			length = read32(entry + 8);
+	}
+
+	if ((offset <= 0) || (length <= 0) || (offset + length > tiffBytes))
+		return false;
+
+	thumb = tiff + offset;
+	thumbBytes = length;
+	return true;
+}
+
+
+void Image::KeepFitPicture(int fitWidth, int fitHeight)
+{
+	tPicture* largest = Pictures.First();
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		if (pic->GetNumPixels() > largest->GetNumPixels())
+			largest = pic;
+
+	tPicture* best = largest;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+	{
+		int w = pic->GetWidth();
+		int h = pic->GetHeight();
+		bool sameAspect = SameAspect(largest->GetWidth(), largest->GetHeight(), w, h);
+		if (sameAspect && Fills(w, h, fitWidth, fitHeight) && (pic->GetNumPixels() < best->GetNumPixels()))
+			best = pic;
+	}
+
+	Info.SrcWidth = largest->GetWidth();
+	Info.SrcHeight = largest->GetHeight();
+	while (tPicture* pic = Pictures.Remove())
+		if (pic != best)
+			delete pic;
+	Pictures.Append(best);
 }
 
 
@@ -144,30 +759,48 @@ void Image::GetCanLoad(tSystem::tExtensions& extensions)
 }
 
 
-bool Image::Load()
+bool Image::Load(int fitWidth, int fitHeight)
 {
 	if (IsLoaded() && !Dirty)
 	{
 		LoadedTime = tSystem::tGetTime();
+		ImgCache.Touch(this);
 		return true;
 	}
 
-	if (Filetype == tFileType::Unknown)
+	if (IsLoadCancelled())
 		return false;
 
-	// If the type is a png file, we may actually be dealing with an apng file inside.
-	// It is more efficient to only use the apng loader if we need to (even though it will
-	// handle non apng files). To this end, we modify the filetype used for loading if necessary.
-	// Note also that from the outside, we only determine the type from the extension. The 
-	// IsAnimatedPNG call is quite expensive -- it needs to load part of the fileinto memory,
-	// not something we want to do before actually loading an image. If DetectAPNGInsidePNG is
-	// false, the PNG loader will always be used for .png files even if they have an apng inside.
-	// The designers of apng made the format backwards compatible with single-frame png loaders.
+	// The Tacent loaders only take a filename and open the file themselves, so the file is only mapped here for the
+	// checks and decoders that read from memory. The size and modification time come from a stat. A mapping is never
+	// made just for those, since a file truncated while it is mapped can fault. The type is always the extension's,
+	// as the Tacent loaders reject files whose extension doesn't match.
+	LoadStatistics::Stopwatch stopwatch;
+	int64 fileSize = 0;
+	if ((Filetype == tFileType::Unknown) || !MappedFile::GetInfo(Filename, fileSize, FileModTime))
+		return false;
+	FileSizeB = uint64(fileSize);
+	MappedFile file;
+	auto mapFile = [this, &file]() -> bool { return file.IsValid() || file.OpenRead(Filename); };
+
+	// If the type is a png file, we may actually be dealing with an apng file inside. It is more efficient to only use
+	// the apng loader if we need to (even though it will handle non apng files). If DetectAPNGInsidePNG is false, the
+	// PNG loader will always be used for png files even if they have an apng inside. The designers of apng made the
+	// format backwards compatible with single-frame png loaders. Only the chunk headers before the first IDAT are read.
 	tSystem::tFileType loadingFiletype = Filetype;
-	if ((Filetype == tSystem::tFileType::PNG) && Config.DetectAPNGInsidePNG && tImageAPNG::IsAnimatedPNG(Filename))
-		loadingFiletype = tSystem::tFileType::APNG;
+	if ((Filetype == tSystem::tFileType::PNG) && Config.DetectAPNGInsidePNG)
+	{
+		if (mapFile() && IsAnimatedPNG(file.GetData(), file.GetSize()))
+			loadingFiletype = tSystem::tFileType::APNG;
+		file.Close();
+	}
+	bool reduce = (fitWidth > 0) && (fitHeight > 0);
+	double readSeconds = stopwatch.Lap();
 
+	// Each case laps the stopwatch once its decoder is done. Whatever it does after that counts as frame handling.
+	double decodeSeconds = 0.0;
 	Info.SrcPixelFormat = tPixelFormat::Invalid;
+	Info.SrcWidth = Info.SrcHeight = 0;
 	bool success = false;
 	try
 	{
@@ -179,6 +812,7 @@ bool Image::Load()
 				bool ok = apng.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int numFrames = apng.GetNumFrames();
 				for (int f = 0; f < numFrames; f++)
@@ -204,6 +838,7 @@ bool Image::Load()
 				bool ok = bmp.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int width = bmp.GetWidth();
 				int height = bmp.GetHeight();
@@ -218,28 +853,34 @@ bool Image::Load()
 
 			case tSystem::tFileType::DDS:
 			{
-				success = DDSCubemap.Load(Filename);
+				// The compressed data is only needed until it's decoded into the picture list.
+				tCubemap ddsCubemap;
+				tTexture ddsTexture2D;
+				success = ddsCubemap.Load(Filename);
 				if (success)
 				{
-					Info.SrcPixelFormat = DDSCubemap.GetSide(tImage::tCubemap::tSide::PosX)->GetPixelFormat();
+					Info.SrcPixelFormat = ddsCubemap.GetSide(tImage::tCubemap::tSide::PosX)->GetPixelFormat();
 				}
 				else
 				{
-					success = DDSTexture2D.Load(Filename);
-					Info.SrcPixelFormat = DDSTexture2D.GetPixelFormat();
+					success = ddsTexture2D.Load(Filename);
+					Info.SrcPixelFormat = ddsTexture2D.GetPixelFormat();
 				}
-				if (success)
+				decodeSeconds = stopwatch.Lap();
+				if (success && !IsLoadCancelled())
 				{
-					if (DDSCubemap.IsValid())
+					// A reduced load has only one picture so there is nothing to build an alt picture from.
+					if (ddsCubemap.IsValid())
 					{
-						ConvertCubemapToPicture();
-						CreateAltPictureFromDDS_Cubemap();			// Create cubemap alt image.
+						success = ConvertCubemapToPicture(ddsCubemap, fitWidth, fitHeight);
+						if (!reduce)
+							AltType = AltPictureType::Cubemap;
 					}
-					else if (DDSTexture2D.IsValid())
+					else if (ddsTexture2D.IsValid())
 					{
-						ConvertTexture2DToPicture();
-						if (DDSTexture2D.GetNumMipmaps() > 1)
-							CreateAltPictureFromDDS_2DMipmaps();	// Create mipmap alt image.
+						success = ConvertTexture2DToPicture(ddsTexture2D, fitWidth, fitHeight);
+						if ((ddsTexture2D.GetNumMipmaps() > 1) && !reduce)
+							AltType = AltPictureType::Mipmaps;
 					}
 				}
 				break;
@@ -247,6 +888,13 @@ bool Image::Load()
 
 			case tSystem::tFileType::EXR:
 			{
+				if (!reduce && LoadLinearEXR())
+				{
+					decodeSeconds = stopwatch.Lap();
+					success = true;
+					break;
+				}
+
 				tImageEXR exr;
 				bool ok = exr.Load
 				(
@@ -259,6 +907,7 @@ bool Image::Load()
 				);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int numFrames = exr.GetNumFrames();
 				for (int f = 0; f < numFrames; f++)
@@ -284,6 +933,7 @@ bool Image::Load()
 				bool ok = gif.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int numFrames = gif.GetNumFrames();
 				for (int f = 0; f < numFrames; f++)
@@ -305,10 +955,18 @@ bool Image::Load()
 
 			case tSystem::tFileType::HDR:
 			{
+				if (!reduce && mapFile() && LoadLinearHDR(file.GetData(), file.GetSize()))
+				{
+					decodeSeconds = stopwatch.Lap();
+					success = true;
+					break;
+				}
+
 				tImageHDR hdr;
 				bool ok = hdr.Load(Filename, LoadParams.GammaValue, LoadParams.HDR_Exposure);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int width = hdr.GetWidth();
 				int height = hdr.GetHeight();
@@ -327,6 +985,7 @@ bool Image::Load()
 				bool ok = ico.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				Info.SrcPixelFormat = ico.GetBestSrcPixelFormat();
 				int numFrames = ico.GetNumFrames();
@@ -347,10 +1006,20 @@ bool Image::Load()
 
 			case tSystem::tFileType::JPG:
 			{
+				#ifdef VIEWER_SCALED_JPG
+				if (reduce && mapFile() && LoadScaledJPG(file.GetData(), file.GetSize(), fitWidth, fitHeight))
+				{
+					decodeSeconds = stopwatch.Lap();
+					success = true;
+					break;
+				}
+				#endif
+
 				tImageJPG jpg;
 				bool ok = jpg.Load(Filename, Viewer::Config.StrictLoading);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int width = jpg.GetWidth();
 				int height = jpg.GetHeight();
@@ -369,6 +1038,7 @@ bool Image::Load()
 				bool ok = png.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int width = png.GetWidth();
 				int height = png.GetHeight();
@@ -387,6 +1057,7 @@ bool Image::Load()
 				bool ok = tga.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int width = tga.GetWidth();
 				int height = tga.GetHeight();
@@ -401,10 +1072,20 @@ bool Image::Load()
 
 			case tSystem::tFileType::TIFF:
 			{
+				#ifdef VIEWER_PARALLEL_TIFF
+				if (mapFile() && LoadPagesTIFF(file.GetData(), file.GetSize(), fitWidth, fitHeight))
+				{
+					decodeSeconds = stopwatch.Lap();
+					success = true;
+					break;
+				}
+				#endif
+
 				tImageTIFF tiff;
 				bool ok = tiff.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int numFrames = tiff.GetNumFrames();
 				for (int f = 0; f < numFrames; f++)
@@ -425,10 +1106,20 @@ bool Image::Load()
 	
 			case tSystem::tFileType::WEBP:
 			{
+				#ifdef VIEWER_SCALED_WEBP
+				if (reduce && mapFile() && LoadScaledWEBP(file.GetData(), file.GetSize(), fitWidth, fitHeight))
+				{
+					decodeSeconds = stopwatch.Lap();
+					success = true;
+					break;
+				}
+				#endif
+
 				tImageWEBP webp;
 				bool ok = webp.Load(Filename);
 				if (!ok)
 					return false;
+				decodeSeconds = stopwatch.Lap();
 
 				int numFrames = webp.GetNumFrames();
 				for (int f = 0; f < numFrames; f++)
@@ -463,7 +1154,12 @@ bool Image::Load()
 						Pictures.Append(picture);
 						partNum++;
 					}
-				} while (ok);
+					else
+					{
+						delete picture;
+					}
+				} while (ok && !IsLoadCancelled());
+				decodeSeconds = stopwatch.Lap();
 
 				if (Pictures.NumItems() > 0)
 				{
@@ -479,31 +1175,285 @@ bool Image::Load()
 		success = false;
 	}
 
-	if (!success)
+	// A cancelled load has nobody waiting for it so we skip the opacity scan as well.
+	if (!success || IsLoadCancelled())
 		return false;
 
+	int64 numPixels = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		numPixels += pic->GetNumPixels();
+
+	// Icons come in several sizes and pyramidal tiffs carry reduced copies of the main page.
+	bool hasSubImages = (loadingFiletype == tFileType::ICO) || (loadingFiletype == tFileType::TIFF);
+	if (reduce && hasSubImages && (Pictures.Count() > 1))
+		KeepFitPicture(fitWidth, fitHeight);
+
+	// Long animations keep most of their frames compressed. Reduced loads are for thumbnails, which only want the
+	// first frame, so they don't bother.
+	bool animated =
+	(
+		(loadingFiletype == tFileType::APNG) || (loadingFiletype == tFileType::GIF) ||
+		(loadingFiletype == tFileType::WEBP) || (loadingFiletype == tFileType::TIFF)
+	);
+	if (!reduce && animated)
+		ParkFrames();
+	double framesSeconds = stopwatch.Lap();
+
 	LoadedTime = tSystem::tGetTime();
 
-	// Fill in rest of info struct.
+	// Fill in rest of info struct. The scaled decoders have already set the source size.
 	Info.Opaque				= IsOpaque();
-	Info.FileSizeBytes		= tSystem::tGetFileSize(Filename);
+	double opacitySeconds	= stopwatch.Lap();
+	Info.FileSizeBytes		= int(FileSizeB);
 	Info.MemSizeBytes		= GetMemSizeBytes();
+	if (Info.SrcWidth == 0)
+	{
+		Info.SrcWidth		= GetPrimaryPic()->GetWidth();
+		Info.SrcHeight		= GetPrimaryPic()->GetHeight();
+	}
+
+	// Reduced loads do different work depending on what the file carries so they would only muddy the figures.
+	if (!reduce)
+	{
+		int64 opacityPixels = (AltType == AltPictureType::Cubemap) ? numPixels : int64(GetPrimaryPic()->GetNumPixels());
+		LoadStats.Record(loadingFiletype, LoadStatistics::Stage::Read, readSeconds, 0, 0);
+		LoadStats.Record(loadingFiletype, LoadStatistics::Stage::Decode, decodeSeconds, int64(FileSizeB), numPixels);
+		LoadStats.Record(loadingFiletype, LoadStatistics::Stage::Frames, framesSeconds, 0, numPixels);
+		LoadStats.Record(loadingFiletype, LoadStatistics::Stage::Opacity, opacitySeconds, 0, opacityPixels);
+	}
 	ClearDirty();
+	ImgCache.Touch(this);
 	return true;
 }
 
 
-int Image::GetMemSizeBytes() const
+int64 Image::GetMemSizeBytes() const
 {
-	int numBytes = 0;
+	int64 numBytes = 0;
 	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
-		numBytes += pic->GetNumPixels() * sizeof(tPixel);
+		numBytes += int64(pic->GetNumPixels()) * sizeof(tPixel);
 
-	numBytes += AltPicture.IsValid() ? AltPicture.GetNumPixels()*sizeof(tPixel) : 0;
+	numBytes += AltPicture.IsValid() ? int64(AltPicture.GetNumPixels())*sizeof(tPixel) : 0;
+	for (const RingFrame& frame : FrameRing)
+		numBytes += frame.Data.size();
+	numBytes += ToneSource.Data.size();
 	return numBytes;
 }
 
 
+tPicture* Image::GetCurrentPic()
+{
+	if ((FrameNum >= 0) && (FrameNum < int(FrameRing.size())))
+		UnparkFrame(FrameRing[FrameNum]);
+
+	return FindCurrentPic();
+}
+
+
+tPicture* Image::FindCurrentPic() const
+{
+	if (!FrameRing.empty())
+	{
+		const RingFrame* frame = FindCurrentRingFrame();
+		return frame ? frame->Picture : nullptr;
+	}
+
+	tPicture* pic = Pictures.First();
+	for (int i = 0; i < FrameNum; i++)
+		pic = pic ? pic->Next() : nullptr;
+	return pic;
+}
+
+
+const Image::RingFrame* Image::FindCurrentRingFrame() const
+{
+	if ((FrameNum < 0) || (FrameNum >= int(FrameRing.size())))
+		return nullptr;
+	return &FrameRing[FrameNum];
+}
+
+
+void Image::ParkFrames()
+{
+	int numFrames = Pictures.Count();
+	if (numFrames <= FrameRingAhead + FrameRingBehind + 1)
+		return;
+
+	int64 decodedBytes = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		decodedBytes += int64(pic->GetNumPixels()) * sizeof(tPixel);
+	if (decodedBytes <= FrameRingMinBytes)
+		return;
+
+	FrameRing.resize(numFrames);
+	int f = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next(), f++)
+	{
+		RingFrame& frame = FrameRing[f];
+		frame.Picture	= pic;
+		frame.Width		= pic->GetWidth();
+		frame.Height	= pic->GetHeight();
+		frame.Duration	= pic->Duration;
+	}
+
+	// Frames are independent.
+	ParallelFor
+	(
+		numFrames,
+		[this](int f)
+		{
+			if (IsLoadCancelled())
+				return;
+			RingFrame& frame = FrameRing[f];
+			FrameCodec::Encode(frame.Data, frame.Picture->GetPixelPointer(), frame.Width*frame.Height);
+			frame.Data.shrink_to_fit();
+		}
+	);
+
+	if (IsLoadCancelled())
+	{
+		FrameRing.clear();
+		return;
+	}
+
+	// Nothing has a texture yet so this only frees the pixels of the frames outside the window.
+	UpdateFrameRing();
+}
+
+
+bool Image::IsInFrameWindow(int frame) const
+{
+	// Playback wraps so the window does too.
+	int numFrames = int(FrameRing.size());
+	int ahead = FramePlayRev ? (FrameNum - frame) : (frame - FrameNum);
+	ahead = (ahead + numFrames) % numFrames;
+	return (frame == 0) || (ahead <= FrameRingAhead) || (numFrames - ahead <= FrameRingBehind);
+}
+
+
+void Image::UpdateFrameRing()
+{
+	if (FrameRing.empty())
+		return;
+
+	// The frame that will be shown soonest is decoded first. One per call costs about the same as showing a frame,
+	// which keeps up with playback. The current frame itself is decoded by GetCurrentPic when it is asked for.
+	int numFrames = int(FrameRing.size());
+	int dir = FramePlayRev ? -1 : 1;
+	for (int step = 1; step <= FrameRingAhead; step++)
+	{
+		RingFrame& frame = FrameRing[(FrameNum + dir*step + numFrames) % numFrames];
+		if (!frame.Picture->IsValid())
+		{
+			UnparkFrame(frame);
+			break;
+		}
+	}
+
+	// The tiled texture reads the picture it was given, so that one stays until Bind moves it to another frame.
+	for (int f = 0; f < numFrames; f++)
+	{
+		tPicture* pic = FrameRing[f].Picture;
+		if (!pic->IsValid() || IsInFrameWindow(f) || (pic == Tiles.GetPicture()))
+			continue;
+
+		if (pic->TextureID != 0)
+		{
+			TexResidency.Release(pic->TextureID);
+			glDeleteTextures(1, &pic->TextureID);
+			pic->TextureID = 0;
+		}
+		pic->Clear();
+		pic->Duration = FrameRing[f].Duration;
+	}
+}
+
+
+void Image::UnparkFrame(RingFrame& frame)
+{
+	if (frame.Picture->IsValid())
+		return;
+
+	// The data was made by us so it can only fail to decode if memory was trampled. Black is better than garbage.
+	int numPixels = frame.Width*frame.Height;
+	tPixel* pixels = new tPixel[numPixels];
+	if (!FrameCodec::Decode(pixels, numPixels, frame.Data.data(), int64(frame.Data.size())))
+		tStd::tMemset(pixels, 0, numPixels*sizeof(tPixel));
+
+	frame.Picture->Set(frame.Width, frame.Height, pixels, false);
+	frame.Picture->Duration = frame.Duration;
+}
+
+
+void Image::UnparkFrames()
+{
+	for (RingFrame& frame : FrameRing)
+		UnparkFrame(frame);
+}
+
+
+void Image::ForEachPicture(const Undo::Step::PictureFn& edit, bool pixels)
+{
+	if (FrameRing.empty())
+	{
+		int index = 0;
+		for (tPicture* pic = Pictures.First(); pic; pic = pic->Next(), index++)
+			edit(*pic, index);
+		return;
+	}
+
+	// Parked pictures keep their durations so those can be changed without decoding anything.
+	if (!pixels)
+	{
+		for (int f = 0; f < int(FrameRing.size()); f++)
+		{
+			edit(*FrameRing[f].Picture, f);
+			FrameRing[f].Duration = FrameRing[f].Picture->Duration;
+		}
+		return;
+	}
+
+	// At most one frame per thread is decoded on top of the window. The compressed copy of every frame is redone since
+	// it has to match the edited pixels.
+	ParallelFor
+	(
+		int(FrameRing.size()),
+		[this, &edit](int f)
+		{
+			RingFrame& frame = FrameRing[f];
+			bool parked = !frame.Picture->IsValid();
+			UnparkFrame(frame);
+			edit(*frame.Picture, f);
+
+			frame.Width		= frame.Picture->GetWidth();
+			frame.Height	= frame.Picture->GetHeight();
+			frame.Duration	= frame.Picture->Duration;
+			FrameCodec::Encode(frame.Data, frame.Picture->GetPixelPointer(), frame.Width*frame.Height);
+			frame.Data.shrink_to_fit();
+			if (parked)
+			{
+				frame.Picture->Clear();
+				frame.Picture->Duration = frame.Duration;
+			}
+		}
+	);
+}
+
+
+void Image::EnableAltPicture(bool enabled)
+{
+	AltPictureEnabled = enabled && (AltType != AltPictureType::None);
+	if (!AltPictureEnabled || AltPicture.IsValid())
+		return;
+
+	if (AltType == AltPictureType::Cubemap)
+		CreateAltPictureFromDDS_Cubemap();
+	else
+		CreateAltPictureFromDDS_2DMipmaps();
+	Info.MemSizeBytes = GetMemSizeBytes();
+}
+
+
 void Image::CreateAltPictureFromDDS_2DMipmaps()
 {
 	int width = 0;
@@ -581,6 +1531,89 @@ void Image::CreateAltPictureFromDDS_Cubemap()
 }
 
 
+void Image::RequestLoad(WorkerPool::Priority priority)
+{
+	if (IsLoaded())
+		return;
+
+	// Fails harmlessly if the job has already started.
+	if (LoadJob)
+	{
+		Workers.Reprioritize(LoadJob, priority);
+		return;
+	}
+
+	// The job decodes into its own image, which the worker creates.
+	struct Result
+	{
+		std::atomic<bool> Cancelled = false;
+		std::unique_ptr<Image> Loaded;
+	};
+	std::shared_ptr<Result> result = std::make_shared<Result>();
+	LoadCancelled = std::shared_ptr<std::atomic<bool>>(result, &result->Cancelled);
+
+	tString filename = Filename;
+	tImage::tPicture::LoadParams params = LoadParams;
+	LoadJob = Workers.Submit
+	(
+		priority,
+		[filename, params, result]
+		{
+			if (result->Cancelled)
+				return;
+			// Default constructed so the only file system access is the one Load makes.
+			result->Loaded.reset(new Image());
+			result->Loaded->LoadParams = params;
+			result->Loaded->CancelFlag = &result->Cancelled;
+			result->Loaded->Load(filename);
+		},
+		[this, result]
+		{
+			LoadJob.reset();
+			LoadCancelled.reset();
+			if (!result->Cancelled && result->Loaded)
+				AdoptLoaded(*result->Loaded);
+		}
+	);
+}
+
+
+void Image::CancelLoad()
+{
+	if (!LoadJob)
+		return;
+
+	*LoadCancelled = true;
+	Workers.Cancel(LoadJob);
+	LoadJob->OnComplete = nullptr;
+	LoadJob.reset();
+	LoadCancelled.reset();
+}
+
+
+void Image::AdoptLoaded(Image& loaded)
+{
+	// Someone may have loaded us synchronously while the job was running. The pictures are moved, not copied, so this
+	// is cheap no matter how big the image is.
+	if (IsLoaded() || !loaded.IsLoaded())
+		return;
+
+	while (tPicture* picture = loaded.Pictures.Remove())
+		Pictures.Append(picture);
+	FrameRing.swap(loaded.FrameRing);
+	ToneSource = std::move(loaded.ToneSource);
+
+	AltType = loaded.AltType;
+	Filetype = loaded.Filetype;
+	FileSizeB = loaded.FileSizeB;
+	FileModTime = loaded.FileModTime;
+	Info = loaded.Info;
+	LoadedTime = tSystem::tGetTime();
+	ClearDirty();
+	ImgCache.Touch(this);
+}
+
+
 bool Image::Unload(bool force)
 {
 	if (!IsLoaded())
@@ -590,12 +1623,16 @@ bool Image::Unload(bool force)
 	if (Dirty && !force)
 		return false;
 
+	ImgCache.Remove(this);
 	Unbind();
-	DDSTexture2D.Clear();
-	DDSCubemap.Clear();
 	AltPicture.Clear();
+	AltType = AltPictureType::None;
 	AltPictureEnabled = false;
 	Pictures.Clear();
+	FrameRing.clear();
+	ToneSource.Clear();
+	ToneMipsStale = false;
+	ToneTilesStale = false;
 	Info.MemSizeBytes = 0;
 
 	LoadedTime = -1.0f;
@@ -605,10 +1642,12 @@ bool Image::Unload(bool force)
 
 void Image::Unbind()
 {
+	Tiles.Clear();
 	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
 	{
 		if (pic->TextureID != 0)
 		{
+			TexResidency.Release(pic->TextureID);
 			glDeleteTextures(1, &pic->TextureID);
 			pic->TextureID = 0;
 		}
@@ -616,19 +1655,48 @@ void Image::Unbind()
 
 	if (TexIDAlt != 0)
 	{
+		TexResidency.Release(TexIDAlt);
 		glDeleteTextures(1, &TexIDAlt);
 		TexIDAlt = 0;
 	}
 }
 
 
-bool Image::IsOpaque() const
+void Image::EvictTexture(uint texID)
 {
-	if (DDSCubemap.IsValid())
-		return DDSCubemap.AllSidesOpaque();
+	// Already released by the residency manager. Textures of a tiled picture belong to the tiles.
+	if (Tiles.EvictTexture(texID))
+		return;
+
+	if (TexIDAlt == texID)
+	{
+		glDeleteTextures(1, &TexIDAlt);
+		TexIDAlt = 0;
+		return;
+	}
+
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+	{
+		if (pic->TextureID == texID)
+		{
+			glDeleteTextures(1, &pic->TextureID);
+			pic->TextureID = 0;
+			return;
+		}
+	}
+}
+
 
-	if (DDSTexture2D.IsValid())
-		return DDSTexture2D.IsOpaque();
+bool Image::IsOpaque() const
+{
+	// Any cubemap side may have alpha.
+	if (AltType == AltPictureType::Cubemap)
+	{
+		for (tPicture* side = Pictures.First(); side; side = side->Next())
+			if (!side->IsOpaque())
+				return false;
+		return true;
+	}
 
 	tPicture* picture = Pictures.First();
 	if (picture && picture->IsValid())
@@ -643,10 +1711,15 @@ int Image::GetWidth() const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetWidth();
 
-	tPicture* picture = GetCurrentPic();
+	tPicture* picture = FindCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->GetWidth();
 
+	// A parked frame still knows its size.
+	const RingFrame* frame = FindCurrentRingFrame();
+	if (frame)
+		return frame->Width;
+
 	return 0;
 }
 
@@ -656,10 +1729,15 @@ int Image::GetHeight() const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetHeight();
 
-	tPicture* picture = GetCurrentPic();
+	tPicture* picture = FindCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->GetHeight();
 
+	// A parked frame still knows its size.
+	const RingFrame* frame = FindCurrentRingFrame();
+	if (frame)
+		return frame->Height;
+
 	return 0;
 }
 
@@ -669,10 +1747,15 @@ int Image::GetArea() const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetArea();
 
-	tPicture* picture = GetCurrentPic();
+	tPicture* picture = FindCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->GetArea();
 
+	// A parked frame still knows its size.
+	const RingFrame* frame = FindCurrentRingFrame();
+	if (frame)
+		return frame->Width*frame->Height;
+
 	return 0;
 }
 
@@ -682,7 +1765,8 @@ tColouri Image::GetPixel(int x, int y) const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetPixel(x, y);
 
-	tPicture* picture = GetCurrentPic();
+	// Bind decodes the current frame, so only a frame that was never shown can still be parked here.
+	tPicture* picture = FindCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->GetPixel(x, y);
 
@@ -694,86 +1778,125 @@ tColouri Image::GetPixel(int x, int y) const
 
 void Image::Rotate90(bool antiClockWise)
 {
+	// Key presses can arrive while the image is still loading.
+	if (!IsLoaded())
+		return;
+
 	tString desc; tsPrintf(desc, "Rotate 90 %s", antiClockWise ? "ACW" : "CW");
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Rotate90(antiClockWise);
+	PushUndo(new Undo::Step_Rotate90(desc, Dirty, antiClockWise));
+	ForEachPicture([antiClockWise](tPicture& picture, int index) { picture.Rotate90(antiClockWise); }, true);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::Rotate(float angle, const tColouri& fill, tResampleFilter upFilter, tResampleFilter downFilter)
 {
+	if (!IsLoaded())
+		return;
+
 	tString desc; tsPrintf(desc, "Rotate %.1f", tRadToDeg(angle));
 	PushUndo(desc);
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->RotateCenter(angle, fill, upFilter, downFilter);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::Flip(bool horizontal)
 {
+	if (!IsLoaded())
+		return;
+
 	tString desc; tsPrintf(desc, "Flip %s", horizontal ? "Horiz" : "Vert");
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Flip(horizontal);
+	PushUndo(new Undo::Step_Flip(desc, Dirty, horizontal));
+	ForEachPicture([horizontal](tPicture& picture, int index) { picture.Flip(horizontal); }, true);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::Crop(int newWidth, int newHeight, int originX, int originY, const tColouri& fillColour)
 {
+	if (!IsLoaded())
+		return;
+
 	tString desc; tsPrintf(desc, "Crop %d %d", newWidth, newHeight);
 	PushUndo(desc);
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->Crop(newWidth, newHeight, originX, originY, fillColour);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::Crop(int newWidth, int newHeight, tPicture::Anchor anchor, const tColouri& fillColour)
 {
+	if (!IsLoaded())
+		return;
+
 	tString desc; tsPrintf(desc, "Crop %d %d", newWidth, newHeight);
 	PushUndo(desc);
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->Crop(newWidth, newHeight, anchor, fillColour);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::Crop(const tColouri& borderColour, uint32 channels)
 {
+	if (!IsLoaded())
+		return;
+
 	PushUndo("Crop Borders");
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->Crop(borderColour, channels);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::Resample(int newWidth, int newHeight, tImage::tResampleFilter filter, tImage::tResampleEdgeMode edgeMode)
 {
-	tString desc; tsPrintf(desc, "Resample %d %d", newWidth, newHeight);
-	PushUndo(desc);
+	if (!IsLoaded())
+		return;
+
+	// The results go to new pictures so the undo step can keep the originals rather than a copy of them. Area
+	// reductions read the source directly. Other filters copy it once, as resampling in place always did.
+	BeginEdit();
+	tList<tPicture> resampled;
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Resample(newWidth, newHeight, filter, edgeMode);
+	{
+		tPicture* result = new tPicture();
+		if (picture->IsValid())
+			AreaResample::Resample(*result, *picture, newWidth, newHeight, filter, edgeMode);
+		result->Duration = picture->Duration;
+		resampled.Append(result);
+	}
+
+	tString desc; tsPrintf(desc, "Resample %d %d", newWidth, newHeight);
+	PushUndo(new Undo::Step_PictureList(desc, Dirty, Pictures, true));
+	while (tPicture* picture = resampled.Remove())
+		Pictures.Append(picture);
 
-	Dirty = true;
+	EndEdit();
 }
 
 
 void Image::SetPixelColour(int x, int y, const tColouri& colour, bool pushUndo, bool surpressDirty)
 {
+	if (!IsLoaded())
+		return;
+
+	// Writes without undo are live previews that the pixel dialog reverts before making the real edit. They only go to
+	// the decoded pictures and leave the frame ring and the linear pixels alone. Parked frames are skipped.
 	if (pushUndo)
 	{
+		BeginEdit();
 		tString desc; tsPrintf(desc, "Pixel Colour (%d,%d)", x, y);
-		PushUndo(desc);
+		UndoStack.PushPixel(Pictures, x, y, desc, Dirty);
 	}
 
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
@@ -782,6 +1905,8 @@ void Image::SetPixelColour(int x, int y, const tColouri& colour, bool pushUndo,
 			picture->SetPixel(x, y, colour);
 	}
 
+	if (pushUndo)
+		ImgCache.Update(this);
 	if (!surpressDirty)
 		Dirty = true;
 }
@@ -789,22 +1914,49 @@ void Image::SetPixelColour(int x, int y, const tColouri& colour, bool pushUndo,
 
 void Image::SetFrameDuration(float duration, bool allFrames)
 {
+	if (!IsLoaded())
+		return;
+
 	tString desc; tsPrintf(desc, "Frame Dur %.3f", duration);
-	PushUndo(desc);
+	PushUndo(new Undo::Step_Durations(desc, Dirty, Pictures));
 
-	if (allFrames)
-	{
-		for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-			picture->Duration = duration;
-	}
-	else
-	{
-		tPicture* pic = GetCurrentPic();
-		if (pic)
-			pic->Duration = duration;
-	}
+	int frameNum = FrameNum;
+	ForEachPicture
+	(
+		[duration, allFrames, frameNum](tPicture& picture, int index)
+		{
+			if (allFrames || (index == frameNum))
+				picture.Duration = duration;
+		},
+		false
+	);
+
+	EndEdit();
+}
+
+
+void Image::Undo()
+{
+	if (!IsLoaded())
+		return;
+
+	// Flips, 90 degree rotations and duration changes go through ForEachPicture and keep the frame ring.
+	auto forEach = [this](const Undo::Step::PictureFn& edit, bool pixels) { ForEachPicture(edit, pixels); };
+	BeginEdit(UndoStack.CanUndoEach());
+	UndoStack.Undo(Pictures, Dirty, forEach);
+	ImgCache.Update(this);
+}
+
+
+void Image::Redo()
+{
+	if (!IsLoaded())
+		return;
 
-	Dirty = true;
+	auto forEach = [this](const Undo::Step::PictureFn& edit, bool pixels) { ForEachPicture(edit, pixels); };
+	BeginEdit(UndoStack.CanRedoEach());
+	UndoStack.Redo(Pictures, Dirty, forEach);
+	ImgCache.Update(this);
 }
 
 
@@ -814,6 +1966,7 @@ uint64 Image::Bind()
 	{
 		if (TexIDAlt != 0)
 		{
+			TexResidency.Touch(TexIDAlt);
 			glBindTexture(GL_TEXTURE_2D, TexIDAlt);
 			return TexIDAlt;
 		}
@@ -823,41 +1976,110 @@ uint64 Image::Bind()
 			return 0;
 
 		tList<tLayer> layers;
-		AltPicture.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
-		BindLayers(layers, TexIDAlt);
+		GenerateLayers(layers, AltPicture);
+		TexResidency.Add(this, TexIDAlt, BindLayers(layers, TexIDAlt));
 		return TexIDAlt;
 	}
 
+	// After a Retonemap the mipmaps are rebuilt, or a tiled picture is redone and its levels built and cached again,
+	// once the params stop changing.
+	bool toneSettling = ToneMipsStale && (tSystem::tGetTime() - ToneChangedTime < ToneSettleTime);
+	if (ToneMipsStale && !toneSettling)
+	{
+		ToneMipsStale = false;
+		tPicture* primary = Pictures.First();
+		if (ToneTilesStale)
+		{
+			ToneTilesStale = false;
+			Tiles.Clear();
+			if (primary && ToneSource.IsValid())
+				Tonemap::Apply(primary->GetPixelPointer(), ToneSource, LoadParams);
+		}
+
+		if (primary && (primary->TextureID != 0))
+		{
+			TexResidency.Release(primary->TextureID);
+			glDeleteTextures(1, &primary->TextureID);
+			primary->TextureID = 0;
+		}
+	}
+
+	// The overview is cached with the thumbnails, but only while the picture still matches the file and, for hdr and
+	// exr, the load params.
+	UpdateFrameRing();
 	tPicture* currPic = GetCurrentPic();
+	if (currPic && TiledTexture::NeedsTiling(currPic->GetWidth(), currPic->GetHeight()))
+	{
+		if (Tiles.GetPicture() != currPic)
+		{
+			tuint256 key = 0;
+			if (!Dirty && !toneSettling)
+			{
+				const char* tag = "Overview";
+				key = tHash::tHashData256((uint8*)tag, int(tStd::tStrlen(tag)));
+				key = tHash::tHashString256(Filename, key);
+				key = tHash::tHashData256((uint8*)&FileSizeB, sizeof(FileSizeB), key);
+				key = tHash::tHashData256((uint8*)&FileModTime, sizeof(FileModTime), key);
+				key = tHash::tHashData256((uint8*)&FrameNum, sizeof(FrameNum), key);
+				if (TypeSupportsProperties())
+				{
+					float params[] =
+					{
+						LoadParams.GammaValue, float(LoadParams.HDR_Exposure), LoadParams.EXR_Exposure,
+						LoadParams.EXR_Defog, LoadParams.EXR_KneeLow, LoadParams.EXR_KneeHigh
+					};
+					key = tHash::tHashData256((uint8*)params, sizeof(params), key);
+				}
+			}
+			Tiles.Set(this, currPic, key);
+		}
+
+		uint texID = Tiles.BindOverview();
+		if (texID == 0)
+			glBindTexture(GL_TEXTURE_2D, 0);
+		return texID;
+	}
+
 	if (currPic && (currPic->TextureID != 0))
 	{
+		TexResidency.Touch(currPic->TextureID);
 		glBindTexture(GL_TEXTURE_2D, currPic->TextureID);
 		return currPic->TextureID;
 	}
 
-	if (!IsLoaded())
+	if (!IsLoaded() || !currPic || !currPic->IsValid())
 		return 0;
 
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-	{
-		if (!picture->IsValid())
-			continue;
+	// Only the picture being shown is uploaded. The other frames and pages are uploaded as they come up, and the
+	// texture residency manager frees the ones not shown recently when over the video memory budget.
+	glGenTextures(1, &currPic->TextureID);
+	if (currPic->TextureID == 0)
+		return 0;
 
-		glGenTextures(1, &picture->TextureID);
+	tList<tLayer> layers;
+	GenerateLayers(layers, *currPic);
+	TexResidency.Add(this, currPic->TextureID, BindLayers(layers, currPic->TextureID));
+	return currPic->TextureID;
+}
 
-		tList<tLayer> layers;
-		picture->GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
-		BindLayers(layers, picture->TextureID);
-	}
-	return GetCurrentPic()->TextureID;
+
+void Image::GenerateLayers(tList<tLayer>& layers, tPicture& picture)
+{
+	LoadStatistics::Stopwatch stopwatch;
+	picture.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
+	LoadStats.Record(Filetype, LoadStatistics::Stage::Mipmaps, stopwatch.Lap(), 0, int64(picture.GetNumPixels()));
 }
 
 
-void Image::BindLayers(const tList<tLayer>& layers, uint texID)
+int64 Image::BindLayers(const tList<tLayer>& layers, uint texID)
 {
 	if (layers.IsEmpty())
-		return;
+		return 0;
 
+	// The time is how long the driver takes to accept the data. It may finish the transfer later.
+	LoadStatistics::Stopwatch stopwatch;
+	int64 numBytes = 0;
+	int64 numPixels = 0;
 	glBindTexture(GL_TEXTURE_2D, texID);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -895,7 +2117,11 @@ void Image::BindLayers(const tList<tLayer>& layers, uint texID)
 			// place. This is why PixelFormat_B8G8R8A8 is quite efficient for example.
 			glTexImage2D(GL_TEXTURE_2D, mipmapLevel, dstFormat, layer->Width, layer->Height, 0, srcFormat, srcType, layer->Data);
 		}
+		numBytes += layer->GetDataSize();
+		numPixels += int64(layer->Width) * int64(layer->Height);
 	}
+	LoadStats.Record(Filetype, LoadStatistics::Stage::Upload, stopwatch.Lap(), numBytes, numPixels);
+	return numBytes;
 }
 
 
@@ -979,49 +2205,53 @@ void Image::GetGLFormatInfo(GLint& srcFormat, GLenum& srcType, GLint& dstFormat,
 }
 
 
-bool Image::ConvertTexture2DToPicture()
+bool Image::ConvertTexture2DToPicture(tTexture& ddsTexture2D, int fitWidth, int fitHeight)
 {
-	if (!DDSTexture2D.IsValid() || !(Pictures.Count() <= 0))
+	if (!ddsTexture2D.IsValid() || !(Pictures.Count() <= 0))
 		return false;
 
-	int w = DDSTexture2D.GetWidth();
-	int h = DDSTexture2D.GetHeight();
-
-	// We need to get the data into the GPU so we cat read the uncompressed version back.
-	uint tempTexID = 0;
-	glGenTextures(1, &tempTexID);
-	if (tempTexID == 0)
-		return false;
+	// A reduced load decodes just one mipmap. They get smaller as we go so the last one that fills the box is it.
+	const tList<tLayer>& layers = ddsTexture2D.GetLayers();
+	tLayer* only = nullptr;
+	if ((fitWidth > 0) && (fitHeight > 0))
+	{
+		only = layers.First();
+		for (tLayer* layer = layers.First(); layer; layer = layer->Next())
+			if (Fills(layer->Width, layer->Height, fitWidth, fitHeight))
+				only = layer;
+		Info.SrcWidth = layers.First()->Width;
+		Info.SrcHeight = layers.First()->Height;
+	}
 
-	const tList<tLayer>& layers = DDSTexture2D.GetLayers();
-	BindLayers(layers, tempTexID);
+	// Decoding is done on the CPU so no OpenGL context is needed. This lets worker threads load DDS files. All the
+	// mipmaps are decoded together so the work spreads over every core.
+	std::vector<BlockCodec::DecodeItem> items;
+	for (tLayer* layer = layers.First(); layer; layer = layer->Next())
+	{
+		if (only && (layer != only))
+			continue;
+		tPixel* pixels = new tPixel[layer->Width * layer->Height];
+		items.push_back({ pixels, layer->PixelFormat, layer->Data, layer->Width, layer->Height });
+	}
 
-	int numMipmaps = DDSTexture2D.GetNumLayers();
-	for (int level = 0; level < numMipmaps; level++)
+	if (!BlockCodec::DecodeMany(items.data(), int(items.size())))
 	{
-		int mipW = w >> level;
-		tiClampMin(mipW, 1);
-		int mipH = h >> level;
-		tiClampMin(mipH, 1);
-		uint8* rgbaData = new uint8[mipW * mipH * 4];
-		glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, rgbaData);
-		Pictures.Append(new tPicture(mipW, mipH, (tPixel*)rgbaData, false));
+		for (BlockCodec::DecodeItem& item : items)
+			delete[] item.Dst;
+		return false;
 	}
 
-	glDeleteTextures(1, &tempTexID);
+	for (BlockCodec::DecodeItem& item : items)
+		Pictures.Append(new tPicture(item.Width, item.Height, item.Dst, false));
 	return true;
 }
 
 
-bool Image::ConvertCubemapToPicture()
+bool Image::ConvertCubemapToPicture(tCubemap& ddsCubemap, int fitWidth, int fitHeight)
 {
-	if (!DDSCubemap.IsValid() || !(Pictures.Count() <= 0))
+	if (!ddsCubemap.IsValid() || !(Pictures.Count() <= 0))
 		return false;
 
-	tTexture* tex = DDSCubemap.GetSide(tCubemap::tSide::PosX);
-	int w = tex->GetWidth();
-	int h = tex->GetHeight();
-
 	// We want the front (+Z) to be the first image.
 	int sideOrder[int(tCubemap::tSide::NumSides)] =
 	{
@@ -1033,234 +2263,298 @@ bool Image::ConvertCubemapToPicture()
 		int(tCubemap::tSide::NegY)
 	};
 
-	for (int s = 0; s < int(tCubemap::tSide::NumSides); s++)
+	// Only the top mipmap of each side is used. The sides are decoded together on the CPU. A reduced load only wants
+	// the front, and from that the smallest mipmap that fills the fit box.
+	bool reduce = (fitWidth > 0) && (fitHeight > 0);
+	int numSides = reduce ? 1 : int(tCubemap::tSide::NumSides);
+	std::vector<BlockCodec::DecodeItem> items;
+	for (int s = 0; s < numSides; s++)
 	{
-		int side = sideOrder[s];
-		uint tempTexID = 0;
-		glGenTextures(1, &tempTexID);
-
-		tTexture* tex = DDSCubemap.GetSide(tCubemap::tSide(side));
-		BindLayers(tex->GetLayers(), tempTexID);
-
-		uint8* rgbaData = new uint8[w * h * 4];
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgbaData);
-		Pictures.Append(new tPicture(w, h, (tPixel*)rgbaData, false));
+		tTexture* tex = ddsCubemap.GetSide(tCubemap::tSide(sideOrder[s]));
+		tLayer* layer = tex->GetLayers().First();
+		if (reduce)
+		{
+			Info.SrcWidth = layer->Width;
+			Info.SrcHeight = layer->Height;
+			for (tLayer* mip = layer->Next(); mip; mip = mip->Next())
+				if (Fills(mip->Width, mip->Height, fitWidth, fitHeight))
+					layer = mip;
+		}
+		tPixel* pixels = new tPixel[layer->Width * layer->Height];
+		items.push_back({ pixels, layer->PixelFormat, layer->Data, layer->Width, layer->Height });
+	}
 
-		glDeleteTextures(1, &tempTexID);
+	if (!BlockCodec::DecodeMany(items.data(), int(items.size())))
+	{
+		for (BlockCodec::DecodeItem& item : items)
+			delete[] item.Dst;
+		return false;
 	}
+
+	for (BlockCodec::DecodeItem& item : items)
+		Pictures.Append(new tPicture(item.Width, item.Height, item.Dst, false));
 	return true;
 }
 
 
-uint64 Image::BindThumbnail()
+bool Image::BindThumbnail(ThumbnailAtlas::Region& region)
 {
 	if (!ThumbnailRequested)
-		return 0;
-
-	if (!ThumbnailThreadFlag.test_and_set())
-	{
-		ThumbnailThread.join();
-		ThumbnailThreadRunning = false;
-		ThumbnailNumThreadsRunning--;
-	}
-
-	if (ThumbnailThreadRunning)
-		return 0;
+		return false;
 
-	// We only ever access ThumbnailPicture once the worker thread is completed,
-	// If the worker thread failed, ThumbnailPicture will be invalid and we return 0.
+	// ThumbnailPicture belongs to the main thread. Jobs write to ThumbnailResult, which is only moved over in the
+	// completion, so a thumbnail stays visible while a different level is generated. An invalidated one must wait
+	// for any job in flight since that job may be reading the old file.
 	if (ThumbnailInvalidateRequested)
 	{
+		if (ThumbnailJob)
+			return false;
 		ThumbnailRequested = false;
 		ThumbnailInvalidateRequested = false;
+		ThumbnailLevel = -1;
 		ThumbnailPicture.Clear();
-		if (TexIDThumbnail != 0)
-		{
-			glDeleteTextures(1, &TexIDThumbnail);
-			TexIDThumbnail = 0;
-		}
-		return 0;
+		ThumbAtlas.Free(ThumbnailHandle);
+		return false;
 	}
 
-	if (ThumbnailPicture.IsValid())
+	// The lookup fails the first time and whenever the atlas has evicted us.
+	if (ThumbAtlas.Lookup(ThumbnailHandle, region))
+		return true;
+
+	// The pixels were freed after the upload, so an evicted thumbnail has to be read back from the thumbnail cache.
+	// Forgetting the level makes the next RequestThumbnail queue a job for it. The handle is freed so that only
+	// happens once per eviction.
+	if (!ThumbnailPicture.IsValid())
 	{
-		if (TexIDThumbnail != 0)
+		if (ThumbnailHandle.IsValid() && !ThumbnailJob)
 		{
-			glBindTexture(GL_TEXTURE_2D, TexIDThumbnail);
-			return TexIDThumbnail;
+			ThumbAtlas.Free(ThumbnailHandle);
+			ThumbnailLevel = -1;
 		}
-
-		glGenTextures(1, &TexIDThumbnail);
-		if (TexIDThumbnail == 0)
-			return 0;
-
-		tList<tLayer> layers;
-		ThumbnailPicture.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
-		BindLayers(layers, TexIDThumbnail);
-		return TexIDThumbnail;
+		return false;
 	}
 
-	return 0;
+	// The upload may be deferred a frame or two. Once done the atlas has the only copy we need.
+	if (!ThumbAtlas.Allocate(ThumbnailHandle, ThumbnailPicture) || !ThumbAtlas.Lookup(ThumbnailHandle, region))
+		return false;
+
+	ThumbnailPicture.Clear();
+	return true;
 }
 
 
-void Image::GenerateThumbnailBridge(Image* img)
+bool Image::PrewarmThumbnail()
 {
-	img->GenerateThumbnail();
+	return GenerateThumbnail(-1);
 }
 
 
-void Image::GenerateThumbnail()
+bool Image::GenerateThumbnail(int level)
 {
-	// This thread (only) is allowed to access ThumbnailPicture. The main thread will leave it alone until GenerateThumbnail is complete.
-	if (ThumbnailPicture.IsValid())
-		return;
+	// This worker (only) is allowed to access ThumbnailResult. The main thread will leave it alone until the job
+	// completes. Every level has its own cache record so switching levels is usually just a cache read. A negative
+	// level only fills the cache, and only if some level is missing. The size and modification time are the same
+	// ones Load uses.
+	int64 fileSize = 0;
+	std::time_t modTime = 0;
+	if (!MappedFile::GetInfo(Filename, fileSize, modTime))
+		return false;
 
-	// Retrieve from cache if possible.
 	tuint256 hash = 0;
-	int thumbVersion = 2;
-	tFileInfo fileInfo;
-	tGetFileInfo(fileInfo, Filename);
+	int thumbVersion = 6;
 	hash = tHash::tHashData256((uint8*)&thumbVersion, sizeof(thumbVersion));
 	hash = tHash::tHashString256(Filename, hash);
-	hash = tHash::tHashData256((uint8*)&fileInfo.FileSize, sizeof(fileInfo.FileSize), hash);
-	hash = tHash::tHashData256((uint8*)&fileInfo.CreationTime, sizeof(fileInfo.CreationTime), hash);
-	hash = tHash::tHashData256((uint8*)&fileInfo.ModificationTime, sizeof(fileInfo.ModificationTime), hash);
-	hash = tHash::tHashData256((uint8*)&ThumbWidth, sizeof(ThumbWidth), hash);
-	hash = tHash::tHashData256((uint8*)&ThumbHeight, sizeof(ThumbHeight), hash);
-	tString hashFile;
-	tsPrintf(hashFile, "%s%032|256X.bin", ThumbCacheDir.Chars(), hash);
-	if (tFileExists(hashFile))
-	{
-		bool loaded = false;
-		tChunkReader chunk(hashFile);
-		for (tChunk ch = chunk.First(); ch.IsValid(); ch = ch.Next())
-		{
-			switch (ch.ID())
-			{
-				case ThumbChunkInfoID:
-					ch.GetItem(CachePrimaryWidth);
-					ch.GetItem(CachePrimaryHeight);
-					ch.GetItem(CachePrimaryArea);
-					break;
-
-				case tChunkID::Image_Picture:
-					ThumbnailPicture.Load(ch);
-					loaded = true;
-					break;
-			}
-		}
-		if (loaded)
-			return;
-	}
+	hash = tHash::tHashData256((uint8*)&fileSize, sizeof(fileSize), hash);
+	hash = tHash::tHashData256((uint8*)&modTime, sizeof(modTime), hash);
 
-	// We need an opengl context if we are processing dds files (for now... opengl is used for decompression). GLFW doesn't support creating
-	// contexts without an associated window. However, contexts with hidden windows can be created with the GLFW_VISIBLE window hint.
-	GLFWwindow* offscreenContext = nullptr;
-	if (Filetype == tFileType::DDS)
+	tuint256 levelHashes[NumThumbLevels];
+	for (int l = 0; l < NumThumbLevels; l++)
 	{
-		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-		offscreenContext = glfwCreateWindow(32, 32, "placeholdertitle", nullptr, nullptr);
-		if (!offscreenContext)
-			return;
-
-		glfwMakeContextCurrent(offscreenContext);
+		int levelW = GetThumbLevelWidth(l);
+		int levelH = GetThumbLevelHeight(l);
+		levelHashes[l] = tHash::tHashData256((uint8*)&levelW, sizeof(levelW), hash);
+		levelHashes[l] = tHash::tHashData256((uint8*)&levelH, sizeof(levelH), levelHashes[l]);
 	}
 
-	Image thumbLoader;
-	int maxLoadAttempts = 5;
-	for (int attempt = 0; attempt < maxLoadAttempts; attempt++)
+	std::vector<uint8> record;
+	if (level >= 0)
 	{
-		bool thumbLoaded = thumbLoader.Load(Filename);
-		if (thumbLoaded)
-			break;
-		else
-			tSystem::tSleep(250);
+		if (ThumbCache.Get(levelHashes[level], record) && DecodeThumbRecord(record))
+			return false;
 	}
-
-	if (Filetype == tFileType::DDS)
+	else
 	{
-		glfwMakeContextCurrent(nullptr);
-		glfwDestroyWindow(offscreenContext);
+		int numCached = 0;
+		for (int l = 0; l < NumThumbLevels; l++)
+			if (ThumbCache.Contains(levelHashes[l]))
+				numCached++;
+		if (numCached == NumThumbLevels)
+			return false;
 	}
 
+	// DDS files are decoded on the CPU so no OpenGL context is needed here. Formats that can are decoded at a reduced
+	// size that is still big enough for the largest level.
+	int maxLevelW = GetThumbLevelWidth(NumThumbLevels-1);
+	int maxLevelH = GetThumbLevelHeight(NumThumbLevels-1);
+	// This runs on a pool worker, so a file that fails to load is not retried. Sleeping here would hold up every other
+	// job queued behind it.
+	Image thumbLoader;
+	thumbLoader.Load(Filename, maxLevelW, maxLevelH);
+
 	// Thumbnails are generated from the primary (first) picture in the picture list.
 	tPicture* srcPic = thumbLoader.GetPrimaryPic();
 	if (!srcPic)
-		return;
+		return false;
 
-	// We make the thumbnail keep its aspect ratio.
+	// We make the thumbnail keep its aspect ratio. The cached size is the size in the file, not of a reduced decode.
 	int srcW = srcPic->GetWidth();
 	int srcH = srcPic->GetHeight();
-	CachePrimaryWidth = srcW;
-	CachePrimaryHeight = srcH;
-	CachePrimaryArea = srcW * srcH;
-
-	float scaleX = float(ThumbWidth)  / float(srcW);
-	float scaleY = float(ThumbHeight) / float(srcH);
-	int iw, ih;
-	if (scaleX < scaleY)
-	{
-		iw = ThumbWidth;
-		ih = int(tRound(float(srcH)*scaleX));
-	}
-	else
+	CachePrimaryWidth = thumbLoader.Info.SrcWidth;
+	CachePrimaryHeight = thumbLoader.Info.SrcHeight;
+	CachePrimaryArea = CachePrimaryWidth * CachePrimaryHeight;
+
+	// One area-average pass takes the source straight to its fitted size inside the largest level. Every level,
+	// including the largest, is then reduced from that and letterboxed in the same pass. The fitted picture is used
+	// rather than the letterboxed one so the transparent border never bleeds into the smaller levels.
+	int fitW, fitH;
+	AreaResample::GetFitSize(fitW, fitH, srcW, srcH, maxLevelW, maxLevelH);
+	tPicture fitted;
+	AreaResample::Resample(fitted, *srcPic, fitW, fitH);
+	thumbLoader.Unload();
+
+	for (int l = NumThumbLevels-1; l >= 0; l--)
 	{
-		ih = ThumbHeight;
-		iw = int(tRound(float(srcW)*scaleY));
+		tPicture levelPic;
+		AreaResample::ResampleFit(levelPic, fitted, GetThumbLevelWidth(l), GetThumbLevelHeight(l));
+		PutThumbRecord(levelHashes[l], levelPic, record);
+		if (l == level)
+			ThumbnailResult.Set(levelPic);
 	}
-	tAssert((iw == ThumbWidth) || (ih == ThumbHeight));
 
-	// Create an image that is big (or small) enough to exactly match either the width or height without ruining the aspect.
-	srcPic->Resample(iw, ih, tResampleFilter::Bilinear);
+	return true;
+}
+
+
+bool Image::DecodeThumbRecord(const std::vector<uint8>& record)
+{
+	if (record.size() < sizeof(ThumbRecordHeader))
+		return false;
+
+	ThumbRecordHeader header;
+	tStd::tMemcpy(&header, record.data(), sizeof(ThumbRecordHeader));
+	tPixelFormat format = tPixelFormat(header.PixelFormat);
+	const uint8* data = record.data() + sizeof(ThumbRecordHeader);
+	int numPixels = header.Width * header.Height;
+	if ((header.ChunkID != ThumbChunkInfoID) || (numPixels <= 0) || !BlockCodec::IsSupported(format))
+		return false;
+
+	if
+	(
+		(int(header.DataSize) != BlockCodec::GetDataSize(format, header.Width, header.Height)) ||
+		(record.size() != sizeof(ThumbRecordHeader) + header.DataSize)
+	)
+		return false;
+
+	CachePrimaryWidth = header.PrimaryWidth;
+	CachePrimaryHeight = header.PrimaryHeight;
+	CachePrimaryArea = header.PrimaryArea;
+	tPixel* pixels = new tPixel[numPixels];
+	BlockCodec::Decode(pixels, format, data, header.Width, header.Height);
+	ThumbnailResult.Set(header.Width, header.Height, pixels, false);
+	return true;
+}
+
+
+void Image::PutThumbRecord(const tuint256& key, tPicture& picture, std::vector<uint8>& record)
+{
+	// Block compression makes records 4 to 8 times smaller than raw RGBA. Thumbnails that were letterboxed only have
+	// fully transparent or fully opaque pixels, so they can use BC1 with binary alpha.
+	tPixelFormat format = BlockCodec::ChooseFormat(picture.GetPixelPointer(), picture.GetNumPixels());
+	ThumbRecordHeader header;
+	header.ChunkID			= ThumbChunkInfoID;
+	header.PrimaryWidth		= CachePrimaryWidth;
+	header.PrimaryHeight	= CachePrimaryHeight;
+	header.PrimaryArea		= CachePrimaryArea;
+	header.Width			= picture.GetWidth();
+	header.Height			= picture.GetHeight();
+	header.PixelFormat		= uint32(format);
+	header.DataSize			= BlockCodec::GetDataSize(format, header.Width, header.Height);
+	record.resize(sizeof(ThumbRecordHeader) + header.DataSize);
+	tStd::tMemcpy(record.data(), &header, sizeof(ThumbRecordHeader));
+	BlockCodec::Encode(record.data() + sizeof(ThumbRecordHeader), format, picture.GetPixelPointer(), header.Width, header.Height);
+	ThumbCache.Put(key, record.data(), int(record.size()));
+}
+
+
+void Image::CompleteThumbnail(int level)
+{
+	// Runs on the main thread once the job is done. A failed job leaves any previous level in place. Either way we
+	// don't ask for this level again unless the thumbnail is unrequested or invalidated.
+	ThumbnailJob.reset();
+	ThumbnailLevel = level;
+	if (!ThumbnailResult.IsValid())
+		return;
 
-	// Center-crop the image to what we need. Cropping to a bigger size adds transparent pixels.
-	srcPic->Crop(ThumbWidth, ThumbHeight);
+	ThumbnailPicture.Set(ThumbnailResult);
+	ThumbnailResult.Clear();
+	ThumbAtlas.Free(ThumbnailHandle);
+}
 
-	ThumbnailPicture.Set(*srcPic);
 
-	// Write to cache file.
-	tChunkWriter writer(hashFile);
-	writer.Begin(ThumbChunkInfoID);
-	writer.Write(CachePrimaryWidth);
-	writer.Write(CachePrimaryHeight);
-	writer.Write(CachePrimaryArea);
-	writer.Write(0x00000000);
-	writer.End();
-	ThumbnailPicture.Save(writer);
-	// std::this_thread::sleep_for(std::chrono::milliseconds(100));
+int Image::GetThumbLevel(float displayWidth)
+{
+	for (int l = 0; l < NumThumbLevels; l++)
+		if (float(GetThumbLevelWidth(l)) >= displayWidth)
+			return l;
+	return NumThumbLevels-1;
 }
 
 
-void Image::RequestThumbnail()
+void Image::RequestThumbnail(WorkerPool::Priority priority, int level)
 {
-	if (ThumbnailRequested)
+	// If a job is already queued we only need to move it to the requested lane. This fails harmlessly if it started.
+	// A different level is picked up when the job completes and we are asked again.
+	if (ThumbnailJob)
+	{
+		if (Workers.GetPriority(ThumbnailJob) != priority)
+			Workers.Reprioritize(ThumbnailJob, priority);
 		return;
+	}
 
-	// Leave one core free unless we are on a two core or lower machine, in which case we always use a min of 2 threads.
-	int numThreadsMax = tClampMin((tSystem::tGetNumCores()) - 1, 2);
-	if (ThumbnailNumThreadsRunning >= numThreadsMax)
+	level = tClamp(level, 0, NumThumbLevels-1);
+	if (ThumbnailRequested && (level == ThumbnailLevel))
 		return;
 
+	// While the new level is generated any existing thumbnail continues to be displayed.
 	ThumbnailRequested = true;
-	ThumbnailThreadRunning = true;
-	ThumbnailNumThreadsRunning++;
-	ThumbnailThreadFlag.test_and_set();
-	ThumbnailThread = std::thread
+	ThumbnailJob = Workers.Submit
 	(
-		[this]
-		{
-			GenerateThumbnailBridge(this);
-			ThumbnailThreadFlag.clear();
-		}
+		priority,
+		[this, level] { GenerateThumbnail(level); },
+		[this, level] { CompleteThumbnail(level); }
 	);
 }
 
 
 void Image::UnrequestThumbnail()
 {
-	if (ThumbnailRequested && !ThumbnailThreadRunning && !ThumbnailPicture.IsValid())
-		ThumbnailRequested = false;
+	if (!ThumbnailRequested)
+		return;
+
+	// A job that's already running is left to finish. Its result will be used the next time we bind.
+	if (ThumbnailJob)
+	{
+		if (!Workers.Cancel(ThumbnailJob))
+			return;
+		ThumbnailJob.reset();
+	}
+
+	// A finished thumbnail is kept.
+	if (HasThumbnail())
+		return;
+
+	ThumbnailRequested = false;
+	ThumbnailLevel = -1;
 }
 
 
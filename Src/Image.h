@@ -15,9 +15,11 @@
 #pragma once
 #include <thread>
 #include <atomic>
+#include <vector>
 #include <glad/glad.h>
 #include <Foundation/tList.h>
 #include <Foundation/tString.h>
+#include <Foundation/tHash.h>
 #include <System/tFile.h>
 #include <Image/tPicture.h>
 #include <Image/tTexture.h>
@@ -25,6 +27,12 @@
 #include <Image/tImageHDR.h>
 #include "Settings.h"
 #include "Undo.h"
+#include "WorkerPool.h"
+#include "ThumbnailAtlas.h"
+#include "TiledTexture.h"
+#include "ImageCache.h"
+#include "TextureResidency.h"
+#include "Tonemap.h"
 namespace Viewer
 {
 
@@ -44,6 +52,12 @@ public:
 	void ResetLoadParams();
 	tImage::tPicture::LoadParams LoadParams;
 
+	// Hdr and exr images keep their linear pixels after loading so a change to the load params can be shown without
+	// reading the file again. Retonemap redoes the primary picture from them and updates its texture in place. The
+	// mipmaps are rebuilt once the params stop changing. Edits drop the linear pixels, after which a reload is needed.
+	bool CanRetonemap() const																							{ return ToneSource.IsValid(); }
+	void Retonemap();
+
 	void Play();
 	void Stop();
 	void UpdatePlaying(float dt);
@@ -56,9 +70,23 @@ public:
 	int FrameNum						= 0;
 
 	static void GetCanLoad(tSystem::tExtensions&);					// Clears the extensions ref before populating.
-	bool Load(const tString& filename);
-	bool Load();													// Load into main memory.
+	// Load into main memory. If a fit size is given, a smaller image may be returned, though never so small it would
+	// need enlarging to fill a fitWidth by fitHeight box. Smaller versions the file already carries are preferred: a
+	// jpg exif thumbnail, a dds mipmap, or an ico or tiff sub-image. Failing that jpg and still webp are decoded at a
+	// reduced size. That's for callers like thumbnailing that only want a small version and throw the image away.
+	bool Load(const tString& filename, int fitWidth = 0, int fitHeight = 0);
+	bool Load(int fitWidth = 0, int fitHeight = 0);
 	bool IsLoaded() const																								{ return (Pictures.Count() > 0); }
+
+	// Loads into main memory on a worker thread. Call from the main thread. The file is decoded into a separate image
+	// that is handed over when the job completes, so until then this image is simply not loaded and may be used
+	// normally. Calling again while a load is in flight only moves it to the supplied lane, which is how a prefetch
+	// becomes a foreground load when the user reaches it.
+	void RequestLoad(WorkerPool::Priority = WorkerPool::Priority::Foreground);
+
+	// A queued load never runs. A running one is asked to stop at the next opportunity and its result is discarded.
+	void CancelLoad();
+	bool IsLoading() const																								{ return bool(LoadJob); }
 	int GetNumFrames() const																							{ return Pictures.Count(); }
 
 	bool IsOpaque() const;
@@ -69,20 +97,27 @@ public:
 	// functions require a texture ID as parameter, this function return the ID.
 	// If the alt image is enabled, the bound texture and ID  will be the alt image's.
 	// Returns 0 (invalid id) if there was a problem.
+	// Pictures too big for a single texture are tiled and the ID is that of a reduced overview. It is 0 until the
+	// overview has been made. DrawTiles then draws the full resolution detail over the top.
 	uint64 Bind();
 	void Unbind();
+	bool IsTiled() const																								{ return Tiles.GetPicture() != nullptr; }
+	bool IsTiling() const																								{ return IsTiled() && !Tiles.IsOverviewReady(); }
+	void DrawTiles(float left, float right, float bottom, float top, float u0, float v0, float u1, float v1)			{ Tiles.Draw(left, right, bottom, top, u0, v0, u1, v1); }
 	int GetWidth() const;
 	int GetHeight() const;
 	int GetArea() const;
 	tColouri GetPixel(int x, int y) const;
 
 	// Some images can store multiple complete images inside a single file (multiple frames).
-	// The primary one is the first one.
+	// The primary one is the first one. Long animations only keep the frames near FrameNum decoded. The current one is
+	// decoded on demand if it isn't already, and GetPictures decodes them all. The const getters above never decode.
 	tImage::tPicture* GetPrimaryPic() const																				{ return Pictures.First(); }
-	tImage::tPicture* GetCurrentPic() const																				{ tImage::tPicture* pic = Pictures.First(); for (int i = 0; i < FrameNum; i++) pic = pic ? pic->Next() : nullptr; return pic; }
-	tList<tImage::tPicture>& GetPictures()																				{ return Pictures; }
+	tImage::tPicture* GetCurrentPic();
+	tList<tImage::tPicture>& GetPictures()																				{ UnparkFrames(); return Pictures; }
 
-	// Functions that edit and cause dirty flag to be set.
+	// Functions that edit and cause dirty flag to be set. Like Undo and Redo they do nothing until the image is
+	// loaded, as key presses and dialogs can get to them while it is still loading.
 	void Rotate90(bool antiClockWise);
 	void Rotate(float angle, const tColouri& fill, tImage::tResampleFilter upFilter, tImage::tResampleFilter downFilter);
 	void Flip(bool horizontal);
@@ -94,8 +129,8 @@ public:
 	void SetFrameDuration(float duration, bool allFrames = false);
 
 	// Undo and redo functions.
-	void Undo()																											{ UndoStack.Undo(Pictures, Dirty); }
-	void Redo()																											{ UndoStack.Redo(Pictures, Dirty); }
+	void Undo();
+	void Redo();
 	bool IsUndoAvailable() const																						{ return UndoStack.UndoAvailable(); }
 	bool IsRedoAvailable() const																						{ return UndoStack.RedoAvailable(); }
 	tString GetUndoDesc() const																							{ tString desc; tsPrintf(desc, "[%s]", UndoStack.GetUndoDesc().Chars()); return desc; }
@@ -111,29 +146,40 @@ public:
 		tImage::tPixelFormat SrcPixelFormat	= tImage::tPixelFormat::Invalid;
 		bool Opaque							= false;
 		int FileSizeBytes					= 0;
-		int MemSizeBytes					= 0;
+		int64 MemSizeBytes					= 0;
+		int SrcWidth						= 0;		// Primary picture size in the file. Only differs from the
+		int SrcHeight						= 0;		// picture if a fit size was given to Load.
 	};
 
-	bool IsAltMipmapsPictureAvail() const																				{ return DDSTexture2D.IsValid() && AltPicture.IsValid(); }
-	bool IsAltCubemapPictureAvail() const																				{ return DDSCubemap.IsValid() && AltPicture.IsValid(); }
-	void EnableAltPicture(bool enabled)																					{ AltPictureEnabled = enabled; }
+	// The alt picture is built the first time it is enabled.
+	bool IsAltMipmapsPictureAvail() const																				{ return AltType == AltPictureType::Mipmaps; }
+	bool IsAltCubemapPictureAvail() const																				{ return AltType == AltPictureType::Cubemap; }
+	void EnableAltPicture(bool enabled);
 	bool IsAltPictureEnabled() const																					{ return AltPictureEnabled; }
 
-	// Thumbnail generation is done on a seperate thread. Calling RequestThumbnail starts the thread. You should call it
-	// over and over as it will only ever start one thread, and it may not start it if too mnay threads are already
-	// working. BindThumbnail will at some point return a non-zero texture ID, but not necessarily right away. Just keep
-	// calling it. Unloaded images remain unloaded after thumbnail generation.
-	void RequestThumbnail();
+	// Thumbnail generation is done by the worker pool. Calling RequestThumbnail queues a job at the supplied priority.
+	// You should call it over and over as it will only ever queue one job. Calling it again with a different priority
+	// moves the job to that lane if it hasn't started yet. Thumbnails are generated and cached at NumThumbLevels
+	// sizes. Requesting a different level replaces the thumbnail once the new level is ready. BindThumbnail will at
+	// some point return true and fill in the atlas region, but not necessarily right away. Just keep calling it for
+	// thumbnails that are on screen. The pixels are freed once they are in the atlas. Ones that aren't drawn for a
+	// while are evicted, after which the next request reads them back from the thumbnail cache. Unloaded images remain
+	// unloaded after thumbnail generation.
+	void RequestThumbnail(WorkerPool::Priority = WorkerPool::Priority::Visible, int level = 1);
 
 	// Call this if you need to invaidate the thumbnail. For example, if the file was saved/edited this should be called
 	// to force regeneration.
 	void RequestInvalidateThumbnail();
 
-	// You are allowed to unrequest. It will succeed if a worker was never assigned.
+	// You are allowed to unrequest. It will succeed if the job has not started yet, in which case it is cancelled.
 	void UnrequestThumbnail();
-	bool IsThumbnailWorkerActive() const																				{ return ThumbnailThreadRunning; }
-	uint64 BindThumbnail();
-	inline static int GetThumbnailNumThreadsRunning()																	{ return ThumbnailNumThreadsRunning; }
+	bool IsThumbnailWorkerActive() const																				{ return bool(ThumbnailJob); }
+	bool IsThumbnailAvailable() const																					{ return !ThumbnailInvalidateRequested && HasThumbnail(); }
+	bool BindThumbnail(ThumbnailAtlas::Region&);
+
+	// Generates and caches every thumbnail level if any are missing. Blocks. May be called from a worker on an image
+	// that is not in the Images list. Returns true if the file had to be loaded.
+	bool PrewarmThumbnail();
 
 	ImgInfo Info;						// Info is only valid AFTER loading.
 	tString Filename;					// Valid before load.
@@ -145,52 +191,159 @@ public:
 	int CachePrimaryArea	= 0;
 
 	const static uint32 ThumbChunkInfoID;
-	const static int ThumbWidth;		// = 256;
-	const static int ThumbHeight;		// = 144;
+	const static int ThumbWidth;		// = 512; The largest level.
+	const static int ThumbHeight;		// = 288;
 	const static int ThumbMinDispWidth;	// = 64;
+
+	// Levels are 16:9 and double in width from 64 to 512. GetThumbLevel returns the smallest level at least as wide as
+	// the supplied display width in pixels.
+	const static int NumThumbLevels = 4;
+	const static int ThumbLevelWidths[NumThumbLevels];
+	static int GetThumbLevelWidth(int level)																			{ return ThumbLevelWidths[level]; }
+	static int GetThumbLevelHeight(int level)																			{ return ThumbLevelWidths[level]*9/16; }
+	static int GetThumbLevel(float displayWidth);
 	static tString ThumbCacheDir;
 
 	bool TypeSupportsProperties() const;
 
 private:
-	void PushUndo(const tString& desc)																					{ UndoStack.Push(Pictures, desc, Dirty); }
-
-	// Dds files are special and already in HW ready format. The tTexture can store dds files, while tPicture stores
-	// other types (tga, gif, jpg, bmp, tif, png, etc). If the image is a dds file, the tTexture is valid and in order
-	// to read pixel data, the image is fetched from the framebuffer to ALSO make a valid PictureImage.
-	//
-	// Note: A tTexture contains all mipmap levels while a tPicture does not. That's why we have a list of tPictures.
-	tImage::tTexture DDSTexture2D;
-	tImage::tCubemap DDSCubemap;
+	// The first snapshots all the pictures. Operations that can be reversed exactly push a smaller step of their own.
+	void PushUndo(const tString& desc)																					{ BeginEdit(); UndoStack.Push(Pictures, desc, Dirty); }
+	void PushUndo(Undo::Step* step)																						{ BeginEdit(step->CanApplyEach()); UndoStack.Push(step); }
+
+	// Dds files are special and already in HW ready format. They are loaded into a tTexture or tCubemap and decoded
+	// into the picture list. For a texture each mipmap becomes a picture. For a cubemap each side does.
 	tList<tImage::tPicture> Pictures;
 
-	// The 'alternative' picture is valid when there is another valid way of displaying the image.
-	// Specifically for cubemaps and dds files with mipmaps this offers an alternative view.
+	// Animations whose decoded frames would take more than FrameRingMinBytes are kept compressed with FrameCodec. The
+	// ring has an entry per frame and is empty otherwise. A frame is decoded while its picture is valid. Only the ones
+	// within FrameRingAhead of FrameNum in the play direction, or FrameRingBehind the other way, stay decoded and only
+	// those have textures. The primary picture is never freed. The compressed copy is kept after decoding so a frame
+	// leaving the window just has its pixels freed. Parked pictures keep their durations. Flips, 90 degree rotations
+	// and duration changes keep the ring. Anything else that edits or swaps the pictures drops it first.
+	struct RingFrame
+	{
+		tImage::tPicture* Picture			= nullptr;
+		std::vector<uint8> Data;
+		int Width							= 0;
+		int Height							= 0;
+		float Duration						= 0.0f;
+	};
+	std::vector<RingFrame> FrameRing;
+	static const int FrameRingAhead			= 8;
+	static const int FrameRingBehind		= 2;
+	static const int64 FrameRingMinBytes	= 256*1024*1024;
+
+	void ParkFrames();												// Runs at the end of Load. Starts the ring if it's worth it.
+	void UpdateFrameRing();											// Decodes at most one frame per call.
+	bool IsInFrameWindow(int frame) const;
+	void UnparkFrame(RingFrame&);
+	void UnparkFrames();
+
+	// Calls edit on every picture. Frames in the ring are decoded for the edit and compressed again after, so the ring
+	// is kept and the frames outside the window take no more memory than before. With pixels false only the durations
+	// may change and nothing is decoded. The pictures may be visited in any order and on any thread.
+	void ForEachPicture(const Undo::Step::PictureFn& edit, bool pixels);
+	tImage::tPicture* FindCurrentPic() const;						// May be parked, in which case it isn't valid.
+	const RingFrame* FindCurrentRingFrame() const;					// Null if there is no ring.
+	void DropFrameRing()																								{ UnparkFrames(); FrameRing.clear(); }
+
+	// Linear pixels for Retonemap. Only kept for full loads. ToneMipsStale is set while the texture has an up to date
+	// top level but old mipmaps, which Bind replaces ToneSettleTime seconds after the last change. ToneTilesStale is
+	// set instead while a tiled picture still has the old params, which Bind applies at the same time.
+	Tonemap::Source ToneSource;
+	bool ToneMipsStale						= false;
+	bool ToneTilesStale						= false;
+	float ToneChangedTime					= 0.0f;
+	static constexpr float ToneSettleTime	= 0.25f;
+	bool LoadLinearHDR(const uint8* data, int64 numBytes);
+	bool LoadLinearEXR();
+
+	// Called before anything changes the pictures. They no longer match the linear pixels, or the frame ring unless
+	// the edit goes through ForEachPicture. EndEdit is called after and recounts what the image cache charges for it.
+	void BeginEdit(bool keepFrameRing = false)																			{ if (!keepFrameRing) DropFrameRing(); ToneSource.Clear(); }
+	void EndEdit()																										{ Dirty = true; ImgCache.Update(this); }
+
+	// The 'alternative' picture is available when there is another valid way of displaying the image. Specifically
+	// for cubemaps and dds files with mipmaps this offers an alternative view. It is made from the picture list.
+	enum class AltPictureType
+	{
+		None,
+		Mipmaps,
+		Cubemap
+	};
+	AltPictureType AltType = AltPictureType::None;
 	bool AltPictureEnabled = false;
 	tImage::tPicture AltPicture;
 
+	WorkerPool::JobRef LoadJob;					// Valid from RequestLoad until the main thread processes the completion.
+	std::shared_ptr<std::atomic<bool>> LoadCancelled;
+	const std::atomic<bool>* CancelFlag = nullptr;	// Only set on the image a load job decodes into.
+	bool IsLoadCancelled() const																						{ return CancelFlag && *CancelFlag; }
+	void AdoptLoaded(Image&);
+
 	bool ThumbnailRequested = false;			// True if ever requested.
 	bool ThumbnailInvalidateRequested = false;
-	bool ThumbnailThreadRunning = false;		// Only true while worker thread going.
-	static int ThumbnailNumThreadsRunning;		// How many worker threads active.
-	std::thread ThumbnailThread;
-	std::atomic_flag ThumbnailThreadFlag = ATOMIC_FLAG_INIT;
-	tImage::tPicture ThumbnailPicture;
+	WorkerPool::JobRef ThumbnailJob;			// Valid from request until the main thread processes the completion.
+	int ThumbnailLevel = -1;					// Level of the last completed job.
+	tImage::tPicture ThumbnailPicture;			// Main thread only. Cleared once uploaded to the atlas.
+	tImage::tPicture ThumbnailResult;			// Written by the job. Moved to ThumbnailPicture on completion.
+	bool HasThumbnail() const																							{ return ThumbnailPicture.IsValid() || ThumbnailHandle.IsValid(); }
+
+	// These run on a pool worker thread. GenerateThumbnail returns true if the source file had to be loaded.
+	bool GenerateThumbnail(int level);
+	bool DecodeThumbRecord(const std::vector<uint8>& record);
+	void PutThumbRecord(const tuint256& key, tImage::tPicture&, std::vector<uint8>& record);
 
-	// These 2 functions run on a helper thread.
-	static void GenerateThumbnailBridge(Image*);
-	void GenerateThumbnail();
+	// Runs on the main thread when the job is done.
+	void CompleteThumbnail(int level);
 
 	// Zero is invalid and means texture has never been bound and loaded into VRAM.
 	uint TexIDAlt			= 0;
-	uint TexIDThumbnail		= 0;
+	TiledTexture Tiles;
+	ThumbnailAtlas::Handle ThumbnailHandle;
 
 	// Returns the approx main mem size of this image. Considers the Pictures list and the AltPicture.
-	int GetMemSizeBytes() const;
-	bool ConvertTexture2DToPicture();
-	bool ConvertCubemapToPicture();
+	int64 GetMemSizeBytes() const;
+
+	// What the image cache charges. The above plus the undo and redo steps.
+	friend class ImageCache;
+	ImageCache::Node CacheNode;
+	int64 GetCacheBytes() const																							{ return GetMemSizeBytes() + UndoStack.GetMemSizeBytes(); }
+
+	// Video memory is budgeted separately. The residency manager calls this to delete a texture that hasn't been bound
+	// recently. Bind uploads it again if it is needed.
+	friend class TextureResidency;
+	void EvictTexture(uint texID);
+
+	// With a fit size only the smallest mipmap that fills the fit box is decoded, and for cubemaps only the front.
+	bool ConvertTexture2DToPicture(tImage::tTexture&, int fitWidth = 0, int fitHeight = 0);
+	bool ConvertCubemapToPicture(tImage::tCubemap&, int fitWidth = 0, int fitHeight = 0);
+
+	// Only walks the chunk headers up to the first IDAT.
+	static bool IsAnimatedPNG(const uint8* data, int64 numBytes);
+
+	// Decode straight to a reduced size for Load. They return false, having added nothing, if the format can't be
+	// reduced or wouldn't get any smaller, in which case the regular loader is used.
+	bool LoadScaledJPG(const uint8* data, int64 numBytes, int fitWidth, int fitHeight);
+	bool LoadScaledWEBP(const uint8* data, int64 numBytes, int fitWidth, int fitHeight);
+
+	// Decodes the pages of a multi-page tiff on all cores. With a fit size only the page KeepFitPicture would keep is
+	// decoded. Returns false, having added nothing, for single pages and for files written by Tacent, which may carry
+	// frame durations only tImageTIFF understands.
+	bool LoadPagesTIFF(const uint8* data, int64 numBytes, int fitWidth, int fitHeight);
+
+	// Finds the jpg thumbnail in the exif block of a jpg, if it has one.
+	static bool FindExifThumbnail(const uint8* data, int64 numBytes, const uint8*& thumb, int64& thumbBytes);
+
+	// For files with several sub-images. Keeps only the smallest with the aspect of the largest that still fills the
+	// fit box in one direction.
+	void KeepFitPicture(int fitWidth, int fitHeight);
+	static bool Fills(int width, int height, int fitWidth, int fitHeight)												{ return (width >= fitWidth) || (height >= fitHeight); }
+	static bool SameAspect(int w0, int h0, int w1, int h1)																{ return tMath::tAbs(int64(w0)*h1 - int64(w1)*h0) * 50 <= int64(w0)*h1; }
 	void GetGLFormatInfo(GLint& srcFormat, GLenum& srcType, GLint& dstFormat, bool& compressed, tImage::tPixelFormat);
-	void BindLayers(const tList<tImage::tLayer>&, uint texID);
+	void GenerateLayers(tList<tImage::tLayer>&, tImage::tPicture&);		// Builds the mipmaps for Bind. Timed.
+	int64 BindLayers(const tList<tImage::tLayer>&, uint texID);		// Returns the bytes uploaded.
 	void CreateAltPictureFromDDS_2DMipmaps();
 	void CreateAltPictureFromDDS_Cubemap();
 
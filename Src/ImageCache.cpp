@@ -0,0 +1,135 @@
+// ImageCache.cpp
+//
+// Keeps track of which of the images in the current folder are loaded, how much memory each owns, and which were used
+// least recently. The images are linked through a node each one carries so touching, recounting and evicting an image
+// never searches or sorts. The charge for an image is everything it holds in main memory: its pictures and frames,
+// the alt picture, any compressed frames or linear hdr pixels, and its undo and redo steps.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <System/tFile.h>
+#include <System/tPrint.h>
+#include "ImageCache.h"
+#include "Image.h"
+using namespace tSystem;
+
+
+namespace Viewer
+{
+	ImageCache ImgCache;
+}
+
+
+void Viewer::ImageCache::Manage(Image* image)
+{
+	image->CacheNode.Managed = true;
+}
+
+
+void Viewer::ImageCache::Touch(Image* image)
+{
+	ImageCache::Node& node = image->CacheNode;
+	if (!node.Managed || !image->IsLoaded())
+		return;
+
+	if (node.Cached)
+	{
+		Unlink(image);
+		UsedBytes -= node.Bytes;
+		NumCached--;
+	}
+
+	node.Bytes = image->GetCacheBytes();
+	UsedBytes += node.Bytes;
+	NumCached++;
+	LinkNewest(image);
+}
+
+
+void Viewer::ImageCache::Update(Image* image)
+{
+	ImageCache::Node& node = image->CacheNode;
+	if (!node.Cached)
+		return;
+
+	UsedBytes -= node.Bytes;
+	node.Bytes = image->GetCacheBytes();
+	UsedBytes += node.Bytes;
+}
+
+
+void Viewer::ImageCache::Remove(Image* image)
+{
+	ImageCache::Node& node = image->CacheNode;
+	if (!node.Cached)
+		return;
+
+	Unlink(image);
+	UsedBytes -= node.Bytes;
+	NumCached--;
+	node.Bytes = 0;
+}
+
+
+int Viewer::ImageCache::Evict(int64 budgetBytes, const std::function<bool(const Image*)>& keep)
+{
+	// Unloading removes the image from the list, so the next one is read first.
+	int numEvicted = 0;
+	Image* image = Oldest;
+	while (image && (UsedBytes > budgetBytes))
+	{
+		Image* newer = image->CacheNode.Newer;
+		if (!keep(image))
+		{
+			int64 bytes = image->CacheNode.Bytes;
+			if (image->Unload())
+			{
+				tPrintf("Unloading %s freeing %|64d Bytes\n", tSystem::tGetFileName(image->Filename).Chars(), bytes);
+				numEvicted++;
+			}
+		}
+		image = newer;
+	}
+	return numEvicted;
+}
+
+
+void Viewer::ImageCache::Unlink(Image* image)
+{
+	ImageCache::Node& node = image->CacheNode;
+	if (node.Older)
+		node.Older->CacheNode.Newer = node.Newer;
+	else
+		Oldest = node.Newer;
+
+	if (node.Newer)
+		node.Newer->CacheNode.Older = node.Older;
+	else
+		Newest = node.Older;
+
+	node.Older = node.Newer = nullptr;
+	node.Cached = false;
+}
+
+
+void Viewer::ImageCache::LinkNewest(Image* image)
+{
+	ImageCache::Node& node = image->CacheNode;
+	node.Older = Newest;
+	node.Newer = nullptr;
+	if (Newest)
+		Newest->CacheNode.Newer = image;
+	else
+		Oldest = image;
+
+	Newest = image;
+	node.Cached = true;
+}
@@ -0,0 +1,76 @@
+// ImageCache.h
+//
+// Keeps track of which of the images in the current folder are loaded, how much memory each owns, and which were used
+// least recently. The images are linked through a node each one carries so touching, recounting and evicting an image
+// never searches or sorts. The charge for an image is everything it holds in main memory: its pictures and frames,
+// the alt picture, any compressed frames or linear hdr pixels, and its undo and redo steps.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <functional>
+#include <Foundation/tStandard.h>
+namespace Viewer
+{
+	class Image;
+
+
+// Main thread only. Only images that were passed to Manage are ever cached, so images the viewer uses for its own
+// interface are never counted or unloaded. Managed images are only loaded on the main thread. Load jobs decode into a
+// separate image that is handed over with AdoptLoaded.
+class ImageCache
+{
+public:
+	// The part of the cache that lives in each image.
+	struct Node
+	{
+		Image* Older						= nullptr;
+		Image* Newer						= nullptr;
+		int64 Bytes							= 0;
+		bool Managed						= false;
+		bool Cached							= false;
+	};
+
+	// Marks an image from the folder list as one the cache may hold.
+	void Manage(Image*);
+
+	// A managed image was loaded or shown. Makes it the most recently used and recounts its bytes. Images that are not
+	// managed or not loaded are ignored.
+	void Touch(Image*);
+
+	// Recounts the bytes of a cached image after it changed. Does not affect how recently it was used.
+	void Update(Image*);
+
+	// Called by the image when it unloads or is destroyed. Does nothing if it isn't cached.
+	void Remove(Image*);
+
+	// Unloads images, least recently used first, until the total is within the budget. Images for which keep returns
+	// true are skipped, as are dirty images since Unload refuses them. Returns the number unloaded.
+	int Evict(int64 budgetBytes, const std::function<bool(const Image*)>& keep);
+
+	int64 GetUsedBytes() const																							{ return UsedBytes; }
+	int GetNumCached() const																							{ return NumCached; }
+
+private:
+	void Unlink(Image*);
+	void LinkNewest(Image*);
+
+	Image* Oldest							= nullptr;
+	Image* Newest							= nullptr;
+	int64 UsedBytes							= 0;
+	int NumCached							= 0;
+};
+
+
+extern ImageCache ImgCache;
+
+
+}
@@ -0,0 +1,222 @@
+// LoadStats.cpp
+//
+// Timing of every stage of getting an image from disk onto the screen, kept separately for each file type. Each stage
+// remembers its most recent samples so the figures follow what the viewer is doing now rather than the whole session.
+// The load statistics window shows them and they can be saved to a text file to compare machines and builds.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <algorithm>
+#include "imgui.h"
+#include "LoadStats.h"
+#include "TacentView.h"
+using namespace tSystem;
+
+
+namespace Viewer
+{
+	LoadStatistics LoadStats;
+}
+
+
+double Viewer::LoadStatistics::Stopwatch::Lap()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - Last).count();
+	Last = now;
+	return seconds;
+}
+
+
+const char* Viewer::LoadStatistics::GetStageName(Stage stage)
+{
+	switch (stage)
+	{
+		case Stage::Read:		return "Read";
+		case Stage::Decode:		return "Decode";
+		case Stage::Frames:		return "Frames";
+		case Stage::Opacity:	return "Opacity";
+		case Stage::Mipmaps:	return "Mipmaps";
+		case Stage::Upload:		return "Upload";
+		default:				return "Unknown";
+	}
+}
+
+
+const char* Viewer::LoadStatistics::GetFileTypeName(tFileType fileType)
+{
+	switch (fileType)
+	{
+		case tFileType::APNG:	return "APNG";
+		case tFileType::BMP:	return "BMP";
+		case tFileType::DDS:	return "DDS";
+		case tFileType::EXR:	return "EXR";
+		case tFileType::GIF:	return "GIF";
+		case tFileType::HDR:	return "HDR";
+		case tFileType::ICO:	return "ICO";
+		case tFileType::JPG:	return "JPG";
+		case tFileType::PNG:	return "PNG";
+		case tFileType::TGA:	return "TGA";
+		case tFileType::TIFF:	return "TIFF";
+		case tFileType::WEBP:	return "WEBP";
+		default:				return "Other";
+	}
+}
+
+
+void Viewer::LoadStatistics::Record(tFileType fileType, Stage stage, double seconds, int64 bytes, int64 pixels)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	Series& series = AllSeries[std::make_pair(fileType, stage)];
+	series.Count++;
+
+	Sample sample = { seconds, bytes, pixels };
+	if (int(series.Recent.size()) < MaxSamples)
+	{
+		series.Recent.push_back(sample);
+		return;
+	}
+
+	series.Recent[series.Next] = sample;
+	series.Next = (series.Next + 1) % MaxSamples;
+}
+
+
+void Viewer::LoadStatistics::Clear()
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	AllSeries.clear();
+}
+
+
+void Viewer::LoadStatistics::GetRows(std::vector<Row>& rows) const
+{
+	rows.clear();
+	std::lock_guard<std::mutex> lock(Mutex);
+	std::vector<double> times;
+	for (const auto& entry : AllSeries)
+	{
+		const Series& series = entry.second;
+		if (series.Recent.empty())
+			continue;
+
+		// Nearest rank percentiles. With at most MaxSamples samples a sort is cheap enough to do every frame.
+		times.clear();
+		double totalSeconds = 0.0;
+		int64 totalBytes = 0;
+		int64 totalPixels = 0;
+		for (const Sample& sample : series.Recent)
+		{
+			times.push_back(sample.Seconds);
+			totalSeconds += sample.Seconds;
+			totalBytes += sample.Bytes;
+			totalPixels += sample.Pixels;
+		}
+		std::sort(times.begin(), times.end());
+		int last = int(times.size()) - 1;
+
+		Row row;
+		row.FileType	= entry.first.first;
+		row.Step		= entry.first.second;
+		row.Count		= series.Count;
+		row.P50			= times[last*50/100];
+		row.P95			= times[last*95/100];
+		row.MBPerSec	= (totalSeconds > 0.0) ? double(totalBytes) / (totalSeconds * 1024.0 * 1024.0) : 0.0;
+		row.MPixPerSec	= (totalSeconds > 0.0) ? double(totalPixels) / (totalSeconds * 1000000.0) : 0.0;
+		rows.push_back(row);
+	}
+}
+
+
+bool Viewer::LoadStatistics::Save(const tString& filename) const
+{
+	std::vector<Row> rows;
+	GetRows(rows);
+
+	std::FILE* file = std::fopen(filename.Chars(), "wt");
+	if (!file)
+		return false;
+
+	std::fprintf(file, "Type\tStage\tCount\tP50ms\tP95ms\tMB/s\tMPix/s\n");
+	for (const Row& row : rows)
+	{
+		std::fprintf
+		(
+			file, "%s\t%s\t%lld\t%.3f\t%.3f\t%.1f\t%.1f\n",
+			GetFileTypeName(row.FileType), GetStageName(row.Step), (long long)row.Count,
+			row.P50*1000.0, row.P95*1000.0, row.MBPerSec, row.MPixPerSec
+		);
+	}
+
+	return std::fclose(file) == 0;
+}
+
+
+void Viewer::ShowLoadStatsWindow(bool* popen)
+{
+	tMath::tVector2 windowPos = GetDialogOrigin(6);
+	ImGui::SetNextWindowPos(windowPos, ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowSize(tMath::tVector2(560.0f, 360.0f), ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin("Load Statistics", popen))
+	{
+		ImGui::End();
+		return;
+	}
+
+	std::vector<LoadStatistics::Row> rows;
+	LoadStats.GetRows(rows);
+
+	// Times are the median and 95th percentile of the recent samples. Rates are totals over the same samples.
+	ImGuiTableFlags tableFlags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_ScrollY;
+	tMath::tVector2 tableSize(0.0f, -ImGui::GetFrameHeightWithSpacing());
+	if (ImGui::BeginTable("LoadStatsTable", 7, tableFlags, tableSize))
+	{
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Type");
+		ImGui::TableSetupColumn("Stage");
+		ImGui::TableSetupColumn("Count");
+		ImGui::TableSetupColumn("P50 ms");
+		ImGui::TableSetupColumn("P95 ms");
+		ImGui::TableSetupColumn("MB/s");
+		ImGui::TableSetupColumn("MPix/s");
+		ImGui::TableHeadersRow();
+
+		for (const LoadStatistics::Row& row : rows)
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();	ImGui::Text("%s", LoadStatistics::GetFileTypeName(row.FileType));
+			ImGui::TableNextColumn();	ImGui::Text("%s", LoadStatistics::GetStageName(row.Step));
+			ImGui::TableNextColumn();	ImGui::Text("%lld", (long long)row.Count);
+			ImGui::TableNextColumn();	ImGui::Text("%.2f", row.P50*1000.0);
+			ImGui::TableNextColumn();	ImGui::Text("%.2f", row.P95*1000.0);
+			ImGui::TableNextColumn();	if (row.MBPerSec > 0.0)		ImGui::Text("%.1f", row.MBPerSec);
+			ImGui::TableNextColumn();	if (row.MPixPerSec > 0.0)	ImGui::Text("%.1f", row.MPixPerSec);
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::Button("Clear", tMath::tVector2(100, 0)))
+		LoadStats.Clear();
+
+	ImGui::SameLine();
+	if (ImGui::Button("Save", tMath::tVector2(100, 0)) && !LoadStats.SaveFile.IsEmpty())
+	{
+		if (LoadStats.Save(LoadStats.SaveFile))
+			tPrintf("Load statistics saved to %s\n", LoadStats.SaveFile.Chars());
+		else
+			tPrintf("Could not save load statistics to %s\n", LoadStats.SaveFile.Chars());
+	}
+	ImGui::SameLine();
+	ImGui::TextDisabled("%s", LoadStats.SaveFile.Chars());
+
+	ImGui::End();
+}
@@ -0,0 +1,105 @@
+// LoadStats.h
+//
+// Timing of every stage of getting an image from disk onto the screen, kept separately for each file type. Each stage
+// remembers its most recent samples so the figures follow what the viewer is doing now rather than the whole session.
+// The load statistics window shows them and they can be saved to a text file to compare machines and builds.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Foundation/tString.h>
+#include <System/tFile.h>
+namespace Viewer
+{
+
+
+class LoadStatistics
+{
+public:
+	enum class Stage
+	{
+		Read,							// Opening the file and identifying its type.
+		Decode,							// The decoder for the format.
+		Frames,							// Moving the decoded frames into pictures, converting and compressing them.
+		Opacity,						// Scanning for transparency.
+		Mipmaps,						// Building the mipmap chain in Bind.
+		Upload,							// Handing the mipmaps to OpenGL in Bind.
+		NumStages
+	};
+	static const char* GetStageName(Stage);
+	static const char* GetFileTypeName(tSystem::tFileType);
+
+	// Measures the time between laps. Starts when constructed.
+	class Stopwatch
+	{
+	public:
+		Stopwatch()																										: Last(std::chrono::steady_clock::now()) { }
+		double Lap();					// Seconds since construction or the previous lap.
+
+	private:
+		std::chrono::steady_clock::time_point Last;
+	};
+
+	// May be called from any thread. The bytes and pixels are what the stage worked through and give the throughput
+	// figures. Either may be zero, in which case that figure is not shown.
+	void Record(tSystem::tFileType, Stage, double seconds, int64 bytes, int64 pixels);
+	void Clear();
+
+	// The times and rates are over the recent samples. The count is every sample since the last clear.
+	struct Row
+	{
+		tSystem::tFileType FileType;
+		Stage Step;
+		int64 Count;
+		double P50;						// Seconds.
+		double P95;
+		double MBPerSec;				// Zero if the stage doesn't record bytes.
+		double MPixPerSec;				// Zero if the stage doesn't record pixels.
+	};
+
+	// One row for every file type and stage that has samples. In file type then stage order.
+	void GetRows(std::vector<Row>&) const;
+
+	// Writes the rows as a tab separated table. Returns false if the file couldn't be written.
+	bool Save(const tString& filename) const;
+	tString SaveFile;					// Set at startup. Where the window's Save button writes.
+
+private:
+	static const int MaxSamples = 128;
+	struct Sample
+	{
+		double Seconds;
+		int64 Bytes;
+		int64 Pixels;
+	};
+
+	struct Series
+	{
+		int64 Count					= 0;
+		std::vector<Sample> Recent;		// A ring once it reaches MaxSamples.
+		int Next					= 0;
+	};
+
+	mutable std::mutex Mutex;
+	std::map<std::pair<tSystem::tFileType, Stage>, Series> AllSeries;
+};
+
+
+extern LoadStatistics LoadStats;
+void ShowLoadStatsWindow(bool* popen);
+
+
+}
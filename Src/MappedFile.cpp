@@ -0,0 +1,265 @@
+// MappedFile.cpp
+//
+// A file mapped into the address space of the process. Used by the thumbnail cache for its pack and index files so
+// that lookups are a pointer offset rather than an open/read/close, and by image loading so a file is only opened
+// once no matter how many times its header is looked at.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#if defined(PLATFORM_WINDOWS)
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.h"
+
+
+bool Viewer::MappedFile::OpenRead(const tString& filename)
+{
+	Close();
+	Writable = false;
+
+	#if defined(PLATFORM_WINDOWS)
+	HANDLE file = CreateFileA(filename.Chars(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	FileHandle = file;
+	Size = int64(size.QuadPart);
+
+	// FILETIME counts 100ns intervals since 1601. The difference to the 1970 epoch is 11644473600 seconds.
+	FILETIME writeTime;
+	if (GetFileTime(file, nullptr, nullptr, &writeTime))
+	{
+		uint64 ticks = (uint64(writeTime.dwHighDateTime) << 32) | uint64(writeTime.dwLowDateTime);
+		ModTime = std::time_t(ticks / 10000000ull) - std::time_t(11644473600ll);
+	}
+
+	#else
+	FileDesc = open(filename.Chars(), O_RDONLY);
+	if (FileDesc < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(FileDesc, &info) != 0)
+	{
+		Close();
+		return false;
+	}
+	Size = int64(info.st_size);
+	ModTime = info.st_mtime;
+	#endif
+
+	if (!Map())
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Viewer::MappedFile::GetInfo(const tString& filename, int64& size, std::time_t& modTime)
+{
+	#if defined(PLATFORM_WINDOWS)
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(filename.Chars(), GetFileExInfoStandard, &info))
+		return false;
+
+	size = (int64(info.nFileSizeHigh) << 32) | int64(info.nFileSizeLow);
+	uint64 ticks = (uint64(info.ftLastWriteTime.dwHighDateTime) << 32) | uint64(info.ftLastWriteTime.dwLowDateTime);
+	modTime = std::time_t(ticks / 10000000ull) - std::time_t(11644473600ll);
+
+	#else
+	struct stat info;
+	if (stat(filename.Chars(), &info) != 0)
+		return false;
+
+	size = int64(info.st_size);
+	modTime = info.st_mtime;
+	#endif
+
+	return size > 0;
+}
+
+
+bool Viewer::MappedFile::OpenWrite(const tString& filename, int64 minSize)
+{
+	Close();
+	Writable = true;
+
+	#if defined(PLATFORM_WINDOWS)
+	HANDLE file = CreateFileA(filename.Chars(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	FileHandle = file;
+	Size = int64(size.QuadPart);
+
+	#else
+	FileDesc = open(filename.Chars(), O_RDWR | O_CREAT, 0644);
+	if (FileDesc < 0)
+		return false;
+
+	// On Windows the share mode takes care of this. The lock is released when the descriptor is closed.
+	if (flock(FileDesc, LOCK_EX | LOCK_NB) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(FileDesc, &info) != 0)
+	{
+		Close();
+		return false;
+	}
+	Size = int64(info.st_size);
+	#endif
+
+	bool mapped = (Size < minSize) ? Resize(minSize) : Map();
+	if (!mapped)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Viewer::MappedFile::Resize(int64 numBytes)
+{
+	if (!Writable || (numBytes < 0))
+		return false;
+
+	Unmap();
+
+	#if defined(PLATFORM_WINDOWS)
+	if (!FileHandle)
+		return false;
+
+	LARGE_INTEGER pos;
+	pos.QuadPart = numBytes;
+	if (!SetFilePointerEx(HANDLE(FileHandle), pos, nullptr, FILE_BEGIN) || !SetEndOfFile(HANDLE(FileHandle)))
+		return false;
+
+	#else
+	if (FileDesc < 0)
+		return false;
+
+	if (ftruncate(FileDesc, off_t(numBytes)) != 0)
+		return false;
+	#endif
+
+	Size = numBytes;
+	return Map();
+}
+
+
+bool Viewer::MappedFile::Map()
+{
+	// Zero sized files can't be mapped. This is not an error for writable files, they are simply not mapped yet.
+	if (Size <= 0)
+		return Writable;
+
+	#if defined(PLATFORM_WINDOWS)
+	DWORD protect = Writable ? PAGE_READWRITE : PAGE_READONLY;
+	MapHandle = CreateFileMappingA(HANDLE(FileHandle), nullptr, protect, DWORD(uint64(Size) >> 32), DWORD(Size & 0xFFFFFFFF), nullptr);
+	if (!MapHandle)
+		return false;
+
+	DWORD access = Writable ? (FILE_MAP_READ | FILE_MAP_WRITE) : FILE_MAP_READ;
+	Data = (uint8*)MapViewOfFile(HANDLE(MapHandle), access, 0, 0, SIZE_T(Size));
+	if (!Data)
+	{
+		CloseHandle(HANDLE(MapHandle));
+		MapHandle = nullptr;
+		return false;
+	}
+
+	#else
+	int prot = Writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	void* addr = mmap(nullptr, size_t(Size), prot, MAP_SHARED, FileDesc, 0);
+	if (addr == MAP_FAILED)
+		return false;
+	Data = (uint8*)addr;
+	#endif
+
+	return true;
+}
+
+
+void Viewer::MappedFile::Unmap()
+{
+	if (!Data)
+		return;
+
+	#if defined(PLATFORM_WINDOWS)
+	UnmapViewOfFile(Data);
+	CloseHandle(HANDLE(MapHandle));
+	MapHandle = nullptr;
+	#else
+	munmap(Data, size_t(Size));
+	#endif
+
+	Data = nullptr;
+}
+
+
+bool Viewer::MappedFile::Flush()
+{
+	if (!Data || !Writable)
+		return false;
+
+	#if defined(PLATFORM_WINDOWS)
+	return FlushViewOfFile(Data, 0) ? true : false;
+	#else
+	return msync(Data, size_t(Size), MS_ASYNC) == 0;
+	#endif
+}
+
+
+void Viewer::MappedFile::Close()
+{
+	Unmap();
+
+	#if defined(PLATFORM_WINDOWS)
+	if (FileHandle)
+		CloseHandle(HANDLE(FileHandle));
+	FileHandle = nullptr;
+	#else
+	if (FileDesc >= 0)
+		close(FileDesc);
+	FileDesc = -1;
+	#endif
+
+	Size = 0;
+	ModTime = 0;
+	Writable = false;
+}
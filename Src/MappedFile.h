@@ -0,0 +1,76 @@
+// MappedFile.h
+//
+// A file mapped into the address space of the process. Used by the thumbnail cache for its pack and index files so
+// that lookups are a pointer offset rather than an open/read/close, and by image loading so a file is only opened
+// once no matter how many times its header is looked at.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <ctime>
+#include <Foundation/tStandard.h>
+#include <Foundation/tString.h>
+namespace Viewer
+{
+
+
+class MappedFile
+{
+public:
+	MappedFile()																										{ }
+	~MappedFile()																										{ Close(); }
+
+	// Maps an existing file read-only. Returns false if the file doesn't exist, is empty, or can't be mapped.
+	bool OpenRead(const tString& filename);
+
+	// Maps a file for reading and writing, creating it if necessary. If the file is smaller than minSize it is grown
+	// (zero filled) to that size first. Only one process may have a given file open for writing. A second attempt
+	// fails rather than having two writers corrupt each other.
+	bool OpenWrite(const tString& filename, int64 minSize = 0);
+
+	// Changes the size of a writable file and remaps it. Any pointer previously returned by GetData is invalid after
+	// this call, so callers sharing the mapping between threads must hold an exclusive lock.
+	bool Resize(int64 numBytes);
+
+	// Writes dirty pages back to disk. Not required for correctness, the OS does this eventually.
+	bool Flush();
+	void Close();
+
+	bool IsValid() const																								{ return Data != nullptr; }
+	bool IsWritable() const																								{ return Writable; }
+	uint8* GetData() const																								{ return Data; }
+	int64 GetSize() const																								{ return Size; }
+
+	// Read from the open file so no separate stat is needed. Only set by OpenRead.
+	std::time_t GetModTime() const																						{ return ModTime; }
+
+	// Gets the size and modification time without opening the file, for callers that don't read it through a mapping.
+	// Returns false if the file doesn't exist or is empty, the same as OpenRead.
+	static bool GetInfo(const tString& filename, int64& size, std::time_t& modTime);
+
+private:
+	bool Map();
+	void Unmap();
+
+	#if defined(PLATFORM_WINDOWS)
+	void* FileHandle	= nullptr;
+	void* MapHandle		= nullptr;
+	#else
+	int FileDesc		= -1;
+	#endif
+	uint8* Data			= nullptr;
+	int64 Size			= 0;
+	std::time_t ModTime	= 0;
+	bool Writable		= false;
+};
+
+
+}
@@ -18,6 +18,7 @@
 #include "OpenSaveDialogs.h"
 #include "TacentView.h"
 #include "Image.h"
+#include "AreaResample.h"
 using namespace tStd;
 using namespace tMath;
 using namespace tSystem;
@@ -207,9 +208,12 @@ void Viewer::SaveMultiFrameTo(const tString& outFile, int outWidth, int outHeigh
 		if (!currPic)
 			continue;
 
-		tImage::tPicture resampled(*currPic);
-		if ((resampled.GetWidth() != outWidth) || (resampled.GetHeight() != outHeight))
-			resampled.Resample(outWidth, outHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+		// The frame takes ownership of the pixels, so the picture is only copied when it is already the right size.
+		tImage::tPicture resampled;
+		if ((currPic->GetWidth() != outWidth) || (currPic->GetHeight() != outHeight))
+			AreaResample::Resample(resampled, *currPic, outWidth, outHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+		else
+			resampled.Set(*currPic);
 
 		tFrame* frame = new tFrame(resampled.StealPixels(), outWidth, outHeight, currPic->Duration);
 		frames.Append(frame);
@@ -254,7 +258,6 @@ void Viewer::SaveMultiFrameTo(const tString& outFile, int outWidth, int outHeigh
 	// and set the current image to the generated one.
 	if (ImagesDir.IsEqualCI( tGetDir(outFile) ))
 	{
-		Images.Clear();
 		PopulateImages();
 		SetCurrentImage(outFile);
 	}
@@ -17,6 +17,7 @@
 #include "Image.h"
 #include "TacentView.h"
 #include "FileDialog.h"
+#include "AreaResample.h"
 using namespace tStd;
 using namespace tSystem;
 using namespace tMath;
@@ -384,18 +385,14 @@ bool Viewer::SaveResizeImageAs(Image& img, const tString& outFile, int width, in
 
 	tPicture* currPic = img.GetCurrentPic();
 	if (!currPic)
+	{
+		if (!imageLoaded)
+			img.Unload();
 		return false;
+	}
 
-	// Make a temp copy we can safely resize.
-	tImage::tPicture outPic;
-	outPic.Set(*currPic);
-
-	// Restore loadedness.
-	if (!imageLoaded)
-		img.Unload();
-
-	int outW = outPic.GetWidth();
-	int outH = outPic.GetHeight();
+	int outW = currPic->GetWidth();
+	int outH = currPic->GetHeight();
 	float aspect = float(outW) / float(outH);
 
 	switch (sizeMode)
@@ -425,15 +422,25 @@ bool Viewer::SaveResizeImageAs(Image& img, const tString& outFile, int width, in
 	tMath::tiClampMin(outW, 4);
 	tMath::tiClampMin(outH, 4);
 
-	if ((outPic.GetWidth() != outW) || (outPic.GetHeight() != outH))
-		outPic.Resample(outW, outH, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+	// The loaded picture is saved as is unless it needs resizing. Resampling reads it directly so no temp copy is made.
+	tImage::tPicture resized;
+	tImage::tPicture* outPic = currPic;
+	if ((currPic->GetWidth() != outW) || (currPic->GetHeight() != outH))
+	{
+		AreaResample::Resample(resized, *currPic, outW, outH, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+		outPic = &resized;
+	}
 
 	bool success = false;
-	tImage::tPicture::tColourFormat colourFmt = outPic.IsOpaque() ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
+	tImage::tPicture::tColourFormat colourFmt = outPic->IsOpaque() ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
 	if (Config.SaveFileType == 0)
-		success = outPic.SaveTGA(outFile, tImage::tImageTGA::tFormat::Auto, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
+		success = outPic->SaveTGA(outFile, tImage::tImageTGA::tFormat::Auto, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
 	else
-		success = outPic.Save(outFile, colourFmt, Config.SaveFileJpegQuality);
+		success = outPic->Save(outFile, colourFmt, Config.SaveFileJpegQuality);
+
+	// Restore loadedness.
+	if (!imageLoaded)
+		img.Unload();
 
 	if (success)
 		tPrintf("Saved image as %s\n", outFile.Chars());
@@ -797,7 +804,8 @@ void Viewer::AddSavedImageIfNecessary(const tString& savedFile)
 		// Add to list. It's still unloaded.
 		Image* newImg = new Image(savedFile);
 		Images.Append(newImg);
-		ImagesLoadTimeSorted.Append(newImg);
+		ImgCache.Manage(newImg);
+		ImagesGeneration++;
 	}
 }
 
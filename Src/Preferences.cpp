@@ -18,6 +18,9 @@
 #include "Preferences.h"
 #include "Settings.h"
 #include "Image.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailPrewarm.h"
+#include "TextureResidency.h"
 #include "TacentView.h"
 #include "Version.cmake.h"
 using namespace tMath;
@@ -135,9 +138,37 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 			ImGui::InputInt("Max Mem (MB)", &Config.MaxImageMemMB); ImGui::SameLine();
 			ShowHelpMark("Approx memory use limit of this app. Minimum 256 MB.");
 			tMath::tiClampMin(Config.MaxImageMemMB, 256);
-			ImGui::InputInt("Max Cache Files", &Config.MaxCacheFiles); ImGui::SameLine();
-			ShowHelpMark("Maximum number of cache files that may be created. Minimum 200.");
-			tMath::tiClampMin(Config.MaxCacheFiles, 200);
+			ImGui::InputInt("Max VRAM (MB)", &Config.MaxTextureMemMB); ImGui::SameLine();
+			ShowHelpMark("Video memory limit for image textures. Least recently shown textures are freed when over and\nuploaded again when next shown. Whatever is on screen is always kept. Minimum 128 MB.");
+			tMath::tiClampMin(Config.MaxTextureMemMB, 128);
+			ImGui::Text
+			(
+				"Textures: %d Resident %.1f MB  Peak %.1f MB  Uploads %llu  Evicted %llu",
+				TexResidency.GetNumResident(), float(TexResidency.GetResidentBytes())/(1024.0f*1024.0f),
+				float(TexResidency.GetPeakBytes())/(1024.0f*1024.0f), (unsigned long long)TexResidency.GetNumUploads(),
+				(unsigned long long)TexResidency.GetNumEvictions()
+			);
+			ImGui::InputInt("Prefetch Images", &Config.PrefetchCount); ImGui::SameLine();
+			ShowHelpMark("Number of images ahead of the current one, in the direction you are stepping, that are loaded in the\nbackground so they show instantly. The previous image is kept too. Stays within Max Mem. 0 to disable.");
+			tMath::tiClamp(Config.PrefetchCount, 0, 8);
+			ImGui::InputInt("Max Cache (MB)", &Config.MaxCacheMB); ImGui::SameLine();
+			ShowHelpMark("Thumbnail cache size limit. Least recently used thumbnails are removed when over. Minimum 16 MB.");
+			tMath::tiClampMin(Config.MaxCacheMB, 16);
+			ImGui::Text
+			(
+				"Cache: %d Thumbnails %.1f MB  Hits %llu  Misses %llu  Evicted %llu%s",
+				ThumbCache.GetNumRecords(), float(ThumbCache.GetLiveBytes())/(1024.0f*1024.0f),
+				(unsigned long long)ThumbCache.GetNumHits(), (unsigned long long)ThumbCache.GetNumMisses(),
+				(unsigned long long)ThumbCache.GetNumEvictions(), ThumbCache.IsSession() ? "  (Session Only)" : ""
+			);
+
+			ImGui::Checkbox("Prewarm Thumbnails", &Config.PrewarmThumbnails); ImGui::SameLine();
+			ShowHelpMark("Generate thumbnails for the current folder and all folders below it in the background.\nTakes effect the next time a folder is opened.");
+			ImGui::InputInt("Prewarm Read (MB/s)", &Config.PrewarmMBPerSec); ImGui::SameLine();
+			ShowHelpMark("Limits how fast files are read when prewarming. Prewarming pauses while an image is loading.");
+			tMath::tiClamp(Config.PrewarmMBPerSec, 1, 1024);
+			if (Prewarmer.IsActive())
+				ImGui::Text("Prewarming: %d Generated  %d Remaining", Prewarmer.GetNumGenerated(), Prewarmer.GetNumRemaining());
 			if (!DeleteAllCacheFilesOnExit)
 			{
 				if (ImGui::Button("Clear Cache"))
@@ -154,6 +185,15 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 			ImGui::InputInt("Max Undo Steps", &Config.MaxUndoSteps); ImGui::SameLine();
 			ShowHelpMark("Maximum number of Ctrl-Z undo steps.");
 			tMath::tiClamp(Config.MaxUndoSteps, 1, 32);
+			ImGui::InputInt("Max Undo Mem (MB)", &Config.MaxUndoMemMB); ImGui::SameLine();
+			ShowHelpMark("Undo snapshots of all images over this are compressed to a file in the cache directory and\nread back when undone that far. The latest snapshot always stays in memory. Minimum 64 MB.");
+			tMath::tiClampMin(Config.MaxUndoMemMB, 64);
+			ImGui::Text
+			(
+				"Undo: %.1f MB In Memory  %d Spilled %.1f MB On Disk",
+				float(Undo::GetResidentBytes())/(1024.0f*1024.0f), Undo::GetNumSpilled(),
+				float(Undo::GetSpilledBytes())/(1024.0f*1024.0f)
+			);
 
 			ImGui::NewLine();
 			ImGui::Separator();
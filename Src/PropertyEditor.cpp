@@ -50,15 +50,20 @@ void Viewer::ShowPropertyEditorWindow(bool* popen)
 			ImGui::Text("Radiance HDR");
 			ImGui::PushItemWidth(110);
 
-			ImGui::InputFloat("Gamma", &CurrImage->LoadParams.GammaValue, 0.01f, 0.1f, "%.3f"); ImGui::SameLine();
-			ShowHelpMark("Gamma to use [0.6, 3.0] if you reload this Radiance hdr file. Open preferences to edit default gamma value.");
+			// Changes show straight away if the image kept its linear pixels. Otherwise they apply on reload.
+			bool changed = false;
+			changed |= ImGui::DragFloat("Gamma", &CurrImage->LoadParams.GammaValue, 0.005f, 0.6f, 3.0f, "%.3f"); ImGui::SameLine();
+			ShowHelpMark("Gamma to use [0.6, 3.0] for this Radiance hdr file. Drag or double-click to edit. Open preferences to edit default gamma value.");
 			tMath::tiClamp(CurrImage->LoadParams.GammaValue, 0.6f, 3.0f);
 
-			ImGui::InputInt("Exposure", &CurrImage->LoadParams.HDR_Exposure); ImGui::SameLine();
-			ShowHelpMark("Exposure adjustment [-10, 10] if you reload this Radiance hdr file.");
+			changed |= ImGui::DragInt("Exposure", &CurrImage->LoadParams.HDR_Exposure, 0.05f, -10, 10); ImGui::SameLine();
+			ShowHelpMark("Exposure adjustment [-10, 10] for this Radiance hdr file.");
 			tMath::tiClamp(CurrImage->LoadParams.HDR_Exposure, -10, 10);
 			ImGui::PopItemWidth();
 
+			if (changed && CurrImage->CanRetonemap())
+				CurrImage->Retonemap();
+
 			ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 8);
 			ImGui::Separator();
 			ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 8);
@@ -66,8 +71,15 @@ void Viewer::ShowPropertyEditorWindow(bool* popen)
 			if (ImGui::Button("Reset", tVector2(100, 0)))
 			{
 				CurrImage->ResetLoadParams();
-				CurrImage->Unload();
-				CurrImage->Load();
+				if (CurrImage->CanRetonemap())
+				{
+					CurrImage->Retonemap();
+				}
+				else
+				{
+					CurrImage->Unload();
+					CurrImage->Load();
+				}
 			}
 			ImGui::SameLine();
 
@@ -87,27 +99,32 @@ void Viewer::ShowPropertyEditorWindow(bool* popen)
 			ImGui::Text("Open EXR");
 			ImGui::PushItemWidth(110);
 
-			ImGui::InputFloat("Gamma", &CurrImage->LoadParams.GammaValue, 0.01f, 0.1f, "%.3f"); ImGui::SameLine();
-			ShowHelpMark("Gamma to use [0.6, 3.0] if you reload this exr file. Open preferences to edit default gamma value.");
+			// Changes show straight away if the image kept its linear pixels. Otherwise they apply on reload.
+			bool changed = false;
+			changed |= ImGui::DragFloat("Gamma", &CurrImage->LoadParams.GammaValue, 0.005f, 0.6f, 3.0f, "%.3f"); ImGui::SameLine();
+			ShowHelpMark("Gamma to use [0.6, 3.0] for this exr file. Drag or double-click to edit. Open preferences to edit default gamma value.");
 			tMath::tiClamp(CurrImage->LoadParams.GammaValue, 0.6f, 3.0f);
 
-			ImGui::InputFloat("Exposure", &CurrImage->LoadParams.EXR_Exposure, 0.01f, 0.1f, "%.3f"); ImGui::SameLine();
-			ShowHelpMark("Exposure adjustment [-10.0, 10.0] if you reload this exr file.");
+			changed |= ImGui::DragFloat("Exposure", &CurrImage->LoadParams.EXR_Exposure, 0.01f, -10.0f, 10.0f, "%.3f"); ImGui::SameLine();
+			ShowHelpMark("Exposure adjustment [-10.0, 10.0] for this exr file.");
 			tMath::tiClamp(CurrImage->LoadParams.EXR_Exposure, -10.0f, 10.0f);
 
-			ImGui::InputFloat("Defog", &CurrImage->LoadParams.EXR_Defog, 0.001f, 0.01f, "%.3f"); ImGui::SameLine();
-			ShowHelpMark("Remove fog strength [0.0, 0.1] if you reload this exr file. Try to keep under 0.01");
+			changed |= ImGui::DragFloat("Defog", &CurrImage->LoadParams.EXR_Defog, 0.0005f, 0.0f, 0.1f, "%.3f"); ImGui::SameLine();
+			ShowHelpMark("Remove fog strength [0.0, 0.1] for this exr file. Try to keep under 0.01");
 			tMath::tiClamp(CurrImage->LoadParams.EXR_Defog, 0.0f, 0.1f);
 
-			ImGui::InputFloat("Knee Low", &CurrImage->LoadParams.EXR_KneeLow, 0.01f, 0.1f, "%.3f"); ImGui::SameLine();
-			ShowHelpMark("Lower bound knee taper [-3.0, 3.0] if you reload this exr file.");
+			changed |= ImGui::DragFloat("Knee Low", &CurrImage->LoadParams.EXR_KneeLow, 0.01f, -3.0f, 3.0f, "%.3f"); ImGui::SameLine();
+			ShowHelpMark("Lower bound knee taper [-3.0, 3.0] for this exr file.");
 			tMath::tiClamp(CurrImage->LoadParams.EXR_KneeLow, -3.0f, 3.0f);
 
-			ImGui::InputFloat("Knee High", &CurrImage->LoadParams.EXR_KneeHigh, 0.01f, 0.1f, "%.3f"); ImGui::SameLine();
-			ShowHelpMark("Upper bound knee taper [3.5, 7.5] if you reload this exr file.");
+			changed |= ImGui::DragFloat("Knee High", &CurrImage->LoadParams.EXR_KneeHigh, 0.01f, 3.5f, 7.5f, "%.3f"); ImGui::SameLine();
+			ShowHelpMark("Upper bound knee taper [3.5, 7.5] for this exr file.");
 			tMath::tiClamp(CurrImage->LoadParams.EXR_KneeHigh, 3.5f, 7.5f);
 			ImGui::PopItemWidth();
 
+			if (changed && CurrImage->CanRetonemap())
+				CurrImage->Retonemap();
+
 			ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 8);
 			ImGui::Separator();
 			ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 8);
@@ -115,8 +132,15 @@ void Viewer::ShowPropertyEditorWindow(bool* popen)
 			if (ImGui::Button("Reset", tVector2(100, 0)))
 			{
 				CurrImage->ResetLoadParams();
-				CurrImage->Unload();
-				CurrImage->Load();
+				if (CurrImage->CanRetonemap())
+				{
+					CurrImage->Retonemap();
+				}
+				else
+				{
+					CurrImage->Unload();
+					CurrImage->Load();
+				}
 			}
 			ImGui::SameLine();
 
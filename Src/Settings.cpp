@@ -90,8 +90,13 @@ void Viewer::Settings::ResetBehaviourSettings()
 	ResizeAspectDen				= 9;
 	ResizeAspectMode			= 0;
 	MaxImageMemMB				= 2048;
-	MaxCacheFiles				= 8192;
+	MaxTextureMemMB				= 1024;
+	PrefetchCount				= 2;
+	MaxCacheMB					= 512;
+	PrewarmThumbnails			= false;
+	PrewarmMBPerSec				= 32;
 	MaxUndoSteps				= 16;
+	MaxUndoMemMB				= 512;
 	StrictLoading				= false;
 	DetectAPNGInsidePNG			= true;
 	MipmapFilter				= int(tImage::tResampleFilter::Bilinear);
@@ -196,8 +201,13 @@ void Viewer::Settings::Load(const tString& filename)
 				ReadItem(ResizeAspectDen);
 				ReadItem(ResizeAspectMode);
 				ReadItem(MaxImageMemMB);
-				ReadItem(MaxCacheFiles);
+				ReadItem(MaxTextureMemMB);
+				ReadItem(PrefetchCount);
+				ReadItem(MaxCacheMB);
+				ReadItem(PrewarmThumbnails);
+				ReadItem(PrewarmMBPerSec);
 				ReadItem(MaxUndoSteps);
+				ReadItem(MaxUndoMemMB);
 				ReadItem(StrictLoading);
 				ReadItem(DetectAPNGInsidePNG);
 				ReadItem(MipmapFilter);
@@ -235,8 +245,12 @@ void Viewer::Settings::Load(const tString& filename)
 	tiClampMin	(ResizeAspectDen, 1);
 	tiClamp		(ResizeAspectMode, 0, 1);
 	tiClampMin	(MaxImageMemMB, 256);
-	tiClampMin	(MaxCacheFiles, 200);	
+	tiClampMin	(MaxTextureMemMB, 128);
+	tiClamp		(PrefetchCount, 0, 8);
+	tiClampMin	(MaxCacheMB, 16);	
+	tiClamp		(PrewarmMBPerSec, 1, 1024);
 	tiClamp		(MaxUndoSteps, 1, 32);
+	tiClampMin	(MaxUndoMemMB, 64);
 	tiClamp		(MipmapFilter, 0, int(tImage::tResampleFilter::NumFilters));	// None allowed.
 	tiClamp		(SaveAllSizeMode, 0, 3);
 	tiClamp		(SaveFileJpegQuality, 1, 100);
@@ -315,8 +329,13 @@ bool Viewer::Settings::Save(const tString& filename)
 	WriteItem(ResizeAspectDen);
 	WriteItem(ResizeAspectMode);
 	WriteItem(MaxImageMemMB);
-	WriteItem(MaxCacheFiles);
+	WriteItem(MaxTextureMemMB);
+	WriteItem(PrefetchCount);
+	WriteItem(MaxCacheMB);
+	WriteItem(PrewarmThumbnails);
+	WriteItem(PrewarmMBPerSec);
 	WriteItem(MaxUndoSteps);
+	WriteItem(MaxUndoMemMB);
 	WriteItem(StrictLoading);
 	WriteItem(DetectAPNGInsidePNG);
 	WriteItem(MipmapFilter);
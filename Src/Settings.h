@@ -112,8 +112,13 @@ namespace Viewer
 		int ResizeAspectDen;
 		int ResizeAspectMode;				// 0 = Crop Mode. 1 = Letterbox Mode.
 		int MaxImageMemMB;					// Max image mem before unloading images.
-		int MaxCacheFiles;					// Max number of cache files before removing oldest.
+		int MaxTextureMemMB;				// Max texture mem before least recently used textures are freed.
+		int PrefetchCount;					// Images ahead of the current one to load in the background. 0 to disable.
+		int MaxCacheMB;						// Max thumbnail cache size before removing least recently used.
+		bool PrewarmThumbnails;				// Fill the thumbnail cache for the current folder tree in the background.
+		int PrewarmMBPerSec;				// Read budget for prewarming.
 		int MaxUndoSteps;
+		int MaxUndoMemMB;					// Undo snapshots of all images over this are compressed to a spill file.
 		bool StrictLoading;					// No attempt to display ill-formed images.
 		bool DetectAPNGInsidePNG;			// Look for APNG data (animated) hidden inside a regular PNG file.
 		int MipmapFilter;					// Matches tImage::tResampleFilter. Use None for no mipmaps.
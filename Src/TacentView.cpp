@@ -24,6 +24,8 @@
 #include <GLFW/glfw3native.h>
 #endif
 
+#include <algorithm>
+#include <vector>
 #include <Foundation/tVersion.cmake.h>
 #include <Foundation/tHash.h>
 #include <System/tCmdLine.h>
@@ -50,6 +52,13 @@
 #include "Rotate.h"
 #include "OpenSaveDialogs.h"
 #include "Settings.h"
+#include "WorkerPool.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailAtlas.h"
+#include "ThumbnailPrewarm.h"
+#include "LoadStats.h"
+#include "ImageCache.h"
+#include "TextureResidency.h"
 #include "Version.cmake.h"
 using namespace tStd;
 using namespace tSystem;
@@ -59,13 +68,19 @@ using namespace tMath;
 namespace Viewer
 {
 	tCmdLine::tParam ImageFileParam(1, "ImageFile", "File to open.");
+	tCmdLine::tOption PrewarmOption("Fill the thumbnail cache for a directory tree and exit.", "prewarm", 'p', 1);
 	NavLogBar NavBar;
 	tString ImagesDir;
 	tList<tStringItem> ImagesSubDirs;
 	tList<Image> Images;
-	tItList<Image> ImagesLoadTimeSorted(tListMode::External);		// We don't need static here cuz the list is only used after main().
+	uint64 ImagesGeneration											= 1;		// Incremented whenever Images is repopulated, added to, or sorted.
 	tuint256 ImagesHash												= 0;
 	Image* CurrImage												= nullptr;
+	Image* LoadingImage												= nullptr;	// Either null or CurrImage while its load job is in flight.
+	std::vector<Image*> Neighbours;												// Prefetched or prefetching. Never unloaded to save memory.
+	int NumPrefetching												= 0;
+	int NavDirection												= 0;		// Set by OnNext and OnPrevious. Zero for jumps.
+	int PrefetchDirection											= 1;		// The direction of the last step.
 	
 	void LoadAppImages(const tString& dataDir);
 	void UnloadAppImages();
@@ -112,6 +127,7 @@ namespace Viewer
 	bool WindowIconified						= false;
 	bool ShowCheatSheet							= false;
 	bool ShowAbout								= false;
+	bool ShowLoadStats							= false;
 	
 	#ifdef ENABLE_FILE_DIALOG_SUPPORT
 	bool Request_OpenFileModal					= false;
@@ -186,7 +202,6 @@ namespace Viewer
 	// When compare functions are used to sort, they result in ascending order if they return a < b.
 	bool Compare_AlphabeticalAscending(const tSystem::tFileInfo& a, const tSystem::tFileInfo& b)						{ return tStricmp(a.FileName.Chars(), b.FileName.Chars()) < 0; }
 	bool Compare_FileCreationTimeAscending(const tSystem::tFileInfo& a, const tSystem::tFileInfo& b)					{ return a.CreationTime < b.CreationTime; }
-	bool Compare_ImageLoadTimeAscending	(const Image& a, const Image& b)												{ return a.GetLoadedTime() < b.GetLoadedTime(); }
 	bool Compare_ImageFileNameAscending	(const Image& a, const Image& b)												{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) < 0; }
 	bool Compare_ImageFileNameDescending(const Image& a, const Image& b)												{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) > 0; }
 	bool Compare_ImageFileTypeAscending	(const Image& a, const Image& b)												{ return int(a.Filetype) < int(b.Filetype); }
@@ -213,10 +228,18 @@ namespace Viewer
 	void SetBasicViewAndBehaviour();
 	bool IsBasicViewAndBehaviour();
 	void AutoPropertyWindow();
+	void FinishLoadCurrImage(bool imgJustLoaded);
+	void StopLoadingImage();
+	void UpdateLoadingImage();
+	void RequestPrefetch();
+	void StopPrefetch();
+	void UpdatePrefetch();
+	void EnforceImageMemBudget();
 
 	tString FindImageFilesInCurrentFolder(tList<tSystem::tFileInfo>& foundFiles);	// Returns the image folder.
 	tuint256 ComputeImagesHash(const tList<tSystem::tFileInfo>& files);
 	int RemoveOldCacheFiles(const tString& cacheDir);								// Returns num removed.
+	int RunPrewarm(const tString& rootDir);											// Returns num generated.
 
 	enum CursorMove
 	{
@@ -330,8 +353,9 @@ void Viewer::PopulateImagesSubDirs()
 
 void Viewer::PopulateImages()
 {
+	StopLoadingImage();
+	StopPrefetch();
 	Images.Clear();
-	ImagesLoadTimeSorted.Clear();
 
 	tList<tSystem::tFileInfo> foundFiles;
 	ImagesDir = FindImageFilesInCurrentFolder(foundFiles);
@@ -346,11 +370,18 @@ void Viewer::PopulateImages()
 		// It is important we don't call Load after newing. We save memory by not having all images loaded.
 		Image* newImg = new Image(*fileInfo);
 		Images.Append(newImg);
-		ImagesLoadTimeSorted.Append(newImg);
+		ImgCache.Manage(newImg);
 	}
 
 	SortImages(Settings::SortKeyEnum(Config.SortKey), Config.SortAscending);
 	CurrImage = nullptr;
+	ImagesGeneration++;
+
+	// Restarting from the new folder. The cache remembers everything already done so revisiting a tree is cheap.
+	if (Config.PrewarmThumbnails)
+		Prewarmer.Start(ImagesDir);
+	else
+		Prewarmer.Stop();
 }
 
 
@@ -389,6 +420,7 @@ void Viewer::SortImages(Settings::SortKeyEnum key, bool ascending)
 	}
 
 	Images.Sort(sortFn);
+	ImagesGeneration++;
 }
 
 
@@ -452,10 +484,66 @@ void Viewer::AutoPropertyWindow()
 void Viewer::LoadCurrImage()
 {
 	tAssert(CurrImage);
-	bool imgJustLoaded = false;
+
+	// Only stepping sets a direction. A jump keeps whatever direction the user was last stepping in.
+	if (NavDirection != 0)
+		PrefetchDirection = NavDirection;
+	NavDirection = 0;
+
+	// Navigation coalesces. Only the image being navigated to keeps loading and anything it superseded is cancelled.
+	if (LoadingImage != CurrImage)
+		StopLoadingImage();
+
 	if (!CurrImage->IsLoaded())
-		imgJustLoaded = CurrImage->Load();
+	{
+		// The prefetches were for the neighbours of an image we have left. Whatever is still wanted is asked for
+		// again once this one is showing. If the current image was one of them its job carries on.
+		Neighbours.erase(std::remove(Neighbours.begin(), Neighbours.end(), CurrImage), Neighbours.end());
+		StopPrefetch();
+
+		// Decoding is done by a worker so the UI stays responsive however big the file is. The rest of the work is
+		// done by FinishLoadCurrImage when the job completes. The prewarmer stays out of the way until then. A
+		// prefetch already in flight for this image is moved to the foreground lane rather than started again.
+		if (!LoadingImage)
+		{
+			CurrImage->RequestLoad();
+			LoadingImage = CurrImage;
+			Prewarmer.Pause();
+		}
+		SetWindowTitle();
+		ResetPan();
+		return;
+	}
+
+	FinishLoadCurrImage(false);
+}
+
+
+void Viewer::StopLoadingImage()
+{
+	if (!LoadingImage)
+		return;
+
+	LoadingImage->CancelLoad();
+	LoadingImage = nullptr;
+	Prewarmer.Resume();
+}
+
 
+void Viewer::UpdateLoadingImage()
+{
+	if (!LoadingImage || LoadingImage->IsLoading())
+		return;
+
+	tAssert(LoadingImage == CurrImage);
+	LoadingImage = nullptr;
+	Prewarmer.Resume();
+	FinishLoadCurrImage(CurrImage->IsLoaded());
+}
+
+
+void Viewer::FinishLoadCurrImage(bool imgJustLoaded)
+{
 	AutoPropertyWindow();
 	if
 	(
@@ -477,38 +565,121 @@ void Viewer::LoadCurrImage()
 	SetWindowTitle();
 	ResetPan();
 
-	// We only need to consider unloading an image when a new one is loaded... in this function.
+	// Showing an image makes it the most recently used whether or not it had to be loaded.
+	ImgCache.Touch(CurrImage);
+
+	// We only need to consider unloading an image when a new one is loaded, either here or when a prefetch lands.
+	if (imgJustLoaded)
+		EnforceImageMemBudget();
+
+	RequestPrefetch();
+}
+
+
+void Viewer::EnforceImageMemBudget()
+{
 	// We currently do not allow unloading when in slideshow and the frame duration is small.
 	bool slideshowSmallDuration = SlideshowPlaying && (Config.SlideshowPeriod < 0.5f);
-	if (imgJustLoaded && !slideshowSmallDuration)
+	if (!slideshowSmallDuration)
 	{
-		ImagesLoadTimeSorted.Sort(Compare_ImageLoadTimeAscending);
-
-		int64 usedMem = 0;
-		for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
-			usedMem += int64((*iter).Info.MemSizeBytes);
-
 		int64 allowedMem = int64(Config.MaxImageMemMB) * 1024 * 1024;
-		if (usedMem > allowedMem)
+		if (ImgCache.GetUsedBytes() > allowedMem)
 		{
-			tPrintf("Used image mem (%|64d) bigger than max (%|64d). Unloading.\n", usedMem, allowedMem);
-			for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
+			tPrintf("Used image mem (%|64d) bigger than max (%|64d). Unloading.\n", ImgCache.GetUsedBytes(), allowedMem);
+
+			// Never unload the current image or its neighbours. RequestPrefetch keeps those within the budget.
+			auto keep = [](const Image* i) -> bool
 			{
-				Image* i = iter.GetObject();
+				return (i == CurrImage) || (std::find(Neighbours.begin(), Neighbours.end(), i) != Neighbours.end());
+			};
+			ImgCache.Evict(allowedMem, keep);
+			tPrintf("Used mem %|64dB out of max %|64dB.\n", ImgCache.GetUsedBytes(), allowedMem);
+		}
+	}
+}
 
-				// Never unload the current image.
-				if (i->IsLoaded() && (i != CurrImage))
-				{
-					tPrintf("Unloading %s freeing %d Bytes\n", tSystem::tGetFileName(i->Filename).Chars(), i->Info.MemSizeBytes);
-					usedMem -= i->Info.MemSizeBytes;
-					i->Unload();
-					if (usedMem < allowedMem)
-						break;
-				}
-			}
-			tPrintf("Used mem %|64dB out of max %|64dB.\n", usedMem, allowedMem);
+
+void Viewer::RequestPrefetch()
+{
+	// The wanted images, nearest first. Config.PrefetchCount ahead in the direction of travel and one behind so
+	// turning back is instant too. Follows the same wrapping rules as OnNext and OnPrevious.
+	std::vector<Image*> wanted;
+	bool circ = SlideshowPlaying && Config.SlideshowLooping;
+	auto step = [circ](Image* image, int dir) -> Image*
+	{
+		if (dir > 0)
+			return circ ? Images.NextCirc(image) : image->Next();
+		return circ ? Images.PrevCirc(image) : image->Prev();
+	};
+
+	if (CurrImage && (Config.PrefetchCount > 0))
+	{
+		Image* image = CurrImage;
+		for (int n = 0; n < Config.PrefetchCount; n++)
+		{
+			image = step(image, PrefetchDirection);
+			if (!image || (image == CurrImage))
+				break;
+			if (std::find(wanted.begin(), wanted.end(), image) == wanted.end())
+				wanted.push_back(image);
 		}
+
+		Image* behind = step(CurrImage, -PrefetchDirection);
+		if (behind && (behind != CurrImage) && (std::find(wanted.begin(), wanted.end(), behind) == wanted.end()))
+			wanted.insert(wanted.begin() + tMin(1, int(wanted.size())), behind);
 	}
+
+	// Stop the ones we no longer want. Those already loaded stay loaded but lose their protection from unloading.
+	for (Image* image : Neighbours)
+		if (std::find(wanted.begin(), wanted.end(), image) == wanted.end())
+			image->CancelLoad();
+
+	// Only as many neighbours as fit in the memory budget alongside the current image. Anything else loaded is fair
+	// game for EnforceImageMemBudget. Until an image has been seen its decoded size is estimated from the thumbnail
+	// cache, or failing that from the file size.
+	int64 allowedMem = int64(Config.MaxImageMemMB) * 1024 * 1024;
+	int64 protectedMem = CurrImage ? CurrImage->Info.MemSizeBytes : 0;
+	Neighbours.clear();
+	for (Image* image : wanted)
+	{
+		int64 mem = image->IsLoaded() ? image->Info.MemSizeBytes :
+			((image->CachePrimaryArea > 0) ? int64(image->CachePrimaryArea) * 4 : int64(image->FileSizeB));
+		if (protectedMem + mem > allowedMem)
+		{
+			image->CancelLoad();
+			continue;
+		}
+
+		protectedMem += mem;
+		Neighbours.push_back(image);
+		image->RequestLoad(WorkerPool::Priority::Prefetch);
+	}
+
+	NumPrefetching = 0;
+	for (Image* image : Neighbours)
+		NumPrefetching += image->IsLoading() ? 1 : 0;
+}
+
+
+void Viewer::StopPrefetch()
+{
+	for (Image* image : Neighbours)
+		image->CancelLoad();
+	Neighbours.clear();
+	NumPrefetching = 0;
+}
+
+
+void Viewer::UpdatePrefetch()
+{
+	// A prefetch landing is the other time memory use goes up.
+	int numPrefetching = 0;
+	for (Image* image : Neighbours)
+		numPrefetching += image->IsLoading() ? 1 : 0;
+
+	if (numPrefetching < NumPrefetching)
+		EnforceImageMemBudget();
+	NumPrefetching = numPrefetching;
 }
 
 
@@ -522,6 +693,7 @@ bool Viewer::OnPrevious()
 		SlideshowCountdown = Config.SlideshowPeriod;
 
 	CurrImage = circ ? Images.PrevCirc(CurrImage) : CurrImage->Prev();
+	NavDirection = -1;
 	LoadCurrImage();
 	return true;
 }
@@ -537,6 +709,7 @@ bool Viewer::OnNext()
 		SlideshowCountdown = Config.SlideshowPeriod;
 
 	CurrImage = circ ? Images.NextCirc(CurrImage) : CurrImage->Next();
+	NavDirection = 1;
 	LoadCurrImage();
 	return true;
 }
@@ -870,6 +1043,14 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	if (dopoll)
 		glfwPollEvents();
 
+	// Hand finished background jobs (thumbnails etc) back to their owners. This is the only place completions run.
+	Workers.ProcessCompletions();
+	UpdateLoadingImage();
+	UpdatePrefetch();
+	ThumbCache.Update(int64(Config.MaxCacheMB)*1024*1024);
+	ThumbAtlas.Update();
+	Prewarmer.Update(int64(Config.PrewarmMBPerSec)*1024*1024);
+
 	if (Config.TransparentWorkArea)
 		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	else
@@ -924,7 +1105,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	int mouseXi = int(mouseX);
 	int mouseYi = int(mouseY);
 
-	if (CurrImage)
+	if (CurrImage && CurrImage->IsLoaded())
 	{
 		if (!skipUpdatePlaying)
 			CurrImage->UpdatePlaying(float(dt));
@@ -1024,7 +1205,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			DrawBackground(left, bottom, right-left, top-bottom);
 
 		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-		CurrImage->Bind();
+		uint64 texID = CurrImage->Bind();
 		glEnable(GL_TEXTURE_2D);
 
 		if (RotateAnglePreview != 0.0f)
@@ -1039,24 +1220,33 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			glMultMatrixf(rotMat.E);
 		}
 
-		glBegin(GL_QUADS);
-		if (!Config.Tile)
+		// A tiled picture has nothing to draw until its overview is made.
+		if (texID != 0)
 		{
-			glTexCoord2f(0.0f + umarg + uoff, 0.0f + vmarg + voff); glVertex2f(left,  bottom);
-			glTexCoord2f(0.0f + umarg + uoff, 1.0f - vmarg + voff); glVertex2f(left,  top);
-			glTexCoord2f(1.0f - umarg + uoff, 1.0f - vmarg + voff); glVertex2f(right, top);
-			glTexCoord2f(1.0f - umarg + uoff, 0.0f + vmarg + voff); glVertex2f(right, bottom);
-		}
-		else
-		{
-			float repU = draww/(right-left);	float offU = (1.0f-repU)/2.0f;
-			float repV = drawh/(top-bottom);	float offV = (1.0f-repV)/2.0f;
-			glTexCoord2f(offU + 0.0f + umarg + uoff,	offV + 0.0f + vmarg + voff);	glVertex2f(hmargin,			vmargin);
-			glTexCoord2f(offU + 0.0f + umarg + uoff,	offV + repV - vmarg + voff);	glVertex2f(hmargin,			vmargin+drawh);
-			glTexCoord2f(offU + repU - umarg + uoff,	offV + repV - vmarg + voff);	glVertex2f(hmargin+draww,	vmargin+drawh);
-			glTexCoord2f(offU + repU - umarg + uoff,	offV + 0.0f + vmarg + voff);	glVertex2f(hmargin+draww,	vmargin);
+			glBegin(GL_QUADS);
+			if (!Config.Tile)
+			{
+				glTexCoord2f(0.0f + umarg + uoff, 0.0f + vmarg + voff); glVertex2f(left,  bottom);
+				glTexCoord2f(0.0f + umarg + uoff, 1.0f - vmarg + voff); glVertex2f(left,  top);
+				glTexCoord2f(1.0f - umarg + uoff, 1.0f - vmarg + voff); glVertex2f(right, top);
+				glTexCoord2f(1.0f - umarg + uoff, 0.0f + vmarg + voff); glVertex2f(right, bottom);
+			}
+			else
+			{
+				float repU = draww/(right-left);	float offU = (1.0f-repU)/2.0f;
+				float repV = drawh/(top-bottom);	float offV = (1.0f-repV)/2.0f;
+				glTexCoord2f(offU + 0.0f + umarg + uoff,	offV + 0.0f + vmarg + voff);	glVertex2f(hmargin,			vmargin);
+				glTexCoord2f(offU + 0.0f + umarg + uoff,	offV + repV - vmarg + voff);	glVertex2f(hmargin,			vmargin+drawh);
+				glTexCoord2f(offU + repU - umarg + uoff,	offV + repV - vmarg + voff);	glVertex2f(hmargin+draww,	vmargin+drawh);
+				glTexCoord2f(offU + repU - umarg + uoff,	offV + 0.0f + vmarg + voff);	glVertex2f(hmargin+draww,	vmargin);
+			}
+			glEnd();
+
+			// The full resolution tiles go over the overview. When tiling the picture across the work area, or while
+			// previewing a rotation, only the overview is drawn.
+			if (CurrImage->IsTiled() && !Config.Tile && (RotateAnglePreview == 0.0f))
+				CurrImage->DrawTiles(left, right, bottom, top, umarg+uoff, vmarg+voff, 1.0f-umarg+uoff, 1.0f-vmarg+voff);
 		}
-		glEnd();
 
 		if (RotateAnglePreview != 0.0f)
 	 		glPopMatrix();
@@ -1210,6 +1400,19 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		ImGui::End();
 	}
 
+	// The arc sweeps once a second while the current image is being decoded or its tiles are being prepared.
+	if (CurrImage && (CurrImage->IsLoading() || CurrImage->IsTiling()))
+	{
+		ImGui::SetNextWindowPos(tVector2((workAreaW>>1)-22.0f+7.0f, float(topUIHeight) + float(workAreaH>>1) - 22.0f));
+		ImGui::Begin("LoadProgress", nullptr, flagsImgButton | ImGuiWindowFlags_NoInputs);
+		ImGui::SetCursorPos(tVector2(15, 14));
+
+		float time = float(ImGui::GetTime());
+		float percent = time - tMath::tFloor(time);
+		ProgressArc(8.0f, percent, ImVec4(1.0f, 1.0f, 1.0f, 1.0f), Viewer::ColourClear);
+		ImGui::End();
+	}
+
 	if (!ImGui::GetIO().WantCaptureMouse)
 		DisappearCountdown -= dt;
 	tVector2 mousePos(mouseX, mouseY);
@@ -1456,19 +1659,21 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		{
 			ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, tVector2(4,3));
 
-			bool undoEnabled = CurrImage && CurrImage->IsUndoAvailable();
+			// Nothing can be edited while the current image is still loading.
+			bool editEnabled = CurrImage && CurrImage->IsLoaded();
+			bool undoEnabled = editEnabled && CurrImage->IsUndoAvailable();
 			tString undoDesc = undoEnabled ? CurrImage->GetUndoDesc() : tString();
 			tString undoStr; tsPrintf(undoStr, "Undo %s", undoDesc.Chars());
 			if (ImGui::MenuItem(undoStr, "Ctrl-Z", false, undoEnabled))
 				Undo();
 
-			bool redoEnabled = CurrImage && CurrImage->IsRedoAvailable();
+			bool redoEnabled = editEnabled && CurrImage->IsRedoAvailable();
 			tString redoDesc = redoEnabled ? CurrImage->GetRedoDesc() : tString();
 			tString redoStr; tsPrintf(redoStr, "Redo %s", redoDesc.Chars());
 			if (ImGui::MenuItem(redoStr, "Ctrl-Y", false, redoEnabled))
 				Redo();
 
-			if (ImGui::MenuItem("Flip Vertically", "Ctrl <", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
+			if (ImGui::MenuItem("Flip Vertically", "Ctrl <", false, editEnabled && !CurrImage->IsAltPictureEnabled()))
 			{
 				CurrImage->Unbind();
 				CurrImage->Flip(false);
@@ -1476,7 +1681,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 				SetWindowTitle();
 			}
 
-			if (ImGui::MenuItem("Flip Horizontally", "Ctrl >", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
+			if (ImGui::MenuItem("Flip Horizontally", "Ctrl >", false, editEnabled && !CurrImage->IsAltPictureEnabled()))
 			{
 				CurrImage->Unbind();
 				CurrImage->Flip(true);
@@ -1484,7 +1689,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 				SetWindowTitle();
 			}
 
-			if (ImGui::MenuItem("Rotate Anti-Clockwise", "<", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
+			if (ImGui::MenuItem("Rotate Anti-Clockwise", "<", false, editEnabled && !CurrImage->IsAltPictureEnabled()))
 			{
 				CurrImage->Unbind();
 				CurrImage->Rotate90(true);
@@ -1492,7 +1697,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 				SetWindowTitle();
 			}
 
-			if (ImGui::MenuItem("Rotate Clockwise", ">", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
+			if (ImGui::MenuItem("Rotate Clockwise", ">", false, editEnabled && !CurrImage->IsAltPictureEnabled()))
 			{
 				CurrImage->Unbind();
 				CurrImage->Rotate90(false);
@@ -1500,15 +1705,15 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 				SetWindowTitle();
 			}
 
-			ImGui::MenuItem("Crop...", "/", &CropMode);
+			ImGui::MenuItem("Crop...", "/", &CropMode, editEnabled);
 
-			if (ImGui::MenuItem("Resize Image...", "Alt-R") && CurrImage)
+			if (ImGui::MenuItem("Resize Image...", "Alt-R", false, editEnabled))
 				resizeImagePressed = true;
 
-			if (ImGui::MenuItem("Resize Canvas...", "Ctrl-R") && CurrImage)
+			if (ImGui::MenuItem("Resize Canvas...", "Ctrl-R", false, editEnabled))
 				resizeCanvasPressed = true;
 
-			if (ImGui::MenuItem("Rotate Image...", "R") && CurrImage)
+			if (ImGui::MenuItem("Rotate Image...", "R", false, editEnabled))
 				rotateImagePressed = true;
 
 			ImGui::MenuItem("Edit Pixel", "A", &Config.ShowPixelEditor);
@@ -1608,6 +1813,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		{
 			ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, tVector2(4,3));
 			ImGui::MenuItem("Cheat Sheet", "F1", &ShowCheatSheet);
+			ImGui::MenuItem("Load Statistics", "", &ShowLoadStats);
 			ImGui::MenuItem("About", "", &ShowAbout);
 			ImGui::PopStyleVar();
 			ImGui::EndMenu();
@@ -1626,7 +1832,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		if (ImGui::BeginPopup("CopyColourAs"))
 			ColourCopyAs();
 
-		bool transAvail = CurrImage ? !CurrImage->IsAltPictureEnabled() : false;
+		bool transAvail = (CurrImage && CurrImage->IsLoaded()) ? !CurrImage->IsAltPictureEnabled() : false;
 		if (ImGui::ImageButton
 		(
 			ImTextureID(FlipVImage.Bind()), ToolImageSize, tVector2(0, 1), tVector2(1, 0), 1, ColourBG,
@@ -1827,6 +2033,9 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	if (ShowAbout)
 		ShowAboutPopup(&ShowAbout);
 
+	if (ShowLoadStats)
+		ShowLoadStatsWindow(&ShowLoadStats);
+
 	ShowCropPopup(tVector4(left, right, top, bottom), tVector2(umarg, vmarg), tVector2(uoff, voff));
 
 	if (Request_DeleteFileModal)
@@ -1870,6 +2079,9 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	glViewport(0, 0, dispw, disph);
 	ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
 
+	// Textures drawn this frame were touched by Bind, so eviction can only free ones that are no longer on screen.
+	TexResidency.EndFrame(int64(Config.MaxTextureMemMB) * 1024 * 1024);
+
 	glfwMakeContextCurrent(window);
 	glfwSwapBuffers(window);
 	FrameNumber++;
@@ -2000,6 +2212,7 @@ void Viewer::SetBasicViewAndBehaviour()
 	PropEditorWindow				= false;
 	ShowCheatSheet					= false;
 	ShowAbout						= false;
+	ShowLoadStats					= false;
 }
 
 
@@ -2013,7 +2226,7 @@ bool Viewer::IsBasicViewAndBehaviour()
 		Config.SlideshowLooping										&& Config.SlideshowProgressArc	&&
 		tMath::tApproxEqual(Config.SlideshowPeriod, 8.0)			&&
 		(CurrZoomMode == ZoomMode::DownscaleOnly)					&&
-		!PropEditorWindow			&& !ShowCheatSheet				&& !ShowAbout
+		!PropEditorWindow			&& !ShowCheatSheet				&& !ShowAbout					&& !ShowLoadStats
 	);
 }
 
@@ -2034,7 +2247,10 @@ void Viewer::ZoomDownscaleOnly()
 
 void Viewer::Undo()
 {
-	tAssert(CurrImage && CurrImage->IsUndoAvailable());
+	// Shortcuts can arrive while the image is still loading.
+	if (!CurrImage || !CurrImage->IsLoaded() || !CurrImage->IsUndoAvailable())
+		return;
+
 	CurrImage->Unbind();
 	CurrImage->Undo();
 	CurrImage->Bind();
@@ -2044,7 +2260,10 @@ void Viewer::Undo()
 
 void Viewer::Redo()
 {
-	tAssert(CurrImage && CurrImage->IsRedoAvailable());
+	// Shortcuts can arrive while the image is still loading.
+	if (!CurrImage || !CurrImage->IsLoaded() || !CurrImage->IsRedoAvailable())
+		return;
+
 	CurrImage->Unbind();
 	CurrImage->Redo();
 	CurrImage->Bind();
@@ -2285,16 +2504,14 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 		case GLFW_KEY_Y:		// Redo.
 			if (modifiers == GLFW_MOD_CONTROL)
 			{
-				if (CurrImage && CurrImage->IsRedoAvailable())
-					Redo();
+				Redo();
 			}
 			break;
 
 		case GLFW_KEY_Z:
 			if (modifiers == GLFW_MOD_CONTROL)
 			{
-				if (CurrImage && CurrImage->IsUndoAvailable())
-					Undo();
+				Undo();
 			}
 			else
 			{
@@ -2305,7 +2522,7 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 			break;
 
 		case GLFW_KEY_R:			// Resize Image.
-			if (!CurrImage)
+			if (!CurrImage || !CurrImage->IsLoaded())
 				break;
 			if (modifiers == GLFW_MOD_ALT)
 				Request_ResizeImageModal = true;
@@ -2479,28 +2696,44 @@ void Viewer::IconifyCallback(GLFWwindow* window, int iconified)
 
 int Viewer::RemoveOldCacheFiles(const tString& cacheDir)
 {
+	// Thumbnails used to be stored one file per image. Those files are no longer read so we remove any left over.
 	tList<tSystem::tFileInfo> cacheFiles;
 	tSystem::tFindFilesFast(cacheFiles, cacheDir, "bin");
-	int numFiles = cacheFiles.NumItems();
-	if (numFiles <= Config.MaxCacheFiles)
-		return 0;
+	int deletedCount = 0;
+	for (tSystem::tFileInfo* info = cacheFiles.First(); info; info = info->Next())
+		if (tDeleteFile(info->FileName))
+			deletedCount++;
 
-	cacheFiles.Sort(Compare_FileCreationTimeAscending);
-	int targetCount = tClampMin(Config.MaxCacheFiles - 100, 0);
+	return deletedCount;
+}
 
-	int numToRemove = numFiles - targetCount;
-	tAssert(numToRemove >= 0);
-	int deletedCount = 0;
-	while (numToRemove)
+
+int Viewer::RunPrewarm(const tString& rootDir)
+{
+	tString dir = tSystem::tIsAbsolutePath(rootDir) ? rootDir : tSystem::tGetCurrentDir() + rootDir;
+	dir = tSystem::tGetSimplifiedPath(dir);
+	if (dir[dir.Length()-1] != '/')
+		dir = dir + "/";
+
+	// Nothing else is competing for the machine so all workers are used and there is no read budget.
+	tPrintf("Prewarming thumbnails in %s\n", dir.Chars());
+	Prewarmer.Start(dir, Workers.GetNumWorkers());
+	int lastRemaining = -1;
+	while (Prewarmer.IsActive())
 	{
-		tSystem::tFileInfo* head = cacheFiles.Remove();
-		if (tDeleteFile(head->FileName))
-			deletedCount++;
-		delete head;
-		numToRemove--;
+		Workers.ProcessCompletions();
+		Prewarmer.Update(0);
+		ThumbCache.Update(int64(Config.MaxCacheMB)*1024*1024);
+
+		int remaining = Prewarmer.GetNumRemaining();
+		if ((remaining != lastRemaining) && ((remaining % 100) == 0))
+			tPrintf("Prewarm %d remaining\n", remaining);
+		lastRemaining = remaining;
+		tSystem::tSleep(10);
 	}
 
-	return deletedCount;
+	tPrintf("Prewarm generated %d thumbnails\n", Prewarmer.GetNumGenerated());
+	return Prewarmer.GetNumGenerated();
 }
 
 
@@ -2653,7 +2886,39 @@ int main(int argc, char** argv)
 		tSystem::tCreateDir(Viewer::Image::ThumbCacheDir);
 	
 	Viewer::Config.Load(cfgFile);
+	Viewer::LoadStats.SaveFile = tSystem::tGetDir(cfgFile) + "LoadStats.txt";
 	Viewer::PendingTransparentWorkArea = Viewer::Config.TransparentWorkArea;
+	Viewer::Workers.Startup();
+	bool cacheOpen = Viewer::ThumbCache.Open(Viewer::Image::ThumbCacheDir);
+
+	// Command line prewarm mode. No window is created. There is no GL context either, which is fine because block
+	// compressed DDS files are decoded on the CPU. Prewarming is pointless without the shared cache, which another
+	// viewer may be holding.
+	if (Viewer::PrewarmOption.IsPresent())
+	{
+		glfwTerminate();
+		if (!cacheOpen)
+		{
+			tPrintf("Prewarm failed. Could not open the thumbnail cache in %s. Is a viewer running?\n", Viewer::Image::ThumbCacheDir.Chars());
+			Viewer::Workers.Shutdown();
+			return 1;
+		}
+		Viewer::RunPrewarm(Viewer::PrewarmOption.Arg1());
+		Viewer::Workers.Shutdown();
+		Viewer::ThumbCache.Close();
+		return 0;
+	}
+
+	// Another viewer has the shared cache. Thumbnails go to a private one for this session instead.
+	if (cacheOpen)
+		Viewer::ThumbCache.RequestCompact();
+	else if (Viewer::ThumbCache.OpenSession(Viewer::Image::ThumbCacheDir))
+		tPrintf("Thumbnail cache in use. Using a session cache that is deleted on exit.\n");
+	else
+		tPrintf("Could not open a thumbnail cache. Thumbnails will not be cached.\n");
+
+	// Old undo snapshots are written next to the thumbnail cache when they go over their memory budget.
+	Undo::OpenSpillFile(Viewer::Image::ThumbCacheDir);
 
 	// We start with window invisible. For windows DwmSetWindowAttribute won't redraw properly otherwise.
 	// For all plats, we want to position the window before displaying it.
@@ -2736,6 +3001,7 @@ int main(int argc, char** argv)
 		return 10;
     }
 	tPrintf("GLAD V %s\n", glGetString(GL_VERSION));
+	Viewer::TiledTexture::QueryMaxTextureSize();
 
 	glfwSwapInterval(1); // Enable vsync
 	glfwSetWindowRefreshCallback(Viewer::Window, Viewer::WindowRefreshFun);
@@ -2821,10 +3087,17 @@ int main(int argc, char** argv)
 		lastUpdateTime = currUpdateTime;
 	}
 
-	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deconstructing the images may block for a bit while shutting
-	// down worker threads. We could show a 'shutting down' popup here if we wanted -- if Image::ThumbnailNumThreadsRunning is > 0.
+	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deconstructing the images may block for a bit while
+	// running thumbnail jobs finish. Queued ones are cancelled. We could show a 'shutting down' popup here if we wanted -- if
+	// Workers.GetNumRunning() is > 0.
+	Viewer::StopLoadingImage();
+	Viewer::StopPrefetch();
 	Viewer::Images.Clear();	
 	Viewer::UnloadAppImages();
+	Undo::CloseSpillFile();
+	Viewer::ThumbAtlas.Clear();
+	Viewer::Prewarmer.Stop();
+	Viewer::Workers.Shutdown();
 
 	// Get current window geometry and set in config file if we're not in fullscreen mode and not iconified.
 	if (!Viewer::FullscreenMode && !Viewer::WindowIconified)
@@ -2844,10 +3117,16 @@ int main(int argc, char** argv)
 	glfwDestroyWindow(Viewer::Window);
 	glfwTerminate();
 
-	// Before we go, lets clear out any old cache files.
+	// Before we go, lets clear out any old cache files. The cache must be closed before its directory can be deleted.
 	if (Viewer::DeleteAllCacheFilesOnExit)
+	{
+		Viewer::ThumbCache.Close();
 		tSystem::tDeleteDir(Viewer::Image::ThumbCacheDir);
+	}
 	else
+	{
 		Viewer::RemoveOldCacheFiles(Viewer::Image::ThumbCacheDir);
+		Viewer::ThumbCache.Close();
+	}
 	return 0;
 }
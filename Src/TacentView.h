@@ -28,7 +28,7 @@ namespace Viewer
 	extern tString ImagesDir;
 	extern tList<tStringItem> ImagesSubDirs;
 	extern tList<Viewer::Image> Images;
-	extern tItList<Viewer::Image> ImagesLoadTimeSorted;
+	extern uint64 ImagesGeneration;
 	extern tCmdLine::tParam ImageFileParam;
 	extern tColouri PixelColour;
 	extern Viewer::Image DefaultThumbnailImage;
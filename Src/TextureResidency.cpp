@@ -0,0 +1,80 @@
+// TextureResidency.cpp
+//
+// Keeps the textures of image frames within a video memory budget. Frames are uploaded when they are first shown and
+// registered here with their size. At the end of each frame, if the total is over budget, the textures bound least
+// recently are handed back to their images to delete. An image uploads them again if they are shown later. Textures
+// used in the current frame are never evicted, so whatever is on screen can take the total over budget.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <iterator>
+#include <Foundation/tFundamentals.h>
+#include "TextureResidency.h"
+#include "Image.h"
+
+
+namespace Viewer
+{
+	TextureResidency TexResidency;
+}
+
+
+void Viewer::TextureResidency::Add(Image* owner, uint texID, int64 numBytes)
+{
+	if (texID == 0)
+		return;
+
+	// A texture name can only be reused after it was deleted, so an existing entry is stale. Replace it.
+	Release(texID);
+	Entries.push_back({ owner, texID, numBytes, FrameNum });
+	Lookup[texID] = std::prev(Entries.end());
+	ResidentBytes += numBytes;
+	PeakBytes = tMath::tMax(PeakBytes, ResidentBytes);
+	NumUploads++;
+}
+
+
+void Viewer::TextureResidency::Touch(uint texID)
+{
+	auto found = Lookup.find(texID);
+	if (found == Lookup.end())
+		return;
+
+	// Splicing to the back keeps the iterator in the map valid.
+	found->second->LastFrame = FrameNum;
+	Entries.splice(Entries.end(), Entries, found->second);
+}
+
+
+void Viewer::TextureResidency::Release(uint texID)
+{
+	auto found = Lookup.find(texID);
+	if (found == Lookup.end())
+		return;
+
+	ResidentBytes -= found->second->Bytes;
+	Entries.erase(found->second);
+	Lookup.erase(found);
+}
+
+
+void Viewer::TextureResidency::EndFrame(int64 budgetBytes)
+{
+	// The list is in the order textures were last touched, so the first one used this frame ends the search.
+	while ((ResidentBytes > budgetBytes) && !Entries.empty() && (Entries.front().LastFrame != FrameNum))
+	{
+		Entry entry = Entries.front();
+		Release(entry.TexID);
+		entry.Owner->EvictTexture(entry.TexID);
+		NumEvictions++;
+	}
+	FrameNum++;
+}
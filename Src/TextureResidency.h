@@ -0,0 +1,74 @@
+// TextureResidency.h
+//
+// Keeps the textures of image frames within a video memory budget. Frames are uploaded when they are first shown and
+// registered here with their size. At the end of each frame, if the total is over budget, the textures bound least
+// recently are handed back to their images to delete. An image uploads them again if they are shown later. Textures
+// used in the current frame are never evicted, so whatever is on screen can take the total over budget.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <Foundation/tStandard.h>
+namespace Viewer
+{
+	class Image;
+
+
+// Main thread only. Independent of the image cache. An image can keep its pixels in main memory while its textures
+// are evicted, and unloading an image releases its textures whether or not they were over budget.
+class TextureResidency
+{
+public:
+	// Call after uploading a texture. It starts out as the most recently used.
+	void Add(Image* owner, uint texID, int64 numBytes);
+
+	// Call whenever the texture is bound for drawing.
+	void Touch(uint texID);
+
+	// Call before the owner deletes the texture itself. Does nothing for textures that were never added.
+	void Release(uint texID);
+
+	// Call once per frame after drawing. Evicts least recently used textures not touched this frame until the resident
+	// total is within the budget, then starts a new frame.
+	void EndFrame(int64 budgetBytes);
+
+	int GetNumResident() const																							{ return int(Entries.size()); }
+	int64 GetResidentBytes() const																						{ return ResidentBytes; }
+	int64 GetPeakBytes() const																							{ return PeakBytes; }
+	uint64 GetNumUploads() const																						{ return NumUploads; }
+	uint64 GetNumEvictions() const																						{ return NumEvictions; }
+
+private:
+	struct Entry
+	{
+		Image* Owner;
+		uint TexID;
+		int64 Bytes;
+		uint64 LastFrame;
+	};
+
+	// Oldest at the front. The map finds an entry from its texture so touching and releasing are constant time.
+	std::list<Entry> Entries;
+	std::unordered_map<uint, std::list<Entry>::iterator> Lookup;
+	uint64 FrameNum							= 1;
+	int64 ResidentBytes						= 0;
+	int64 PeakBytes							= 0;
+	uint64 NumUploads						= 0;
+	uint64 NumEvictions						= 0;
+};
+
+
+extern TextureResidency TexResidency;
+
+
+}
@@ -0,0 +1,343 @@
+// ThumbnailAtlas.cpp
+//
+// Packs thumbnails into a small number of large textures. Each page is divided into equal sized cells and cells are
+// reused through a free list. Thumbnails that have not been drawn for a while are evicted from the atlas. Their
+// pictures remain in main memory so they are simply uploaded again if they come back into view.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <glad/glad.h>
+#include <Image/tLayer.h>
+#include "ThumbnailAtlas.h"
+#include "Settings.h"
+using namespace tImage;
+
+
+namespace Viewer
+{
+	ThumbnailAtlas ThumbAtlas;
+}
+
+
+namespace
+{
+	// A 2048x2048 page holds 112 thumbnails at 256x144. Every GL 2.1 implementation supports this size.
+	const int PageSize					= 2048;
+
+	// Mipmap levels are only kept while the cell edges stay on texel boundaries, so a cell never filters in texels
+	// from its neighbours. Thumbnails are never displayed smaller than a quarter size so five levels is plenty.
+	const int MaxLevels					= 5;
+
+	// Above this many pages we reuse the least recently drawn cell rather than create a new page. About 22MB each.
+	const int MaxPages					= 8;
+
+	// Uploading builds mipmaps on the main thread. Spreading uploads over a few frames avoids a hitch when a folder
+	// full of cached thumbnails scrolls into view.
+	const int MaxUploadsPerFrame		= 16;
+
+	// Cells not drawn for this many frames are evicted by Update. Cells drawn this frame or last are never evicted.
+	const uint64 StaleFrames			= 600;
+	const uint64 StaleCheckInterval		= 60;
+}
+
+
+bool Viewer::ThumbnailAtlas::Allocate(Handle& handle, const tPicture& picture)
+{
+	Free(handle);
+	if (!picture.IsValid() || (picture.GetWidth() > PageSize) || (picture.GetHeight() > PageSize))
+		return false;
+
+	if (NumUploadsThisFrame >= MaxUploadsPerFrame)
+		return false;
+
+	int cellW = picture.GetWidth();
+	int cellH = picture.GetHeight();
+
+	// First look for a page of the right cell size with a free cell.
+	int pageIndex = -1;
+	int numPages = 0;
+	for (int p = 0; p < int(Pages.size()); p++)
+	{
+		Page& page = Pages[p];
+		if (!page.TexID)
+			continue;
+		numPages++;
+		if ((page.CellWidth == cellW) && (page.CellHeight == cellH) && !page.FreeCells.empty())
+		{
+			pageIndex = p;
+			break;
+		}
+	}
+
+	int cell = -1;
+	if (pageIndex >= 0)
+	{
+		Page& page = Pages[pageIndex];
+		cell = page.FreeCells.back();
+		page.FreeCells.pop_back();
+	}
+
+	// At the page limit we take over the cell that was drawn longest ago.
+	if ((cell < 0) && (numPages >= MaxPages))
+		cell = EvictLeastRecentlyUsed(cellW, cellH, pageIndex);
+
+	// Otherwise, or if everything is on screen, we need a new page. Holes left by deleted pages are reused.
+	if (cell < 0)
+	{
+		pageIndex = -1;
+		for (int p = 0; (p < int(Pages.size())) && (pageIndex < 0); p++)
+			if (!Pages[p].TexID)
+				pageIndex = p;
+
+		if (pageIndex < 0)
+		{
+			Pages.emplace_back();
+			pageIndex = int(Pages.size()) - 1;
+		}
+
+		Page& page = Pages[pageIndex];
+		if (!CreatePage(page, cellW, cellH))
+			return false;
+		cell = page.FreeCells.back();
+		page.FreeCells.pop_back();
+	}
+
+	Page& page = Pages[pageIndex];
+	Cell& c = page.Cells[cell];
+	c.Used = true;
+	c.Generation = NextGeneration++;
+	c.LastUsedFrame = Frame;
+	Upload(page, cell, picture);
+	NumUploadsThisFrame++;
+
+	handle.Page = pageIndex;
+	handle.Cell = cell;
+	handle.Generation = c.Generation;
+	return true;
+}
+
+
+bool Viewer::ThumbnailAtlas::Lookup(const Handle& handle, Region& region)
+{
+	if (!handle.IsValid() || (handle.Page >= int(Pages.size())))
+		return false;
+
+	Page& page = Pages[handle.Page];
+	if (!page.TexID || (handle.Cell >= int(page.Cells.size())))
+		return false;
+
+	Cell& cell = page.Cells[handle.Cell];
+	if (!cell.Used || (cell.Generation != handle.Generation))
+		return false;
+
+	cell.LastUsedFrame = Frame;
+
+	// Inset by half a texel so bilinear filtering at the edges doesn't reach into the neighbouring cells.
+	int x = (handle.Cell % page.NumCols) * page.CellWidth;
+	int y = (handle.Cell / page.NumCols) * page.CellHeight;
+	float texel = 1.0f / float(PageSize);
+	region.TexID	= page.TexID;
+	region.U0		= (float(x) + 0.5f) * texel;
+	region.V0		= (float(y) + 0.5f) * texel;
+	region.U1		= (float(x + page.CellWidth) - 0.5f) * texel;
+	region.V1		= (float(y + page.CellHeight) - 0.5f) * texel;
+	return true;
+}
+
+
+void Viewer::ThumbnailAtlas::Free(Handle& handle)
+{
+	if (!handle.IsValid())
+		return;
+
+	if (handle.Page < int(Pages.size()))
+	{
+		Page& page = Pages[handle.Page];
+		if (page.TexID && (handle.Cell < int(page.Cells.size())))
+		{
+			Cell& cell = page.Cells[handle.Cell];
+			if (cell.Used && (cell.Generation == handle.Generation))
+				FreeCell(page, handle.Cell);
+		}
+	}
+
+	handle = Handle();
+}
+
+
+void Viewer::ThumbnailAtlas::Update()
+{
+	Frame++;
+	NumUploadsThisFrame = 0;
+	if (Frame % StaleCheckInterval)
+		return;
+
+	for (Page& page : Pages)
+	{
+		if (!page.TexID)
+			continue;
+
+		for (int c = 0; c < int(page.Cells.size()); c++)
+		{
+			Cell& cell = page.Cells[c];
+			if (cell.Used && (cell.LastUsedFrame + StaleFrames < Frame))
+				FreeCell(page, c);
+		}
+
+		if (int(page.FreeCells.size()) == int(page.Cells.size()))
+			DeletePage(page);
+	}
+
+	while (!Pages.empty() && !Pages.back().TexID)
+		Pages.pop_back();
+}
+
+
+void Viewer::ThumbnailAtlas::Clear()
+{
+	for (Page& page : Pages)
+		DeletePage(page);
+	Pages.clear();
+}
+
+
+int Viewer::ThumbnailAtlas::GetNumPages() const
+{
+	int numPages = 0;
+	for (const Page& page : Pages)
+		if (page.TexID)
+			numPages++;
+	return numPages;
+}
+
+
+int Viewer::ThumbnailAtlas::GetNumUsedCells() const
+{
+	int numUsed = 0;
+	for (const Page& page : Pages)
+		if (page.TexID)
+			numUsed += int(page.Cells.size() - page.FreeCells.size());
+	return numUsed;
+}
+
+
+bool Viewer::ThumbnailAtlas::CreatePage(Page& page, int cellWidth, int cellHeight)
+{
+	int numLevels = 1;
+	while (numLevels < MaxLevels)
+	{
+		int mask = (1 << numLevels) - 1;
+		if ((cellWidth & mask) || (cellHeight & mask))
+			break;
+		numLevels++;
+	}
+
+	glGenTextures(1, &page.TexID);
+	if (!page.TexID)
+		return false;
+
+	glBindTexture(GL_TEXTURE_2D, page.TexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (numLevels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels-1);
+	for (int level = 0; level < numLevels; level++)
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, PageSize >> level, PageSize >> level, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	int numCols = PageSize / cellWidth;
+	int numRows = PageSize / cellHeight;
+	page.CellWidth = cellWidth;
+	page.CellHeight = cellHeight;
+	page.NumCols = numCols;
+	page.NumLevels = numLevels;
+	page.Cells.assign(numCols*numRows, Cell());
+
+	// Reversed so cells are handed out top to bottom. Not important, but easier to look at in a GL debugger.
+	page.FreeCells.resize(numCols*numRows);
+	for (int c = 0; c < numCols*numRows; c++)
+		page.FreeCells[c] = numCols*numRows - 1 - c;
+
+	return true;
+}
+
+
+void Viewer::ThumbnailAtlas::DeletePage(Page& page)
+{
+	if (page.TexID)
+		glDeleteTextures(1, &page.TexID);
+	page = Page();
+}
+
+
+void Viewer::ThumbnailAtlas::FreeCell(Page& page, int cell)
+{
+	page.Cells[cell].Used = false;
+	page.FreeCells.push_back(cell);
+}
+
+
+int Viewer::ThumbnailAtlas::EvictLeastRecentlyUsed(int cellWidth, int cellHeight, int& pageIndex)
+{
+	int bestPage = -1;
+	int bestCell = -1;
+	uint64 bestFrame = Frame - 1;
+	for (int p = 0; p < int(Pages.size()); p++)
+	{
+		Page& page = Pages[p];
+		if (!page.TexID || (page.CellWidth != cellWidth) || (page.CellHeight != cellHeight))
+			continue;
+
+		for (int c = 0; c < int(page.Cells.size()); c++)
+		{
+			if (page.Cells[c].LastUsedFrame < bestFrame)
+			{
+				bestFrame = page.Cells[c].LastUsedFrame;
+				bestPage = p;
+				bestCell = c;
+			}
+		}
+	}
+
+	if (bestCell < 0)
+		return -1;
+
+	// The generation changes when the cell is reallocated, which makes the previous owner's handle stale.
+	pageIndex = bestPage;
+	Pages[bestPage].Cells[bestCell].Used = false;
+	return bestCell;
+}
+
+
+void Viewer::ThumbnailAtlas::Upload(const Page& page, int cell, const tPicture& picture)
+{
+	int x = (cell % page.NumCols) * page.CellWidth;
+	int y = (cell / page.NumCols) * page.CellHeight;
+
+	// GenerateLayers doesn't modify the picture, it just isn't declared const.
+	tPicture& pic = const_cast<tPicture&>(picture);
+	tList<tLayer> layers;
+	if (page.NumLevels > 1)
+		pic.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
+
+	glBindTexture(GL_TEXTURE_2D, page.TexID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (layers.IsEmpty())
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, page.CellWidth, page.CellHeight, GL_RGBA, GL_UNSIGNED_BYTE, pic.GetPixelPointer());
+		return;
+	}
+
+	int level = 0;
+	for (tLayer* layer = layers.First(); layer && (level < page.NumLevels); layer = layer->Next(), level++)
+		glTexSubImage2D(GL_TEXTURE_2D, level, x >> level, y >> level, layer->Width, layer->Height, GL_RGBA, GL_UNSIGNED_BYTE, layer->Data);
+}
@@ -0,0 +1,106 @@
+// ThumbnailAtlas.h
+//
+// Packs thumbnails into a small number of large textures. Each page is divided into equal sized cells and cells are
+// reused through a free list. Thumbnails that have not been drawn for a while are evicted from the atlas. Their
+// pictures remain in main memory so they are simply uploaded again if they come back into view.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Image/tPicture.h>
+namespace Viewer
+{
+
+
+// All functions must be called from the main thread since they make GL calls.
+class ThumbnailAtlas
+{
+public:
+	ThumbnailAtlas()																									{ }
+	~ThumbnailAtlas()																									{ tAssert(Pages.empty()); }
+
+	// A handle is owned by whoever allocated it. It goes stale if the atlas evicts the cell, after which Lookup fails
+	// and the owner should allocate again. Stale handles may still be passed to Free.
+	struct Handle
+	{
+		bool IsValid() const																							{ return Page >= 0; }
+		int Page				= -1;
+		int Cell				= -1;
+		uint32 Generation		= 0;
+	};
+
+	// Texture coordinates are in GL convention with V = 0 at the bottom row of the picture.
+	struct Region
+	{
+		uint64 TexID			= 0;
+		float U0				= 0.0f;
+		float V0				= 0.0f;
+		float U1				= 1.0f;
+		float V1				= 1.0f;
+	};
+
+	// Uploads the picture into a free cell. Pages are created for each distinct picture size. Returns false if the
+	// upload budget for this frame is spent or no texture could be created. Try again next frame.
+	bool Allocate(Handle&, const tImage::tPicture&);
+
+	// Returns true and fills in the region if the handle is still resident. Counts as a use for eviction purposes.
+	bool Lookup(const Handle&, Region&);
+	void Free(Handle&);
+
+	// Call once per frame. Evicts cells that have not been looked up in a long time and deletes empty pages.
+	void Update();
+
+	// Deletes all textures. Must be called before the GL context goes away.
+	void Clear();
+
+	int GetNumPages() const;
+	int GetNumUsedCells() const;
+
+private:
+	struct Cell
+	{
+		bool Used				= false;
+		uint32 Generation		= 0;
+		uint64 LastUsedFrame	= 0;
+	};
+
+	struct Page
+	{
+		uint TexID				= 0;			// Zero if the page slot is unused.
+		int CellWidth			= 0;
+		int CellHeight			= 0;
+		int NumCols				= 0;
+		int NumLevels			= 0;
+		std::vector<Cell> Cells;
+		std::vector<int> FreeCells;
+	};
+
+	bool CreatePage(Page&, int cellWidth, int cellHeight);
+	void DeletePage(Page&);
+	void FreeCell(Page&, int cell);
+	int EvictLeastRecentlyUsed(int cellWidth, int cellHeight, int& pageIndex);
+	void Upload(const Page&, int cell, const tImage::tPicture&);
+
+	// Page indices are stored in handles so deleted pages leave a hole that is reused by the next page created.
+	std::vector<Page> Pages;
+	uint32 NextGeneration		= 1;
+	uint64 Frame				= 1;
+	int NumUploadsThisFrame		= 0;
+};
+
+
+// The atlas used for Content View thumbnails.
+extern ThumbnailAtlas ThumbAtlas;
+
+
+}
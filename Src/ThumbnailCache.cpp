@@ -0,0 +1,719 @@
+// ThumbnailCache.cpp
+//
+// A single-file thumbnail cache. Records are appended to a memory-mapped pack file and located through a hashed
+// index file that is also memory-mapped. A lookup is one probe into the index and a copy out of the pack, with no
+// per-thumbnail filesystem work. Readers may run concurrently from the worker pool. Space left behind by removed
+// records is reclaimed by a compaction pass that runs in the background.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <System/tFile.h>
+#include <System/tPrint.h>
+#include <Foundation/tFundamentals.h>
+#include "ThumbnailCache.h"
+using namespace tMath;
+
+
+namespace Viewer
+{
+	ThumbnailCache ThumbCache;
+
+	const uint32 PackMagic				= 0x4B505654;		// 'TVPK'
+	const uint32 IndexMagic				= 0x58495654;		// 'TVIX'
+	const uint32 RecordMagic			= 0x43525654;		// 'TVRC'
+	const uint32 DeadMagic				= 0x44525654;		// 'TVRD'
+	const uint32 PackVersion			= 1;
+	const uint32 IndexVersion			= 2;
+	const uint32 MinIndexSlots			= 4096;
+	const int64 MinPackBytes			= 16*1024*1024;
+	const int64 CompactMinDeadBytes		= 8*1024*1024;
+	const int MaxEvictionsPerPass		= 512;
+	const int EvictIntervalSeconds		= 2;
+	const int MaxSessions				= 8;		// Private caches for viewers started while the shared one is held.
+
+	inline uint32 GetAccessTime()																						{ return uint32(std::time(nullptr)); }
+}
+static_assert(sizeof(tuint256) == 32, "Thumbnail cache keys must be 32 bytes.");
+
+
+bool Viewer::ThumbnailCache::Open(const tString& cacheDir)
+{
+	Close();
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	PackFile = cacheDir + "Thumbnails.pak";
+	IndexFile = cacheDir + "Thumbnails.idx";
+	return OpenFiles();
+}
+
+
+bool Viewer::ThumbnailCache::OpenSession(const tString& cacheDir)
+{
+	Close();
+	for (int s = 0; s < MaxSessions; s++)
+	{
+		{
+			std::unique_lock<std::shared_mutex> lock(Mutex);
+			tsPrintf(PackFile, "%sThumbnailsSession%d.pak", cacheDir.Chars(), s);
+			tsPrintf(IndexFile, "%sThumbnailsSession%d.idx", cacheDir.Chars(), s);
+			if (!OpenFiles())
+				continue;
+			Session = true;
+		}
+
+		// A session cache left by a viewer that didn't exit cleanly is of no use to anyone.
+		Clear();
+		return IsOpen();
+	}
+	return false;
+}
+
+
+bool Viewer::ThumbnailCache::OpenFiles()
+{
+	if (!Pack.OpenWrite(PackFile, MinPackBytes))
+		return false;
+
+	PackHeader* packHeader = (PackHeader*)Pack.GetData();
+	bool newPack = (packHeader->Magic != PackMagic) || (packHeader->Version != PackVersion);
+	if (newPack)
+	{
+		// Unknown or old format. Start over.
+		tStd::tMemset(Pack.GetData(), 0, int(tMin(Pack.GetSize(), MinPackBytes)));
+		packHeader->Magic = PackMagic;
+		packHeader->Version = PackVersion;
+	}
+
+	if (!Index.OpenWrite(IndexFile, sizeof(IndexHeader)))
+	{
+		Pack.Close();
+		return false;
+	}
+
+	IndexHeader* header = GetHeader();
+	bool indexValid =
+		!newPack &&
+		(header->Magic == IndexMagic) && (header->Version == IndexVersion) &&
+		(header->NumSlots > 0) && ((header->NumSlots & (header->NumSlots - 1)) == 0) &&
+		(Index.GetSize() >= int64(sizeof(IndexHeader) + header->NumSlots*sizeof(Slot))) &&
+		(header->PackEnd >= sizeof(PackHeader)) && (int64(header->PackEnd) <= Pack.GetSize());
+
+	bool ok = indexValid ? true : (newPack ? InitIndex(MinIndexSlots, sizeof(PackHeader)) : RebuildIndex());
+	if (!ok)
+	{
+		Index.Close();
+		Pack.Close();
+	}
+	return ok;
+}
+
+
+void Viewer::ThumbnailCache::Close()
+{
+	// A compaction or eviction in progress needs to finish before we pull the files out from under it.
+	Workers.Abandon(CompactJob);
+	Workers.Abandon(EvictJob);
+	EvictAgain = false;
+
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen() || Session)
+	{
+		Index.Close();
+		Pack.Close();
+		if (Session)
+		{
+			tSystem::tDeleteFile(PackFile);
+			tSystem::tDeleteFile(IndexFile);
+			Session = false;
+		}
+		return;
+	}
+
+	// Access times are only kept in the index so they must be written before we go.
+	ApplyAccesses();
+
+	// The pack grows in large steps. Give back the unused tail.
+	Pack.Resize(int64(GetHeader()->PackEnd));
+	Index.Flush();
+	Index.Close();
+	Pack.Close();
+}
+
+
+int Viewer::ThumbnailCache::FindSlot(const uint8* key) const
+{
+	IndexHeader* header = GetHeader();
+	Slot* slots = GetSlots();
+	uint32 mask = header->NumSlots - 1;
+
+	// The keys are hashes already so any 4 bytes make a good starting slot.
+	uint32 start;
+	tStd::tMemcpy(&start, key, sizeof(start));
+	for (uint32 probe = 0; probe < header->NumSlots; probe++)
+	{
+		Slot& slot = slots[(start + probe) & mask];
+		if (slot.State == SlotState_Empty)
+			return -1;
+
+		if ((slot.State == SlotState_Used) && (tStd::tMemcmp(slot.Key, key, 32) == 0))
+			return int((start + probe) & mask);
+	}
+
+	return -1;
+}
+
+
+bool Viewer::ThumbnailCache::InitIndex(uint32 numSlots, uint64 packEnd)
+{
+	int64 indexBytes = sizeof(IndexHeader) + int64(numSlots)*sizeof(Slot);
+	if (!Index.Resize(indexBytes))
+		return false;
+
+	tStd::tMemset(Index.GetData(), 0, int(indexBytes));
+	IndexHeader* header = GetHeader();
+	header->Magic = IndexMagic;
+	header->Version = IndexVersion;
+	header->NumSlots = numSlots;
+	header->PackEnd = packEnd;
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::ResizeIndex(uint32 numSlots)
+{
+	IndexHeader* header = GetHeader();
+	uint64 packEnd = header->PackEnd;
+	std::vector<Slot> used;
+	used.reserve(header->NumUsed);
+	Slot* slots = GetSlots();
+	for (uint32 s = 0; s < header->NumSlots; s++)
+		if (slots[s].State == SlotState_Used)
+			used.push_back(slots[s]);
+
+	if (!InitIndex(numSlots, packEnd))
+		return false;
+
+	for (const Slot& slot : used)
+		InsertSlot(slot.Key, slot.Offset, slot.Size, slot.LastAccess);
+
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::InsertSlot(const uint8* key, uint64 offset, uint32 size, uint32 lastAccess)
+{
+	// Keep the load factor at or below a half so probe chains stay short. If most of the occupancy is tombstones a
+	// rehash at the same size is enough to clear them.
+	IndexHeader* header = GetHeader();
+	if ((header->NumUsed + header->NumRemoved + 1)*2 > header->NumSlots)
+	{
+		uint32 numSlots = ((header->NumUsed + 1)*4 > header->NumSlots) ? header->NumSlots*2 : header->NumSlots;
+		if (!ResizeIndex(numSlots))
+			return false;
+		header = GetHeader();
+	}
+
+	Slot* slots = GetSlots();
+	int existing = FindSlot(key);
+	if (existing >= 0)
+	{
+		Slot& slot = slots[existing];
+		header->LiveBytes -= GetRecordSpan(slot.Size);
+		RecordHeader* old = (RecordHeader*)GetRecord(existing);
+		if (old)
+			old->Magic = DeadMagic;
+		slot.Offset = offset;
+		slot.Size = size;
+		slot.LastAccess = lastAccess;
+		header->LiveBytes += GetRecordSpan(size);
+		return true;
+	}
+
+	uint32 mask = header->NumSlots - 1;
+	uint32 start;
+	tStd::tMemcpy(&start, key, sizeof(start));
+	for (uint32 probe = 0; probe < header->NumSlots; probe++)
+	{
+		Slot& slot = slots[(start + probe) & mask];
+		if (slot.State == SlotState_Used)
+			continue;
+
+		if (slot.State == SlotState_Removed)
+			header->NumRemoved--;
+		tStd::tMemcpy(slot.Key, key, 32);
+		slot.Offset = offset;
+		slot.Size = size;
+		slot.State = SlotState_Used;
+		slot.LastAccess = lastAccess;
+		header->NumUsed++;
+		header->LiveBytes += GetRecordSpan(size);
+		return true;
+	}
+
+	return false;
+}
+
+
+void Viewer::ThumbnailCache::RemoveSlot(int index)
+{
+	// Marking the record dead stops a rebuilt index from bringing it back. A stale slot's record isn't ours to kill.
+	RecordHeader* record = (RecordHeader*)GetRecord(index);
+	if (record)
+		record->Magic = DeadMagic;
+	DropSlot(index);
+}
+
+
+void Viewer::ThumbnailCache::DropSlot(int index)
+{
+	IndexHeader* header = GetHeader();
+	Slot& slot = GetSlots()[index];
+	slot.State = SlotState_Removed;
+	header->NumUsed--;
+	header->NumRemoved++;
+	header->LiveBytes -= GetRecordSpan(slot.Size);
+}
+
+
+bool Viewer::ThumbnailCache::RebuildIndex()
+{
+	if (!InitIndex(MinIndexSlots, sizeof(PackHeader)))
+		return false;
+
+	// Access history is lost when rebuilding. Everything is treated as if it was used now.
+	uint32 now = GetAccessTime();
+	uint64 offset = sizeof(PackHeader);
+	uint64 packSize = uint64(Pack.GetSize());
+	while (offset + sizeof(RecordHeader) <= packSize)
+	{
+		RecordHeader* record = (RecordHeader*)(Pack.GetData() + offset);
+		if ((record->Magic != RecordMagic) && (record->Magic != DeadMagic))
+			break;
+
+		uint64 span = GetRecordSpan(record->Size);
+		if (offset + span > packSize)
+			break;
+
+		if ((record->Magic == RecordMagic) && !InsertSlot(record->Key, offset, record->Size, now))
+			return false;
+
+		offset += span;
+	}
+
+	GetHeader()->PackEnd = offset;
+	return true;
+}
+
+
+const Viewer::ThumbnailCache::RecordHeader* Viewer::ThumbnailCache::GetRecord(int index) const
+{
+	if (index < 0)
+		return nullptr;
+
+	const Slot& slot = GetSlots()[index];
+	if (slot.Offset + GetRecordSpan(slot.Size) > uint64(Pack.GetSize()))
+		return nullptr;
+
+	const RecordHeader* header = (const RecordHeader*)(Pack.GetData() + slot.Offset);
+	if ((header->Magic != RecordMagic) || (header->Size != slot.Size) || (tStd::tMemcmp(header->Key, slot.Key, 32) != 0))
+		return nullptr;
+
+	return header;
+}
+
+
+bool Viewer::ThumbnailCache::Get(const tuint256& key, std::vector<uint8>& record)
+{
+	bool stale = false;
+	{
+		std::shared_lock<std::shared_mutex> lock(Mutex);
+		if (!IsOpen())
+			return false;
+
+		int index = FindSlot((const uint8*)&key);
+		const RecordHeader* header = GetRecord(index);
+		if (!header)
+		{
+			NumMisses++;
+			if (index < 0)
+				return false;
+			stale = true;
+		}
+		else
+		{
+			const uint8* data = (const uint8*)(header + 1);
+			record.assign(data, data + header->Size);
+		}
+	}
+
+	// The slot is dropped so the thumbnail is made again and put back properly. The record it pointed at may belong
+	// to another key so it is left alone. The check is repeated since the lock was let go.
+	if (stale)
+	{
+		std::unique_lock<std::shared_mutex> lock(Mutex);
+		if (!IsOpen())
+			return false;
+
+		int index = FindSlot((const uint8*)&key);
+		if ((index >= 0) && !GetRecord(index))
+			DropSlot(index);
+		return false;
+	}
+
+	NumHits++;
+	std::lock_guard<std::mutex> accessLock(AccessMutex);
+	Accesses.push_back({ key, GetAccessTime() });
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::Contains(const tuint256& key) const
+{
+	std::shared_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen())
+		return false;
+
+	return GetRecord(FindSlot((const uint8*)&key)) != nullptr;
+}
+
+
+bool Viewer::ThumbnailCache::Put(const tuint256& key, const uint8* record, int numBytes)
+{
+	if (!record || (numBytes <= 0))
+		return false;
+
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen())
+		return false;
+
+	uint64 offset = GetHeader()->PackEnd;
+	uint64 span = GetRecordSpan(uint32(numBytes));
+	if (offset + span > uint64(Pack.GetSize()))
+	{
+		// Grow geometrically so appends stay cheap. Remapping is why Get must copy the record out.
+		int64 newSize = tMax(Pack.GetSize()*2, int64(offset + span));
+		if (!Pack.Resize(newSize))
+			return false;
+	}
+
+	RecordHeader* header = (RecordHeader*)(Pack.GetData() + offset);
+	header->Magic = RecordMagic;
+	header->Size = uint32(numBytes);
+	tStd::tMemcpy(header->Key, &key, 32);
+	tStd::tMemcpy(header + 1, record, numBytes);
+
+	// The index is updated last. If we die before this the record is simply beyond PackEnd and gets overwritten.
+	if (!InsertSlot(header->Key, offset, uint32(numBytes), GetAccessTime()))
+		return false;
+
+	GetHeader()->PackEnd = offset + span;
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::Remove(const tuint256& key)
+{
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen())
+		return false;
+
+	int index = FindSlot((const uint8*)&key);
+	if (index < 0)
+		return false;
+
+	RemoveSlot(index);
+	return true;
+}
+
+
+void Viewer::ThumbnailCache::ApplyAccesses()
+{
+	std::vector<Access> accesses;
+	{
+		std::lock_guard<std::mutex> accessLock(AccessMutex);
+		accesses.swap(Accesses);
+	}
+
+	Slot* slots = GetSlots();
+	for (const Access& access : accesses)
+	{
+		int index = FindSlot((const uint8*)&access.Key);
+		if (index >= 0)
+			slots[index].LastAccess = tMax(slots[index].LastAccess, access.Time);
+	}
+}
+
+
+int Viewer::ThumbnailCache::Evict(int64 budgetBytes, int maxRecords)
+{
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen())
+		return 0;
+
+	ApplyAccesses();
+	IndexHeader* header = GetHeader();
+	if (int64(header->LiveBytes) <= budgetBytes)
+		return 0;
+
+	// Aim a little under budget so we aren't evicting a record for every one that is added.
+	int64 target = budgetBytes - budgetBytes/20;
+	int64 excess = int64(header->LiveBytes) - target;
+
+	std::vector<std::pair<uint32, int>> used;
+	used.reserve(header->NumUsed);
+	Slot* slots = GetSlots();
+	for (uint32 s = 0; s < header->NumSlots; s++)
+		if (slots[s].State == SlotState_Used)
+			used.push_back(std::make_pair(slots[s].LastAccess, int(s)));
+
+	int numCandidates = tMin(maxRecords, int(used.size()));
+	std::partial_sort(used.begin(), used.begin() + numCandidates, used.end());
+
+	int numEvicted = 0;
+	for (int c = 0; (c < numCandidates) && (excess > 0); c++)
+	{
+		Slot& slot = slots[used[c].second];
+		excess -= int64(GetRecordSpan(slot.Size));
+		RemoveSlot(used[c].second);
+		numEvicted++;
+	}
+
+	NumEvictions += numEvicted;
+	return numEvicted;
+}
+
+
+void Viewer::ThumbnailCache::Update(int64 budgetBytes)
+{
+	if (EvictJob)
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	if (!EvictAgain && (now - LastEvictTime < std::chrono::seconds(EvictIntervalSeconds)))
+		return;
+
+	LastEvictTime = now;
+	EvictAgain = false;
+	int64 liveBytes = GetLiveBytes();
+	{
+		std::lock_guard<std::mutex> accessLock(AccessMutex);
+		if ((liveBytes <= budgetBytes) && Accesses.empty())
+			return;
+	}
+
+	// The number evicted is written by the worker and only read in the completion, which runs on this thread.
+	std::shared_ptr<int> numEvicted = std::make_shared<int>(0);
+	EvictJob = Workers.Submit
+	(
+		WorkerPool::Priority::Prewarm,
+		[this, budgetBytes, numEvicted] { *numEvicted = Evict(budgetBytes, MaxEvictionsPerPass); },
+		[this, numEvicted]
+		{
+			EvictJob.reset();
+			EvictAgain = (*numEvicted == MaxEvictionsPerPass);
+			if (*numEvicted > 0)
+				RequestCompact();
+		}
+	);
+}
+
+
+void Viewer::ThumbnailCache::Clear()
+{
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen())
+		return;
+
+	if (!Pack.Resize(MinPackBytes) || !InitIndex(MinIndexSlots, sizeof(PackHeader)))
+	{
+		Index.Close();
+		Pack.Close();
+		return;
+	}
+
+	// Zero the old records so a rebuilt index doesn't find them.
+	tStd::tMemset(Pack.GetData() + sizeof(PackHeader), 0, int(MinPackBytes - sizeof(PackHeader)));
+}
+
+
+bool Viewer::ThumbnailCache::Compact()
+{
+	// Phase one copies the live records into a new pack while holding only a shared lock. Readers carry on. Writers
+	// wait, but there are only a few of them and they are on worker threads.
+	tString tempFile = PackFile + ".tmp";
+	MappedFile temp;
+	std::unordered_map<uint64, uint64> moved;
+	uint64 snapshotEnd = 0;
+	uint64 tempEnd = sizeof(PackHeader);
+	{
+		std::shared_lock<std::shared_mutex> lock(Mutex);
+		if (!IsOpen())
+			return false;
+
+		IndexHeader* header = GetHeader();
+		snapshotEnd = header->PackEnd;
+		if (!temp.OpenWrite(tempFile, tMax(int64(sizeof(PackHeader) + header->LiveBytes), MinPackBytes)))
+			return false;
+
+		std::vector<uint64> offsets;
+		offsets.reserve(header->NumUsed);
+		Slot* slots = GetSlots();
+		for (uint32 s = 0; s < header->NumSlots; s++)
+			if ((slots[s].State == SlotState_Used) && GetRecord(int(s)))
+				offsets.push_back(slots[s].Offset);
+		std::sort(offsets.begin(), offsets.end());
+
+		tStd::tMemcpy(temp.GetData(), Pack.GetData(), sizeof(PackHeader));
+		for (uint64 offset : offsets)
+		{
+			const RecordHeader* record = (const RecordHeader*)(Pack.GetData() + offset);
+			uint64 span = GetRecordSpan(record->Size);
+			tStd::tMemcpy(temp.GetData() + tempEnd, record, int(span));
+			moved[offset] = tempEnd;
+			tempEnd += span;
+		}
+	}
+
+	// Phase two takes the exclusive lock, picks up anything appended in the meantime, and swaps the files.
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	if (!IsOpen())
+	{
+		temp.Close();
+		tSystem::tDeleteFile(tempFile);
+		return false;
+	}
+
+	// Slots that don't point at their own record were skipped above. They are dropped rather than carried over.
+	IndexHeader* header = GetHeader();
+	Slot* slots = GetSlots();
+	for (uint32 s = 0; s < header->NumSlots; s++)
+		if ((slots[s].State == SlotState_Used) && !GetRecord(int(s)))
+			DropSlot(int(s));
+
+	for (uint32 s = 0; s < header->NumSlots; s++)
+	{
+		Slot& slot = slots[s];
+		if ((slot.State != SlotState_Used) || (slot.Offset < snapshotEnd))
+			continue;
+
+		uint64 span = GetRecordSpan(slot.Size);
+		if ((tempEnd + span > uint64(temp.GetSize())) && !temp.Resize(tMax(temp.GetSize()*2, int64(tempEnd + span))))
+		{
+			temp.Close();
+			tSystem::tDeleteFile(tempFile);
+			return false;
+		}
+		tStd::tMemcpy(temp.GetData() + tempEnd, Pack.GetData() + slot.Offset, int(span));
+		moved[slot.Offset] = tempEnd;
+		tempEnd += span;
+	}
+
+	// Records removed while we were copying were carried across. Mark them dead in the new pack.
+	std::unordered_map<uint64, bool> referenced;
+	for (uint32 s = 0; s < header->NumSlots; s++)
+		if (slots[s].State == SlotState_Used)
+			referenced[slots[s].Offset] = true;
+	for (auto& entry : moved)
+		if (referenced.find(entry.first) == referenced.end())
+			((RecordHeader*)(temp.GetData() + entry.second))->Magic = DeadMagic;
+
+	temp.Resize(int64(tempEnd));
+	temp.Close();
+	Pack.Close();
+
+	// Rename replaces the destination atomically on Linux. On Windows the destination must be removed first.
+	bool renamed = (std::rename(tempFile.Chars(), PackFile.Chars()) == 0);
+	if (!renamed)
+	{
+		tSystem::tDeleteFile(PackFile);
+		renamed = (std::rename(tempFile.Chars(), PackFile.Chars()) == 0);
+	}
+
+	if (!Pack.OpenWrite(PackFile, MinPackBytes))
+	{
+		Index.Close();
+		return false;
+	}
+
+	if (!renamed)
+	{
+		// If both renames failed we may have lost the pack entirely, in which case we start over. Otherwise the
+		// original pack is still there and rebuilding the index from it is always safe.
+		PackHeader* packHeader = (PackHeader*)Pack.GetData();
+		if ((packHeader->Magic != PackMagic) || (packHeader->Version != PackVersion))
+		{
+			packHeader->Magic = PackMagic;
+			packHeader->Version = PackVersion;
+			InitIndex(MinIndexSlots, sizeof(PackHeader));
+			return false;
+		}
+		RebuildIndex();
+		return false;
+	}
+
+	uint64 liveBytes = 0;
+	for (uint32 s = 0; s < header->NumSlots; s++)
+	{
+		Slot& slot = slots[s];
+		if (slot.State != SlotState_Used)
+			continue;
+		slot.Offset = moved[slot.Offset];
+		liveBytes += GetRecordSpan(slot.Size);
+	}
+	header->PackEnd = tempEnd;
+	header->LiveBytes = liveBytes;
+	return true;
+}
+
+
+void Viewer::ThumbnailCache::RequestCompact()
+{
+	if (CompactJob || !IsOpen())
+		return;
+
+	int64 used = GetPackBytes() - int64(sizeof(PackHeader));
+	int64 dead = used - GetLiveBytes();
+	if ((dead < CompactMinDeadBytes) || (dead*4 < used))
+		return;
+
+	CompactJob = Workers.Submit
+	(
+		WorkerPool::Priority::Prewarm,
+		[this] { Compact(); },
+		[this] { CompactJob.reset(); }
+	);
+}
+
+
+int Viewer::ThumbnailCache::GetNumRecords() const
+{
+	std::shared_lock<std::shared_mutex> lock(Mutex);
+	return IsOpen() ? int(GetHeader()->NumUsed) : 0;
+}
+
+
+int64 Viewer::ThumbnailCache::GetPackBytes() const
+{
+	std::shared_lock<std::shared_mutex> lock(Mutex);
+	return IsOpen() ? int64(GetHeader()->PackEnd) : 0;
+}
+
+
+int64 Viewer::ThumbnailCache::GetLiveBytes() const
+{
+	std::shared_lock<std::shared_mutex> lock(Mutex);
+	return IsOpen() ? int64(GetHeader()->LiveBytes) : 0;
+}
@@ -0,0 +1,185 @@
+// ThumbnailCache.h
+//
+// A single-file thumbnail cache. Records are appended to a memory-mapped pack file and located through a hashed
+// index file that is also memory-mapped. A lookup is one probe into the index and a copy out of the pack, with no
+// per-thumbnail filesystem work. Readers may run concurrently from the worker pool. The cache is kept within a byte
+// budget by evicting the least recently used records a few at a time on the worker pool. Space left behind by removed
+// records is reclaimed by a compaction pass that also runs in the background.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <shared_mutex>
+#include <Foundation/tStandard.h>
+#include <Foundation/tString.h>
+#include <Foundation/tHash.h>
+#include "MappedFile.h"
+#include "WorkerPool.h"
+namespace Viewer
+{
+
+
+class ThumbnailCache
+{
+public:
+	ThumbnailCache()																									{ }
+	~ThumbnailCache()																									{ Close(); }
+
+	// Opens or creates the pack and index files inside cacheDir. If the index is missing or doesn't agree with the
+	// pack it is rebuilt by scanning the pack. Returns false if the cache can't be used, in which case Get and Put
+	// simply fail. Open and Close are main thread only.
+	bool Open(const tString& cacheDir);
+	void Close();
+
+	// For when another process holds the shared cache. Opens a private cache in cacheDir that starts empty and whose
+	// files are deleted on Close, so thumbnails are still only made once per session.
+	bool OpenSession(const tString& cacheDir);
+	bool IsSession() const																								{ return Session; }
+	bool IsOpen() const																									{ return Pack.IsValid() && Index.IsValid(); }
+
+	// Get, Put and Remove may be called from any thread. Get copies the record out so the caller never holds on to
+	// memory inside the mapping. Putting a key that already exists replaces the record. Get and Put count as an
+	// access for LRU purposes.
+	bool Get(const tuint256& key, std::vector<uint8>& record);
+	bool Put(const tuint256& key, const uint8* record, int numBytes);
+	bool Remove(const tuint256& key);
+
+	// Checks for a record without copying it. Does not count as an access.
+	bool Contains(const tuint256& key) const;
+
+	// Removes least recently used records until the live bytes are a little under budgetBytes, but never more than
+	// maxRecords in one call so the exclusive lock is only held briefly. Returns the number removed.
+	int Evict(int64 budgetBytes, int maxRecords);
+	void Clear();
+
+	// Call once per frame from the main thread. Every so often this queues an eviction pass on the worker pool if
+	// the cache is over budget. If a pass couldn't get under budget the next one is queued right away.
+	void Update(int64 budgetBytes);
+
+	// Rewrites the pack without the dead space left by removed or replaced records. Compact blocks. RequestCompact
+	// queues a compaction on the worker pool if there is enough dead space to make it worthwhile. Main thread only.
+	bool Compact();
+	void RequestCompact();
+
+	int GetNumRecords() const;
+	int64 GetPackBytes() const;							// Bytes of the pack in use, including dead space.
+	int64 GetLiveBytes() const;							// Bytes of the pack used by records the index refers to.
+
+	// Counters for this session.
+	uint64 GetNumHits() const																							{ return NumHits; }
+	uint64 GetNumMisses() const																							{ return NumMisses; }
+	uint64 GetNumEvictions() const																						{ return NumEvictions; }
+
+private:
+	enum SlotState : uint32
+	{
+		SlotState_Empty,
+		SlotState_Used,
+		SlotState_Removed								// Tombstone. Keeps probe chains intact.
+	};
+
+	struct PackHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint64 Reserved;
+	};
+
+	// Every record in the pack starts with one of these. It contains the key so the index can be rebuilt from the
+	// pack alone. The record data follows and the next record starts at the following 8-byte boundary.
+	struct RecordHeader
+	{
+		uint32 Magic;									// RecordMagic if live, DeadMagic once removed.
+		uint32 Size;									// Record data bytes. Excludes this header.
+		uint8 Key[32];
+	};
+
+	struct IndexHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumSlots;								// Always a power of 2.
+		uint32 NumUsed;
+		uint32 NumRemoved;
+		uint32 Pad;
+		uint64 PackEnd;									// Offset one past the last record in the pack.
+		uint64 LiveBytes;
+	};
+
+	struct Slot
+	{
+		uint8 Key[32];
+		uint64 Offset;
+		uint32 Size;
+		uint32 State;
+		uint32 LastAccess;								// Seconds since the epoch. Persists between sessions.
+		uint32 Pad;
+	};
+
+	// Readers only hold a shared lock so they can't write to the index. They record their accesses here and the
+	// times are written to the index the next time someone holds the exclusive lock for eviction.
+	struct Access
+	{
+		tuint256 Key;
+		uint32 Time;
+	};
+
+	IndexHeader* GetHeader() const																						{ return (IndexHeader*)Index.GetData(); }
+	Slot* GetSlots() const																								{ return (Slot*)(Index.GetData() + sizeof(IndexHeader)); }
+	static uint64 GetRecordSpan(uint32 size)																			{ return (sizeof(RecordHeader) + uint64(size) + 7) & ~uint64(7); }
+
+	// Maps the files named by PackFile and IndexFile. Assumes the exclusive lock is held.
+	bool OpenFiles();
+
+	// These all assume the caller holds the appropriate lock.
+	int FindSlot(const uint8* key) const;
+
+	// Returns the record the slot points at, or null if it isn't a live record for the slot's key. A stale index left
+	// by a crash, or flushed out of order with the pack, can point at the record of another key.
+	const RecordHeader* GetRecord(int slot) const;
+	bool InitIndex(uint32 numSlots, uint64 packEnd);
+	bool ResizeIndex(uint32 numSlots);
+	bool InsertSlot(const uint8* key, uint64 offset, uint32 size, uint32 lastAccess);
+	void RemoveSlot(int slot);
+	void DropSlot(int slot);							// Leaves the record alone.
+	bool RebuildIndex();
+	void ApplyAccesses();
+
+	tString PackFile;
+	tString IndexFile;
+	MappedFile Pack;
+	MappedFile Index;
+	bool Session										= false;
+	mutable std::shared_mutex Mutex;
+	WorkerPool::JobRef CompactJob;
+
+	std::mutex AccessMutex;
+	std::vector<Access> Accesses;
+
+	WorkerPool::JobRef EvictJob;
+	std::chrono::steady_clock::time_point LastEvictTime;
+	bool EvictAgain										= false;
+
+	std::atomic<uint64> NumHits							= 0;
+	std::atomic<uint64> NumMisses						= 0;
+	std::atomic<uint64> NumEvictions					= 0;
+};
+
+
+// The cache used for all thumbnails.
+extern ThumbnailCache ThumbCache;
+
+
+}
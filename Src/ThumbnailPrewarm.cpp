@@ -0,0 +1,163 @@
+// ThumbnailPrewarm.cpp
+//
+// Fills the thumbnail cache for a whole directory tree in the background so the first visit to a folder doesn't pay
+// for thumbnail generation. Work is done on the lowest priority lane of the worker pool, is limited to a few jobs at
+// a time and to a read budget in bytes per second, and is paused while the foreground is loading an image.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <algorithm>
+#include <System/tFile.h>
+#include "ThumbnailPrewarm.h"
+#include "Image.h"
+using namespace tMath;
+
+
+namespace Viewer
+{
+	ThumbnailPrewarmer Prewarmer;
+}
+
+
+void Viewer::ThumbnailPrewarmer::Start(const tString& rootDir, int maxInFlight)
+{
+	Stop();
+	MaxInFlight = (maxInFlight > 0) ? maxInFlight : tMax(Workers.GetNumWorkers()/2, 1);
+	Allowance = 0.0;
+	LastUpdate = std::chrono::steady_clock::now();
+
+	// Walking a big tree can take a while so it is a job too. The file list is handed over in the completion.
+	std::shared_ptr<std::vector<File>> files = std::make_shared<std::vector<File>>();
+	std::shared_ptr<std::atomic<bool>> cancelled = std::make_shared<std::atomic<bool>>(false);
+	WalkCancelled = cancelled;
+	WalkJob = Workers.Submit
+	(
+		WorkerPool::Priority::Prewarm,
+		[rootDir, files, cancelled] { FindFiles(rootDir, *files, *cancelled); },
+		[this, files]
+		{
+			WalkJob.reset();
+			Pending.insert(Pending.end(), files->begin(), files->end());
+		}
+	);
+}
+
+
+void Viewer::ThumbnailPrewarmer::Stop()
+{
+	if (WalkJob)
+	{
+		*WalkCancelled = true;
+		Workers.Cancel(WalkJob);
+		WalkJob->OnComplete = nullptr;
+		WalkJob.reset();
+	}
+
+	// Running jobs only touch the cache and the file name they captured, so we can let them finish on their own.
+	for (Work& work : InFlight)
+	{
+		Workers.Cancel(work.Job);
+		work.Job->OnComplete = nullptr;
+	}
+	InFlight.clear();
+	Pending.clear();
+}
+
+
+void Viewer::ThumbnailPrewarmer::Update(int64 bytesPerSecond)
+{
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - LastUpdate).count();
+	LastUpdate = now;
+
+	// Allow at most a second's worth of reading to build up while idle.
+	if (bytesPerSecond > 0)
+		Allowance = tMin(Allowance + elapsed*double(bytesPerSecond), double(bytesPerSecond));
+
+	while (!Pending.empty() && (int(InFlight.size()) < MaxInFlight) && !IsPaused())
+	{
+		if ((bytesPerSecond > 0) && (Allowance <= 0.0))
+			break;
+
+		File file = Pending.front();
+		Pending.pop_front();
+		if (bytesPerSecond > 0)
+			Allowance -= double(file.Size);
+		Submit(file);
+	}
+}
+
+
+void Viewer::ThumbnailPrewarmer::Submit(const File& file)
+{
+	std::shared_ptr<Result> outcome = std::make_shared<Result>();
+	WorkerPool::JobRef job = Workers.Submit
+	(
+		WorkerPool::Priority::Prewarm,
+		[this, file, outcome]
+		{
+			// If a foreground load started while we were queued the file goes back on the list.
+			if (IsPaused())
+			{
+				outcome->Deferred = true;
+				return;
+			}
+
+			Image image(file.Name);
+			outcome->Generated = image.PrewarmThumbnail();
+		},
+		[this, file, outcome]
+		{
+			InFlight.erase
+			(
+				std::remove_if(InFlight.begin(), InFlight.end(), [&outcome](const Work& w) { return w.Outcome == outcome; }),
+				InFlight.end()
+			);
+
+			if (outcome->Deferred)
+				Pending.push_front(file);
+			else if (outcome->Generated)
+				NumGenerated++;
+
+			// Files that were already cached were barely read so they don't count against the budget.
+			if (outcome->Deferred || !outcome->Generated)
+				Allowance += double(file.Size);
+		}
+	);
+
+	InFlight.push_back({ job, outcome });
+}
+
+
+void Viewer::ThumbnailPrewarmer::FindFiles(const tString& rootDir, std::vector<File>& files, const std::atomic<bool>& cancelled)
+{
+	tSystem::tExtensions extensions;
+	Image::GetCanLoad(extensions);
+
+	// Breadth first so the folders nearest the root, which are the most likely to be visited next, are done first.
+	std::deque<tString> dirs;
+	dirs.push_back(rootDir);
+	while (!dirs.empty() && !cancelled)
+	{
+		tString dir = dirs.front();
+		dirs.pop_front();
+
+		tList<tSystem::tFileInfo> found;
+		tSystem::tFindFilesFast(found, dir, extensions);
+		for (tSystem::tFileInfo* info = found.First(); info; info = info->Next())
+			files.push_back({ info->FileName, int64(info->FileSize) });
+
+		tList<tStringItem> subDirs;
+		tSystem::tFindDirs(subDirs, dir, false);
+		for (tStringItem* subDir = subDirs.First(); subDir; subDir = subDir->Next())
+			dirs.push_back(*subDir);
+	}
+}
@@ -0,0 +1,97 @@
+// ThumbnailPrewarm.h
+//
+// Fills the thumbnail cache for a whole directory tree in the background so the first visit to a folder doesn't pay
+// for thumbnail generation. Work is done on the lowest priority lane of the worker pool, is limited to a few jobs at
+// a time and to a read budget in bytes per second, and is paused while the foreground is loading an image.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Foundation/tString.h>
+#include "WorkerPool.h"
+namespace Viewer
+{
+
+
+// Everything except Pause and Resume is main thread only.
+class ThumbnailPrewarmer
+{
+public:
+	ThumbnailPrewarmer()																								{ }
+
+	// Starts walking rootDir and every directory below it. A walk already in progress is stopped first. At most
+	// maxInFlight files are processed at once. If maxInFlight is <= 0 half the workers are used.
+	void Start(const tString& rootDir, int maxInFlight = 0);
+
+	// Drops all remaining work. Jobs already running finish but their results are ignored. Does not block.
+	void Stop();
+	bool IsActive() const																								{ return WalkJob || !Pending.empty() || !InFlight.empty(); }
+
+	// Call once per frame. Queues more files while within budget. A bytesPerSecond of 0 means unlimited.
+	void Update(int64 bytesPerSecond);
+
+	// Foreground loads bracket themselves with these. While paused no new files are started and queued jobs hand
+	// their file back. Calls nest.
+	void Pause()																										{ PauseCount++; }
+	void Resume()																										{ PauseCount--; }
+	bool IsPaused() const																								{ return PauseCount > 0; }
+
+	int GetNumGenerated() const																							{ return NumGenerated; }
+	int GetNumRemaining() const																							{ return int(Pending.size() + InFlight.size()); }
+
+private:
+	struct File
+	{
+		tString Name;
+		int64 Size;
+	};
+
+	struct Result
+	{
+		bool Deferred			= false;
+		bool Generated			= false;
+	};
+
+	struct Work
+	{
+		WorkerPool::JobRef Job;
+		std::shared_ptr<Result> Outcome;
+	};
+
+	static void FindFiles(const tString& rootDir, std::vector<File>& files, const std::atomic<bool>& cancelled);
+	void Submit(const File&);
+
+	WorkerPool::JobRef WalkJob;
+	std::shared_ptr<std::atomic<bool>> WalkCancelled;
+	std::deque<File> Pending;
+	std::vector<Work> InFlight;
+	int MaxInFlight				= 1;
+
+	// Token bucket for the read budget. Files are charged when queued and refunded if they were already cached.
+	double Allowance			= 0.0;
+	std::chrono::steady_clock::time_point LastUpdate;
+
+	std::atomic<int> PauseCount	= 0;
+	int NumGenerated			= 0;
+};
+
+
+// Prewarms the folder being viewed and everything below it.
+extern ThumbnailPrewarmer Prewarmer;
+
+
+}
@@ -0,0 +1,370 @@
+// TiledTexture.cpp
+//
+// Displays pictures bigger than the largest texture OpenGL allows. A pyramid of half-size levels is built on a worker
+// and only the tiles of the level matching the zoom that are on screen are uploaded, a few per frame. The coarsest
+// level fits in one texture and is drawn underneath so there is always something to see while tiles stream in.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+#include <glad/glad.h>
+#include <Foundation/tFundamentals.h>
+#include "TiledTexture.h"
+#include "ThumbnailCache.h"
+#include "AreaResample.h"
+#include "TextureResidency.h"
+using namespace tMath;
+
+
+int Viewer::TiledTexture::MaxTextureSize = 4096;
+
+
+void Viewer::TiledTexture::QueryMaxTextureSize()
+{
+	GLint size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+	if (size > 0)
+		MaxTextureSize = size;
+}
+
+
+void Viewer::TiledTexture::Set(Image* owner, const tImage::tPicture* picture, const tuint256& cacheKey)
+{
+	Clear();
+	if (!picture || !picture->IsValid())
+		return;
+
+	// Each level is half the one before, rounded up, until one fits in a single texture. That one is the overview.
+	Owner = owner;
+	Picture = picture;
+	int overviewSize = tMin(OverviewSize, MaxTextureSize);
+	int width = picture->GetWidth();
+	int height = picture->GetHeight();
+	NumLevels = 0;
+	while (NumLevels < MaxLevels)
+	{
+		Levels[NumLevels].Width = width;
+		Levels[NumLevels].Height = height;
+		NumLevels++;
+		if ((width <= overviewSize) && (height <= overviewSize))
+			break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+
+	// Level 0 is the picture itself so its tiles can be uploaded straight away.
+	Levels[0].Data = picture->GetPixelPointer();
+	Levels[0].Ready = true;
+	if (NumLevels == 1)
+		return;
+
+	BuildJob = Workers.Submit
+	(
+		WorkerPool::Priority::Foreground,
+		[this, cacheKey] { Build(cacheKey); },
+		[this] { BuildJob.reset(); }
+	);
+}
+
+
+void Viewer::TiledTexture::Build(const tuint256& cacheKey)
+{
+	// The overview is made first, straight from the picture, because nothing can be shown until it exists. The
+	// in-between levels are each made from the one before, which costs a quarter of the previous level every time.
+	Level& overview = Levels[NumLevels-1];
+	if (!LoadOverview(cacheKey))
+	{
+		overview.Pixels.resize(size_t(overview.Width) * size_t(overview.Height));
+		AreaResample::Reduce
+		(
+			overview.Pixels.data(), overview.Width, overview.Height,
+			Levels[0].Data, Levels[0].Width, Levels[0].Height
+		);
+		SaveOverview(cacheKey);
+	}
+	overview.Data = overview.Pixels.data();
+	overview.Ready = true;
+
+	for (int l = 1; (l < NumLevels-1) && !Cancelled; l++)
+	{
+		const Level& prev = Levels[l-1];
+		Level& level = Levels[l];
+		level.Pixels.resize(size_t(level.Width) * size_t(level.Height));
+		AreaResample::Reduce(level.Pixels.data(), level.Width, level.Height, prev.Data, prev.Width, prev.Height);
+		level.Data = level.Pixels.data();
+		level.Ready = true;
+	}
+}
+
+
+bool Viewer::TiledTexture::LoadOverview(const tuint256& cacheKey)
+{
+	if (cacheKey == tuint256(0))
+		return false;
+
+	std::vector<uint8> record;
+	if (!ThumbCache.Get(cacheKey, record) || (record.size() < sizeof(OverviewHeader)))
+		return false;
+
+	Level& overview = Levels[NumLevels-1];
+	OverviewHeader header;
+	tStd::tMemcpy(&header, record.data(), sizeof(OverviewHeader));
+	size_t numBytes = size_t(overview.Width) * size_t(overview.Height) * sizeof(tPixel);
+	if
+	(
+		(header.Magic != OverviewMagic) || (header.Width != overview.Width) || (header.Height != overview.Height) ||
+		(record.size() != sizeof(OverviewHeader) + numBytes)
+	)
+		return false;
+
+	overview.Pixels.resize(size_t(overview.Width) * size_t(overview.Height));
+	tStd::tMemcpy(overview.Pixels.data(), record.data() + sizeof(OverviewHeader), int(numBytes));
+	return true;
+}
+
+
+void Viewer::TiledTexture::SaveOverview(const tuint256& cacheKey)
+{
+	if (cacheKey == tuint256(0))
+		return;
+
+	const Level& overview = Levels[NumLevels-1];
+	OverviewHeader header = { OverviewMagic, overview.Width, overview.Height, 0 };
+	size_t numBytes = size_t(overview.Width) * size_t(overview.Height) * sizeof(tPixel);
+	std::vector<uint8> record(sizeof(OverviewHeader) + numBytes);
+	tStd::tMemcpy(record.data(), &header, sizeof(OverviewHeader));
+	tStd::tMemcpy(record.data() + sizeof(OverviewHeader), overview.Pixels.data(), int(numBytes));
+	ThumbCache.Put(cacheKey, record.data(), int(record.size()));
+}
+
+
+void Viewer::TiledTexture::Clear()
+{
+	// The build reads the picture and writes the levels so it must be stopped before either goes away. At worst this
+	// waits for the level being made to finish.
+	if (BuildJob)
+	{
+		Cancelled = true;
+		Workers.Abandon(BuildJob);
+	}
+	Cancelled = false;
+
+	for (auto& entry : Tiles)
+	{
+		TexResidency.Release(entry.second.TexID);
+		glDeleteTextures(1, &entry.second.TexID);
+	}
+	Tiles.clear();
+
+	if (OverviewTexID != 0)
+	{
+		TexResidency.Release(OverviewTexID);
+		glDeleteTextures(1, &OverviewTexID);
+		OverviewTexID = 0;
+	}
+
+	for (int l = 0; l < NumLevels; l++)
+	{
+		Level& level = Levels[l];
+		level.Width = level.Height = 0;
+		std::vector<tPixel>().swap(level.Pixels);
+		level.Data = nullptr;
+		level.Ready = false;
+	}
+	NumLevels = 0;
+	Picture = nullptr;
+	Owner = nullptr;
+}
+
+
+uint Viewer::TiledTexture::BindOverview()
+{
+	if (OverviewTexID != 0)
+	{
+		TexResidency.Touch(OverviewTexID);
+		glBindTexture(GL_TEXTURE_2D, OverviewTexID);
+		return OverviewTexID;
+	}
+
+	if (!IsOverviewReady())
+		return 0;
+
+	// Zoomed right out the overview is minified so it gets mipmaps. The driver makes them.
+	const Level& overview = Levels[NumLevels-1];
+	glGenTextures(1, &OverviewTexID);
+	glBindTexture(GL_TEXTURE_2D, OverviewTexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, overview.Width, overview.Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, overview.Data);
+
+	// The mipmaps add about a third.
+	int64 numBytes = int64(overview.Width) * int64(overview.Height) * 4;
+	TexResidency.Add(Owner, OverviewTexID, numBytes + numBytes/3);
+	return OverviewTexID;
+}
+
+
+void Viewer::TiledTexture::Upload(Tile& tile, int level, int tileX, int tileY)
+{
+	// Tiles carry a one pixel border from their neighbours so linear filtering doesn't show seams. The sub-rectangle
+	// is read straight out of the level using the unpack row length, so there is no copy.
+	const Level& lev = Levels[level];
+	int x0 = tileX*TileSize;
+	int y0 = tileY*TileSize;
+	tile.TexX = tMax(x0 - 1, 0);
+	tile.TexY = tMax(y0 - 1, 0);
+	tile.TexW = tMin(x0 + TileSize + 1, lev.Width) - tile.TexX;
+	tile.TexH = tMin(y0 + TileSize + 1, lev.Height) - tile.TexY;
+
+	glGenTextures(1, &tile.TexID);
+	glBindTexture(GL_TEXTURE_2D, tile.TexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, lev.Width);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile.TexX);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, tile.TexY);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tile.TexW, tile.TexH, 0, GL_RGBA, GL_UNSIGNED_BYTE, lev.Data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	TexResidency.Add(Owner, tile.TexID, int64(tile.TexW) * int64(tile.TexH) * 4);
+}
+
+
+void Viewer::TiledTexture::Draw(float left, float right, float bottom, float top, float u0, float v0, float u1, float v1)
+{
+	float screenW = right - left;
+	float screenH = top - bottom;
+	if ((NumLevels < 2) || (screenW <= 0.0f) || (screenH <= 0.0f) || (u1 <= u0) || (v1 <= v0))
+		return;
+
+	// The level is the finest one that is minified by less than 2. Linear filtering is fine for that. If that is the
+	// overview, or the level isn't built yet, the overview already drawn is all there is.
+	float texelsPerPixel = (u1 - u0) * float(Levels[0].Width) / screenW;
+	int level = 0;
+	while ((level+1 < NumLevels) && (texelsPerPixel >= 2.0f))
+	{
+		texelsPerPixel *= 0.5f;
+		level++;
+	}
+	const Level& lev = Levels[level];
+	if ((level == NumLevels-1) || !lev.Ready)
+		return;
+
+	// The visible part of the level in level pixels.
+	float levW = float(lev.Width);
+	float levH = float(lev.Height);
+	float xa = tClamp(u0, 0.0f, 1.0f) * levW;
+	float xb = tClamp(u1, 0.0f, 1.0f) * levW;
+	float ya = tClamp(v0, 0.0f, 1.0f) * levH;
+	float yb = tClamp(v1, 0.0f, 1.0f) * levH;
+	if ((xb <= xa) || (yb <= ya))
+		return;
+
+	int tileX0 = int(xa) / TileSize;
+	int tileX1 = tMin(int(std::ceil(xb)) - 1, lev.Width - 1) / TileSize;
+	int tileY0 = int(ya) / TileSize;
+	int tileY1 = tMin(int(std::ceil(yb)) - 1, lev.Height - 1) / TileSize;
+
+	auto drawTile = [&](const Tile& tile, int tileX, int tileY)
+	{
+		float px0 = tMax(float(tileX*TileSize), xa);
+		float px1 = tMin(float(tileX*TileSize + TileSize), xb);
+		float py0 = tMax(float(tileY*TileSize), ya);
+		float py1 = tMin(float(tileY*TileSize + TileSize), yb);
+		if ((px1 <= px0) || (py1 <= py0))
+			return;
+
+		float sx0 = left + (px0/levW - u0) / (u1 - u0) * screenW;
+		float sx1 = left + (px1/levW - u0) / (u1 - u0) * screenW;
+		float sy0 = bottom + (py0/levH - v0) / (v1 - v0) * screenH;
+		float sy1 = bottom + (py1/levH - v0) / (v1 - v0) * screenH;
+		float s0 = (px0 - float(tile.TexX)) / float(tile.TexW);
+		float s1 = (px1 - float(tile.TexX)) / float(tile.TexW);
+		float t0 = (py0 - float(tile.TexY)) / float(tile.TexH);
+		float t1 = (py1 - float(tile.TexY)) / float(tile.TexH);
+
+		TexResidency.Touch(tile.TexID);
+		glBindTexture(GL_TEXTURE_2D, tile.TexID);
+		glBegin(GL_QUADS);
+		glTexCoord2f(s0, t0); glVertex2f(sx0, sy0);
+		glTexCoord2f(s0, t1); glVertex2f(sx0, sy1);
+		glTexCoord2f(s1, t1); glVertex2f(sx1, sy1);
+		glTexCoord2f(s1, t0); glVertex2f(sx1, sy0);
+		glEnd();
+	};
+
+	// Resident tiles are drawn now. Missing ones are uploaded centre first so the middle of the screen sharpens first.
+	struct Missing
+	{
+		float DistSq;
+		int TileX, TileY;
+	};
+	std::vector<Missing> missing;
+	float centreX = (xa + xb) * 0.5f;
+	float centreY = (ya + yb) * 0.5f;
+	for (int tileY = tileY0; tileY <= tileY1; tileY++)
+	{
+		for (int tileX = tileX0; tileX <= tileX1; tileX++)
+		{
+			auto found = Tiles.find(GetTileKey(level, tileX, tileY));
+			if (found == Tiles.end())
+			{
+				float dx = (float(tileX) + 0.5f) * float(TileSize) - centreX;
+				float dy = (float(tileY) + 0.5f) * float(TileSize) - centreY;
+				missing.push_back({ dx*dx + dy*dy, tileX, tileY });
+				continue;
+			}
+
+			drawTile(found->second, tileX, tileY);
+		}
+	}
+
+	std::sort(missing.begin(), missing.end(), [](const Missing& a, const Missing& b) { return a.DistSq < b.DistSq; });
+	int numUploads = tMin(int(missing.size()), MaxUploadsPerDraw);
+	for (int m = 0; m < numUploads; m++)
+	{
+		Tile& tile = Tiles[GetTileKey(level, missing[m].TileX, missing[m].TileY)];
+		Upload(tile, level, missing[m].TileX, missing[m].TileY);
+		drawTile(tile, missing[m].TileX, missing[m].TileY);
+	}
+}
+
+
+bool Viewer::TiledTexture::EvictTexture(uint texID)
+{
+	// Already released by the residency manager. An evicted tile is uploaded again if it is drawn.
+	if (OverviewTexID == texID)
+	{
+		glDeleteTextures(1, &OverviewTexID);
+		OverviewTexID = 0;
+		return true;
+	}
+
+	for (auto entry = Tiles.begin(); entry != Tiles.end(); ++entry)
+	{
+		if (entry->second.TexID == texID)
+		{
+			glDeleteTextures(1, &entry->second.TexID);
+			Tiles.erase(entry);
+			return true;
+		}
+	}
+
+	return false;
+}
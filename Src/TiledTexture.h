@@ -0,0 +1,120 @@
+// TiledTexture.h
+//
+// Displays pictures bigger than the largest texture OpenGL allows. A pyramid of half-size levels is built on a worker
+// and only the tiles of the level matching the zoom that are on screen are uploaded, a few per frame. The coarsest
+// level fits in one texture and is drawn underneath so there is always something to see while tiles stream in. Tile
+// and overview textures count against the same video memory budget as frame textures. See TextureResidency.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Foundation/tHash.h>
+#include <Math/tColour.h>
+#include <Image/tPicture.h>
+#include "WorkerPool.h"
+namespace Viewer
+{
+	class Image;
+
+
+// Main thread only.
+class TiledTexture
+{
+public:
+	TiledTexture()																										{ }
+	~TiledTexture()																										{ Clear(); }
+
+	// Call once after the OpenGL context is created. Until then pictures over 4096 in either direction are tiled.
+	static void QueryMaxTextureSize();
+	static bool NeedsTiling(int width, int height)																		{ return (width > MaxTextureSize) || (height > MaxTextureSize); }
+
+	// Starts building the levels for the picture on a worker. The picture must not change or go away until Clear is
+	// called. If cacheKey is not zero the coarsest level is kept in the thumbnail cache under that key so the next
+	// visit can skip computing it. Textures are registered with the residency manager as belonging to owner.
+	void Set(Image* owner, const tImage::tPicture*, const tuint256& cacheKey);
+
+	// Frees the textures and drops the levels. A build in progress is stopped after the level it is working on.
+	void Clear();
+	const tImage::tPicture* GetPicture() const																			{ return Picture; }
+
+	// Binds the texture of the coarsest level, uploading it the first time. Returns 0 if it isn't built yet.
+	uint BindOverview();
+	bool IsOverviewReady() const																						{ return (NumLevels > 0) && Levels[NumLevels-1].Ready; }
+
+	// Draws whatever detail tiles are resident over the screen rectangle, which shows the part of the picture from
+	// (u0, v0) to (u1, v1). Missing tiles are uploaded, nearest the centre first, up to a few per call. Call after
+	// drawing the overview so it shows through wherever tiles are missing.
+	void Draw(float left, float right, float bottom, float top, float u0, float v0, float u1, float v1);
+
+	// Deletes the tile or overview texture if it is one of ours. For the owner's EvictTexture. Returns false if not.
+	bool EvictTexture(uint texID);
+
+	int GetNumLevels() const																							{ return NumLevels; }
+	int GetNumResidentTiles() const																						{ return int(Tiles.size()); }
+
+private:
+	struct Level
+	{
+		int Width							= 0;
+		int Height							= 0;
+		std::vector<tPixel> Pixels;								// Empty for level 0, which uses the picture.
+		const tPixel* Data					= nullptr;
+		std::atomic<bool> Ready				= false;			// Set by the worker once Data may be read.
+	};
+
+	struct Tile
+	{
+		uint TexID							= 0;
+		int TexX							= 0;				// Level pixels the texture starts at, including the border.
+		int TexY							= 0;
+		int TexW							= 0;
+		int TexH							= 0;
+	};
+
+	// The overview record in the thumbnail cache.
+	struct OverviewHeader
+	{
+		uint32 Magic;
+		int32 Width;
+		int32 Height;
+		uint32 Pad;
+	};
+
+	void Build(const tuint256& cacheKey);
+	bool LoadOverview(const tuint256& cacheKey);
+	void SaveOverview(const tuint256& cacheKey);
+	void Upload(Tile&, int level, int tileX, int tileY);
+	static uint64 GetTileKey(int level, int tileX, int tileY)															{ return (uint64(level) << 48) | (uint64(tileY) << 24) | uint64(tileX); }
+
+	static int MaxTextureSize;
+	static const int MaxLevels				= 16;
+	static const int TileSize				= 512;
+	static const int OverviewSize			= 2048;
+	static const int MaxUploadsPerDraw		= 4;
+	static const uint32 OverviewMagic		= 0x5756564F;
+
+	Image* Owner							= nullptr;
+	const tImage::tPicture* Picture			= nullptr;
+	Level Levels[MaxLevels];
+	int NumLevels							= 0;
+	uint OverviewTexID						= 0;
+	std::unordered_map<uint64, Tile> Tiles;
+
+	WorkerPool::JobRef BuildJob;
+	std::atomic<bool> Cancelled				= false;
+};
+
+
+}
@@ -0,0 +1,415 @@
+// Tonemap.cpp
+//
+// Keeps the linear pixels of hdr and exr images and maps them to displayable RGBA using the load params. Redoing the
+// mapping after a change to gamma, exposure, defog or the knee only costs a pass over the pixels, not a reload. Both
+// operators turn a 16 bit input, a half float or an rgbe mantissa and exponent, into 8 bits, so each change builds a
+// 64K entry table and the pass over the pixels is a table lookup per channel spread over all cores.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <Foundation/tFundamentals.h>
+#include "Tonemap.h"
+#include "WorkerPool.h"
+using namespace tMath;
+
+
+namespace Tonemap
+{
+	// Images with fewer pixels than this are mapped on the calling thread. Larger ones are handed out RowsPerBand rows
+	// at a time.
+	const int ParallelThreshold					= 1024*1024;
+	const int RowsPerBand						= 16;
+	const int TableSize							= 65536;
+
+	// One table per output channel. For rgbe all three colour channels share the first table, indexed by exponent
+	// then mantissa. For halfs each channel has its own since defog subtracts a different amount from each.
+	struct Tables
+	{
+		uint8 Colour[3][TableSize];
+		uint8 Alpha[TableSize];
+	};
+
+	float HalfToFloat(uint16);
+	bool ReadLine(const uint8* data, int64 numBytes, int64& pos, char* line, int maxLen);
+	bool ReadRGBERow(uint8* row, int width, const uint8* data, int64 numBytes, int64& pos);
+	void BuildRGBETables(Tables&, const tImage::tPicture::LoadParams&);
+	void BuildHalfTables(Tables&, const Source&, const tImage::tPicture::LoadParams&);
+	void ApplyRows(tPixel* dst, const Source&, const Tables&, int rowBegin, int rowEnd);
+
+	// The exrdisplay knee. Compresses everything above the knee logarithmically with f chosen so the knee range maps
+	// onto the display range. In double since f gets very small when the knee range is close to the display range.
+	inline float Knee(double x, double f)																				{ return float(std::log(x*f + 1.0) / f); }
+	float FindKneeF(float x, float y);
+}
+
+
+float Tonemap::HalfToFloat(uint16 h)
+{
+	uint32 sign = uint32(h & 0x8000) << 16;
+	uint32 exp = (h >> 10) & 0x1F;
+	uint32 mant = h & 0x03FF;
+	uint32 bits;
+	if (exp == 0)
+	{
+		if (mant == 0)
+		{
+			bits = sign;
+		}
+		else
+		{
+			// Denormal. Shift until the implicit bit appears and adjust the exponent to match.
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x0400))
+			{
+				mant <<= 1;
+				exp--;
+			}
+			bits = sign | (exp << 23) | ((mant & 0x03FF) << 13);
+		}
+	}
+	else if (exp == 0x1F)
+	{
+		bits = sign | 0x7F800000 | (mant << 13);
+	}
+	else
+	{
+		bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+	}
+
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+
+bool Tonemap::ReadLine(const uint8* data, int64 numBytes, int64& pos, char* line, int maxLen)
+{
+	int len = 0;
+	while ((pos < numBytes) && (data[pos] != '\n'))
+	{
+		if (len < maxLen-1)
+			line[len++] = char(data[pos]);
+		pos++;
+	}
+	line[len] = '\0';
+	if (pos >= numBytes)
+		return false;
+
+	pos++;
+	return true;
+}
+
+
+bool Tonemap::ReadRGBERow(uint8* row, int width, const uint8* data, int64 numBytes, int64& pos)
+{
+	if (pos + 4 > numBytes)
+		return false;
+
+	// New style rows start with 2, 2 and the width and store each channel as its own run-length encoded span.
+	const uint8* start = data + pos;
+	bool newStyle = (width >= 8) && (width <= 0x7FFF) && (start[0] == 2) && (start[1] == 2) && !(start[2] & 0x80);
+	if (newStyle)
+	{
+		if (((int(start[2]) << 8) | int(start[3])) != width)
+			return false;
+		pos += 4;
+
+		for (int c = 0; c < 4; c++)
+		{
+			int x = 0;
+			while (x < width)
+			{
+				if (pos >= numBytes)
+					return false;
+				int count = data[pos++];
+				if (count > 128)
+				{
+					count -= 128;
+					if ((x + count > width) || (pos >= numBytes))
+						return false;
+					uint8 value = data[pos++];
+					for (int i = 0; i < count; i++, x++)
+						row[x*4 + c] = value;
+				}
+				else
+				{
+					if ((count == 0) || (x + count > width) || (pos + count > numBytes))
+						return false;
+					for (int i = 0; i < count; i++, x++)
+						row[x*4 + c] = data[pos++];
+				}
+			}
+		}
+		return true;
+	}
+
+	// Flat pixels, possibly with old style runs. A pixel of 1, 1, 1 repeats the previous one. Consecutive runs shift
+	// their counts up by a byte each time.
+	int x = 0;
+	int shift = 0;
+	while (x < width)
+	{
+		if (pos + 4 > numBytes)
+			return false;
+		const uint8* pixel = data + pos;
+		pos += 4;
+		if ((pixel[0] == 1) && (pixel[1] == 1) && (pixel[2] == 1))
+		{
+			if ((x == 0) || (shift > 24))
+				return false;
+			int64 count = int64(pixel[3]) << shift;
+			if (x + count > width)
+				return false;
+			for (int64 i = 0; i < count; i++, x++)
+				std::memcpy(row + x*4, row + (x-1)*4, 4);
+			shift += 8;
+		}
+		else
+		{
+			std::memcpy(row + x*4, pixel, 4);
+			x++;
+			shift = 0;
+		}
+	}
+	return true;
+}
+
+
+bool Tonemap::DecodeRGBE(Source& source, const uint8* data, int64 numBytes)
+{
+	source.Clear();
+	if (!data || (numBytes < 2) || (data[0] != '#') || (data[1] != '?'))
+		return false;
+
+	// Header lines up to the first empty one. Only the format matters. Exposure and colour correction lines are
+	// ignored, as tImageHDR does.
+	int64 pos = 0;
+	const int maxLine = 256;
+	char line[maxLine];
+	while (true)
+	{
+		if (!ReadLine(data, numBytes, pos, line, maxLine))
+			return false;
+		if (line[0] == '\0')
+			break;
+		if ((std::strncmp(line, "FORMAT=", 7) == 0) && (std::strcmp(line + 7, "32-bit_rle_rgbe") != 0))
+			return false;
+	}
+
+	// Only the standard orientation and its vertical flip. Anything else is left to tImageHDR.
+	if (!ReadLine(data, numBytes, pos, line, maxLine))
+		return false;
+	char ySign = 0, xSign = 0;
+	int width = 0, height = 0;
+	if (std::sscanf(line, "%cY %d %cX %d", &ySign, &height, &xSign, &width) != 4)
+		return false;
+	if (((ySign != '-') && (ySign != '+')) || (xSign != '+') || (width <= 0) || (height <= 0))
+		return false;
+	if (int64(width)*int64(height) > int64(0x7FFFFFFF)/4)
+		return false;
+
+	// Rows are stored top-down for -Y. Flip them into bottom-up order as they are read.
+	std::vector<uint8> pixels(size_t(width)*size_t(height)*4);
+	for (int y = 0; y < height; y++)
+	{
+		int row = (ySign == '-') ? (height - 1 - y) : y;
+		if (!ReadRGBERow(pixels.data() + size_t(row)*size_t(width)*4, width, data, numBytes, pos))
+			return false;
+	}
+
+	source.Format = Encoding::RGBE;
+	source.Width = width;
+	source.Height = height;
+	source.Data.swap(pixels);
+	return true;
+}
+
+
+void Tonemap::ComputeFog(Source& source)
+{
+	source.FogR = source.FogG = source.FogB = 0.0f;
+	if (source.Format != Encoding::Half)
+		return;
+
+	// Same as the exrdisplay fog colour. Non-finite values are skipped but still count towards the average.
+	const uint16* halfs = (const uint16*)source.Data.data();
+	int64 numPixels = int64(source.Width)*int64(source.Height);
+	if (numPixels <= 0)
+		return;
+	double sum[3] = { 0.0, 0.0, 0.0 };
+	for (int64 p = 0; p < numPixels; p++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			float value = HalfToFloat(halfs[p*4 + c]);
+			if (std::isfinite(value))
+				sum[c] += value;
+		}
+	}
+	source.FogR = float(sum[0] / double(numPixels));
+	source.FogG = float(sum[1] / double(numPixels));
+	source.FogB = float(sum[2] / double(numPixels));
+}
+
+
+void Tonemap::BuildRGBETables(Tables& tables, const tImage::tPicture::LoadParams& params)
+{
+	// Each mantissa is the centre of its bucket, as in the Radiance gamma tables. An exponent of zero is black.
+	float invGamma = 1.0f / tMax(params.GammaValue, 0.01f);
+	for (int e = 0; e < 256; e++)
+	{
+		uint8* entries = tables.Colour[0] + (e << 8);
+		if (e == 0)
+		{
+			std::memset(entries, 0, 256);
+			continue;
+		}
+
+		float scale = std::ldexp(1.0f, e - 128 + params.HDR_Exposure) / 256.0f;
+		for (int m = 0; m < 256; m++)
+		{
+			float value = 256.0f * std::pow((float(m) + 0.5f) * scale, invGamma);
+			entries[m] = uint8(tClamp(int(value), 0, 255));
+		}
+	}
+}
+
+
+float Tonemap::FindKneeF(float x, float y)
+{
+	float f0 = 0.0f;
+	float f1 = 1.0f;
+	while (Knee(x, f1) > y)
+	{
+		f0 = f1;
+		f1 = f1 * 2.0f;
+	}
+
+	for (int i = 0; i < 30; i++)
+	{
+		float f2 = (f0 + f1) / 2.0f;
+		if (Knee(x, f2) < y)
+			f1 = f2;
+		else
+			f0 = f2;
+	}
+	return (f0 + f1) / 2.0f;
+}
+
+
+void Tonemap::BuildHalfTables(Tables& tables, const Source& source, const tImage::tPicture::LoadParams& params)
+{
+	// Exposure is offset so that 0 maps middle grey to about 0.18 on screen, as exrdisplay does.
+	float gamma = 1.0f / tMax(params.GammaValue, 0.01f);
+	float exposure = std::pow(2.0f, params.EXR_Exposure + 2.47393f);
+	float kneeLow = std::pow(2.0f, params.EXR_KneeLow);
+	float kneeF = FindKneeF(std::pow(2.0f, params.EXR_KneeHigh) - kneeLow, std::pow(2.0f, 3.5f) - kneeLow);
+	float scale = 255.0f * std::pow(2.0f, -3.5f * gamma);
+	float fog[3] = { params.EXR_Defog*source.FogR, params.EXR_Defog*source.FogG, params.EXR_Defog*source.FogB };
+
+	for (int h = 0; h < TableSize; h++)
+	{
+		float value = HalfToFloat(uint16(h));
+		bool finite = std::isfinite(value);
+		for (int c = 0; c < 3; c++)
+		{
+			if (!finite)
+			{
+				tables.Colour[c][h] = 0;
+				continue;
+			}
+
+			float x = tMax(0.0f, value - fog[c]) * exposure;
+			if (x > kneeLow)
+				x = kneeLow + Knee(x - kneeLow, kneeF);
+			x = std::pow(x, gamma) * scale;
+			tables.Colour[c][h] = uint8(tClamp(int(x), 0, 255));
+		}
+
+		tables.Alpha[h] = finite ? uint8(tClamp(int(value*255.0f + 0.5f), 0, 255)) : 0;
+	}
+}
+
+
+void Tonemap::ApplyRows(tPixel* dst, const Source& source, const Tables& tables, int rowBegin, int rowEnd)
+{
+	int width = source.Width;
+	if (source.Format == Encoding::RGBE)
+	{
+		const uint8* table = tables.Colour[0];
+		for (int y = rowBegin; y < rowEnd; y++)
+		{
+			const uint8* src = source.Data.data() + size_t(y)*size_t(width)*4;
+			tPixel* out = dst + size_t(y)*size_t(width);
+			for (int x = 0; x < width; x++, src += 4)
+			{
+				int e = int(src[3]) << 8;
+				out[x].R = table[e | src[0]];
+				out[x].G = table[e | src[1]];
+				out[x].B = table[e | src[2]];
+				out[x].A = 255;
+			}
+		}
+		return;
+	}
+
+	const uint16* halfs = (const uint16*)source.Data.data();
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const uint16* src = halfs + size_t(y)*size_t(width)*4;
+		tPixel* out = dst + size_t(y)*size_t(width);
+		for (int x = 0; x < width; x++, src += 4)
+		{
+			out[x].R = tables.Colour[0][src[0]];
+			out[x].G = tables.Colour[1][src[1]];
+			out[x].B = tables.Colour[2][src[2]];
+			out[x].A = tables.Alpha[src[3]];
+		}
+	}
+}
+
+
+void Tonemap::Apply(tPixel* dst, const Source& source, const tImage::tPicture::LoadParams& params)
+{
+	if (!dst || !source.IsValid())
+		return;
+
+	// Too big for the stack of a worker thread.
+	std::unique_ptr<Tables> tables(new Tables);
+	if (source.Format == Encoding::RGBE)
+		BuildRGBETables(*tables, params);
+	else
+		BuildHalfTables(*tables, source, params);
+
+	int height = source.Height;
+	if (int64(source.Width)*int64(height) < ParallelThreshold)
+	{
+		ApplyRows(dst, source, *tables, 0, height);
+		return;
+	}
+
+	// Rows are independent.
+	const Tables& shared = *tables;
+	int numBands = (height + RowsPerBand - 1) / RowsPerBand;
+	Viewer::ParallelFor
+	(
+		numBands,
+		[&](int band)
+		{
+			int rowBegin = band*RowsPerBand;
+			ApplyRows(dst, source, shared, rowBegin, tMin(rowBegin + RowsPerBand, height));
+		}
+	);
+}
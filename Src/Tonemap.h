@@ -0,0 +1,59 @@
+// Tonemap.h
+//
+// Keeps the linear pixels of hdr and exr images and maps them to displayable RGBA using the load params. Redoing the
+// mapping after a change to gamma, exposure, defog or the knee only costs a pass over the pixels, not a reload. Both
+// operators turn a 16 bit input, a half float or an rgbe mantissa and exponent, into 8 bits, so each change builds a
+// 64K entry table and the pass over the pixels is a table lookup per channel spread over all cores.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Math/tColour.h>
+#include <Image/tPicture.h>
+namespace Tonemap
+{
+	enum class Encoding
+	{
+		None,
+		RGBE,								// Radiance. 4 bytes per pixel. Uses GammaValue and HDR_Exposure.
+		Half								// OpenEXR RGBA halfs. 8 bytes per pixel. Uses GammaValue and the EXR params.
+	};
+
+	// Rows are bottom-up like tPicture so the mapping is a straight pass. The fog colour is the average of each channel
+	// over the image, which exr defog subtracts scaled by the defog param. Unused for rgbe.
+	struct Source
+	{
+		bool IsValid() const																							{ return Format != Encoding::None; }
+		void Clear()																									{ Format = Encoding::None; Width = Height = 0; FogR = FogG = FogB = 0.0f; Data.clear(); Data.shrink_to_fit(); }
+
+		Encoding Format						= Encoding::None;
+		int Width							= 0;
+		int Height							= 0;
+		float FogR							= 0.0f;
+		float FogG							= 0.0f;
+		float FogB							= 0.0f;
+		std::vector<uint8> Data;
+	};
+
+	// Reads a Radiance hdr file. Returns false, leaving the source invalid, for anything it doesn't handle: xyze
+	// pixels, rotated or mirrored images, and damaged files.
+	bool DecodeRGBE(Source&, const uint8* data, int64 numBytes);
+
+	// Sets the fog colour of a Half source from its pixels.
+	void ComputeFog(Source&);
+
+	// Fills dst, which must hold Width*Height pixels, from the source using the operator for its encoding. Follows the
+	// Radiance gamma and exposure mapping for rgbe and the exrdisplay defog, exposure, knee and gamma mapping for halfs,
+	// the same operators tImageHDR and tImageEXR use.
+	void Apply(tPixel* dst, const Source&, const tImage::tPicture::LoadParams&);
+}
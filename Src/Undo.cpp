@@ -13,75 +13,574 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <System/tFile.h>
 #include "Undo.h"
 #include "Image.h"
 #include "Settings.h"
+#include "FrameCodec.h"
+#include "MappedFile.h"
 using namespace tStd;
 using namespace tMath;
 using namespace tSystem;
 using namespace tImage;
 
 
-Undo::Step_PictureList::Step_PictureList(const tString& desc, bool dirty, const tList<tImage::tPicture>& pics) :
+namespace Undo
+{
+	// Each spilled step takes one range of the spill file. Ranges freed by steps that are read back or deleted are
+	// reused first-fit. Ones at the end shrink the used part, and the file itself shrinks when mostly unused.
+	struct SpillRange
+	{
+		int64 Offset;
+		int64 NumBytes;
+	};
+	Viewer::MappedFile SpillFile;
+	tString SpillFilename;
+	int64 SpillEnd							= 0;
+	std::vector<SpillRange> SpillGaps;					// Free ranges before SpillEnd. Sorted and never touching.
+	const int64 MinSpillBytes				= 16*1024*1024;
+	const int MaxSpillFiles					= 8;		// One per running viewer. The file can only have one writer.
+
+	Step_PictureList* Oldest				= nullptr;
+	Step_PictureList* Newest				= nullptr;
+	int64 ResidentBytes						= 0;
+	int64 SpilledBytes						= 0;
+	int NumSpilled							= 0;
+
+	void LinkNewest(Step_PictureList*);
+	void Unlink(Step_PictureList*);
+	bool ReserveSpill(int64 end);
+	int64 AllocSpill(int64 numBytes);					// Returns the offset, or -1 if the file couldn't grow.
+	void FreeSpill(int64 offset, int64 numBytes);
+	void ResetSpill();
+	void EnforceBudget();
+	Step::ForEachFn ForEachIn(tList<tPicture>&);		// For steps whose Apply is their ApplyEach over the list.
+}
+
+
+bool Undo::OpenSpillFile(const tString& dir)
+{
+	CloseSpillFile();
+	for (int f = 0; f < MaxSpillFiles; f++)
+	{
+		tString filename;
+		tsPrintf(filename, "%sUndoSpill%d.bin", dir.Chars(), f);
+		if (!SpillFile.OpenWrite(filename, MinSpillBytes))
+			continue;
+
+		// A file left by a viewer that didn't exit cleanly may be large. Its contents are never read.
+		SpillFilename = filename;
+		ResetSpill();
+		return true;
+	}
+	return false;
+}
+
+
+void Undo::CloseSpillFile()
+{
+	if (!SpillFile.IsValid())
+		return;
+
+	SpillFile.Close();
+	tDeleteFile(SpillFilename);
+	SpillFilename.Clear();
+	SpillEnd = 0;
+	SpillGaps.clear();
+}
+
+
+int64 Undo::GetResidentBytes()
+{
+	return ResidentBytes;
+}
+
+
+int64 Undo::GetSpilledBytes()
+{
+	return SpilledBytes;
+}
+
+
+int Undo::GetNumSpilled()
+{
+	return NumSpilled;
+}
+
+
+void Undo::LinkNewest(Step_PictureList* step)
+{
+	step->Older = Newest;
+	step->Newer = nullptr;
+	if (Newest)
+		Newest->Newer = step;
+	else
+		Oldest = step;
+	Newest = step;
+}
+
+
+void Undo::Unlink(Step_PictureList* step)
+{
+	if (step->Older)
+		step->Older->Newer = step->Newer;
+	else
+		Oldest = step->Newer;
+
+	if (step->Newer)
+		step->Newer->Older = step->Older;
+	else
+		Newest = step->Older;
+
+	step->Older = step->Newer = nullptr;
+}
+
+
+bool Undo::ReserveSpill(int64 end)
+{
+	if (end <= SpillFile.GetSize())
+		return true;
+
+	// Grow geometrically so appends stay cheap. Only offsets are kept so remapping is fine.
+	return SpillFile.Resize(tMax(SpillFile.GetSize()*2, end));
+}
+
+
+int64 Undo::AllocSpill(int64 numBytes)
+{
+	for (auto gap = SpillGaps.begin(); gap != SpillGaps.end(); ++gap)
+	{
+		if (gap->NumBytes < numBytes)
+			continue;
+
+		int64 offset = gap->Offset;
+		gap->Offset += numBytes;
+		gap->NumBytes -= numBytes;
+		if (gap->NumBytes == 0)
+			SpillGaps.erase(gap);
+		return offset;
+	}
+
+	if (!ReserveSpill(SpillEnd + numBytes))
+		return -1;
+
+	int64 offset = SpillEnd;
+	SpillEnd += numBytes;
+	return offset;
+}
+
+
+void Undo::FreeSpill(int64 offset, int64 numBytes)
+{
+	if (numBytes <= 0)
+		return;
+
+	// Merge with the gaps either side.
+	auto next = SpillGaps.begin();
+	while ((next != SpillGaps.end()) && (next->Offset < offset))
+		++next;
+	next = SpillGaps.insert(next, { offset, numBytes });
+	if ((next+1 != SpillGaps.end()) && ((next+1)->Offset == next->Offset + next->NumBytes))
+	{
+		next->NumBytes += (next+1)->NumBytes;
+		SpillGaps.erase(next+1);
+	}
+	if ((next != SpillGaps.begin()) && ((next-1)->Offset + (next-1)->NumBytes == next->Offset))
+	{
+		(next-1)->NumBytes += next->NumBytes;
+		SpillGaps.erase(next);
+	}
+
+	if (!SpillGaps.empty() && (SpillGaps.back().Offset + SpillGaps.back().NumBytes == SpillEnd))
+	{
+		SpillEnd = SpillGaps.back().Offset;
+		SpillGaps.pop_back();
+	}
+
+	// The file grows by doubling so it only shrinks once it is four times what is used. That keeps a step spilling
+	// and coming back from resizing every time.
+	if (SpillFile.GetSize() > tMax(MinSpillBytes, SpillEnd*4))
+		SpillFile.Resize(tMax(MinSpillBytes, SpillEnd*2));
+}
+
+
+void Undo::ResetSpill()
+{
+	SpillEnd = 0;
+	SpillGaps.clear();
+	if (SpillFile.IsValid() && (SpillFile.GetSize() > MinSpillBytes))
+		SpillFile.Resize(MinSpillBytes);
+}
+
+
+void Undo::EnforceBudget()
+{
+	int64 budgetBytes = int64(Viewer::Config.MaxUndoMemMB) * 1024 * 1024;
+	for (Step_PictureList* step = Oldest; step && (step != Newest) && (ResidentBytes > budgetBytes); step = step->Newer)
+	{
+		if (!step->IsSpilled())
+			step->Spill();
+	}
+}
+
+
+Undo::Step_PictureList::Step_PictureList(const tString& desc, bool dirty, tList<tImage::tPicture>& pics, bool take) :
+	Step(desc, dirty)
+{
+	if (take)
+	{
+		while (tPicture* pic = pics.Remove())
+			Pictures.Append(pic);
+	}
+	else
+	{
+		for (tPicture* pic = pics.First(); pic; pic = pic->Next())
+			Pictures.Append(new tPicture(*pic));
+	}
+
+	ResidentBytes += GetPixelBytes();
+	LinkNewest(this);
+}
+
+
+Undo::Step_PictureList::~Step_PictureList()
+{
+	Unlink(this);
+	if (Spilled)
+		FreeSpilled();
+	else
+	{
+		ResidentBytes -= GetPixelBytes();
+	}
+	Pictures.Empty();
+}
+
+
+int64 Undo::Step_PictureList::GetPixelBytes() const
+{
+	int64 numBytes = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		numBytes += int64(pic->GetNumPixels()) * sizeof(tPixel);
+	return numBytes;
+}
+
+
+int64 Undo::Step_PictureList::GetMemSizeBytes() const
+{
+	return GetPixelBytes();
+}
+
+
+bool Undo::Step_PictureList::Spill()
+{
+	if (Spilled || !SpillFile.IsValid())
+		return false;
+
+	// Every picture is compressed before any space is taken so the step gets a single range. Nothing is freed until
+	// they are all written, so a failure leaves the step untouched.
+	std::vector<std::vector<uint8>> data(Pictures.Count());
+	int64 numBytes = 0;
+	int index = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next(), index++)
+	{
+		if (pic->IsValid())
+			FrameCodec::Encode(data[index], pic->GetPixelPointer(), pic->GetNumPixels());
+		numBytes += int64(data[index].size());
+	}
+
+	int64 offset = AllocSpill(numBytes);
+	if (offset < 0)
+		return false;
+
+	std::vector<SpilledPicture> spilledPictures;
+	index = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next(), index++)
+	{
+		SpilledPicture spilled = { 0, 0, pic->Duration, offset, int64(data[index].size()) };
+		if (pic->IsValid())
+		{
+			tMemcpy(SpillFile.GetData() + offset, data[index].data(), int(data[index].size()));
+			spilled.Width = pic->GetWidth();
+			spilled.Height = pic->GetHeight();
+		}
+		spilledPictures.push_back(spilled);
+		offset += spilled.NumBytes;
+	}
+
+	ResidentBytes -= GetPixelBytes();
+	Pictures.Empty();
+	SpilledPictures.swap(spilledPictures);
+	SpilledBytes += numBytes;
+	NumSpilled++;
+	Spilled = true;
+	return true;
+}
+
+
+void Undo::Step_PictureList::Unspill()
+{
+	if (!Spilled)
+		return;
+
+	for (const SpilledPicture& spilled : SpilledPictures)
+	{
+		tPicture* pic = new tPicture();
+		int numPixels = spilled.Width*spilled.Height;
+		if (numPixels > 0)
+		{
+			// The data was written by us so it can only fail to decode if the file was changed under us.
+			tPixel* pixels = new tPixel[numPixels];
+			if (!FrameCodec::Decode(pixels, numPixels, SpillFile.GetData() + spilled.Offset, spilled.NumBytes))
+				tMemset(pixels, 0, numPixels*sizeof(tPixel));
+			pic->Set(spilled.Width, spilled.Height, pixels, false);
+		}
+		pic->Duration = spilled.Duration;
+		Pictures.Append(pic);
+	}
+
+	FreeSpilled();
+	ResidentBytes += GetPixelBytes();
+}
+
+
+void Undo::Step_PictureList::FreeSpilled()
+{
+	// The pictures were written one after the other so the step's range starts at the first.
+	int64 numBytes = 0;
+	for (const SpilledPicture& spilled : SpilledPictures)
+		numBytes += spilled.NumBytes;
+	if (!SpilledPictures.empty())
+		FreeSpill(SpilledPictures.front().Offset, numBytes);
+
+	SpilledBytes -= numBytes;
+	SpilledPictures.clear();
+	Spilled = false;
+	if (--NumSpilled == 0)
+		ResetSpill();
+}
+
+
+void Undo::Step_PictureList::Apply(tList<tImage::tPicture>& pics)
+{
+	Unspill();
+	ResidentBytes -= GetPixelBytes();
+
+	// The pictures are relinked, not copied.
+	tList<tPicture> current;
+	while (tPicture* pic = pics.Remove())
+		current.Append(pic);
+	while (tPicture* pic = Pictures.Remove())
+		pics.Append(pic);
+	while (tPicture* pic = current.Remove())
+		Pictures.Append(pic);
+
+	ResidentBytes += GetPixelBytes();
+	Unlink(this);
+	LinkNewest(this);
+}
+
+
+Undo::Step::ForEachFn Undo::ForEachIn(tList<tPicture>& pics)
+{
+	return [&pics](const Step::PictureFn& fn, bool pixels)
+	{
+		int index = 0;
+		for (tPicture* pic = pics.First(); pic; pic = pic->Next(), index++)
+			fn(*pic, index);
+	};
+}
+
+
+void Undo::Step_Flip::Apply(tList<tImage::tPicture>& pics)
+{
+	ApplyEach(ForEachIn(pics));
+}
+
+
+void Undo::Step_Flip::ApplyEach(const ForEachFn& forEach)
+{
+	bool horizontal = Horizontal;
+	forEach([horizontal](tPicture& pic, int index) { pic.Flip(horizontal); }, true);
+}
+
+
+void Undo::Step_Rotate90::Apply(tList<tImage::tPicture>& pics)
+{
+	ApplyEach(ForEachIn(pics));
+}
+
+
+void Undo::Step_Rotate90::ApplyEach(const ForEachFn& forEach)
+{
+	bool antiClockWise = !AntiClockWise;
+	forEach([antiClockWise](tPicture& pic, int index) { pic.Rotate90(antiClockWise); }, true);
+	AntiClockWise = antiClockWise;
+}
+
+
+Undo::Step_Durations::Step_Durations(const tString& desc, bool dirty, const tList<tImage::tPicture>& pics) :
 	Step(desc, dirty)
 {
 	for (tPicture* pic = pics.First(); pic; pic = pic->Next())
-		Pictures.Append(new tPicture(*pic));
+		Durations.push_back(pic->Duration);
 }
 
 
-void Undo::Step_PictureList::Restore(tList<tImage::tPicture>& pics)
+void Undo::Step_Durations::Apply(tList<tImage::tPicture>& pics)
 {
-	pics.Clear();
-	for (tPicture* restorePic = Pictures.First(); restorePic; restorePic = restorePic->Next())
-		pics.Append(new tPicture(*restorePic));
+	ApplyEach(ForEachIn(pics));
+}
+
+
+void Undo::Step_Durations::ApplyEach(const ForEachFn& forEach)
+{
+	// Each index is only visited once so the pictures may be done in any order.
+	forEach
+	(
+		[this](tPicture& pic, int index)
+		{
+			if (index < int(Durations.size()))
+				tSwap(pic.Duration, Durations[index]);
+		},
+		false
+	);
+}
+
+
+void Undo::Step_Pixels::Add(const tList<tImage::tPicture>& pics, int x, int y)
+{
+	int index = 0;
+	bool added = false;
+	for (tPicture* pic = pics.First(); pic; pic = pic->Next(), index++)
+	{
+		if ((x < 0) || (x >= pic->GetWidth()) || (y < 0) || (y >= pic->GetHeight()))
+			continue;
+
+		bool recorded = false;
+		for (const Delta& delta : Deltas)
+		{
+			if ((delta.Picture == index) && (delta.X == x) && (delta.Y == y))
+			{
+				recorded = true;
+				break;
+			}
+		}
+		if (!recorded)
+		{
+			Deltas.push_back({ index, x, y, pic->GetPixel(x, y) });
+			added = true;
+		}
+	}
+
+	if (added)
+		NumPixels++;
+}
+
+
+void Undo::Step_Pixels::Apply(tList<tImage::tPicture>& pics)
+{
+	std::vector<tPicture*> pictures;
+	for (tPicture* pic = pics.First(); pic; pic = pic->Next())
+		pictures.push_back(pic);
+
+	for (Delta& delta : Deltas)
+	{
+		if (delta.Picture >= int(pictures.size()))
+			continue;
+
+		// Only reachable if the pictures changed size without the step knowing. Never write outside them.
+		tPicture* pic = pictures[delta.Picture];
+		if ((delta.X < 0) || (delta.X >= pic->GetWidth()) || (delta.Y < 0) || (delta.Y >= pic->GetHeight()))
+			continue;
+
+		tPixel colour = pic->GetPixel(delta.X, delta.Y);
+		pic->SetPixel(delta.X, delta.Y, delta.Colour);
+		delta.Colour = colour;
+	}
 }
 
 
 void Undo::Stack::Push(tList<tImage::tPicture>& preOpState, const tString& desc, bool dirty)
 {
-	// Create the undo step.
-	Undo::Step_PictureList* step = new Undo::Step_PictureList(desc, dirty, preOpState);
+	Push(new Undo::Step_PictureList(desc, dirty, preOpState));
+}
+
+
+void Undo::Stack::Push(Step* step)
+{
+	// Redo steps are inverses of the states that led here. After a new edit they no longer apply.
+	while (Step* redoStep = RedoSteps.Remove())
+		delete redoStep;
+
 	UndoSteps.Insert(step);
 
 	// Drop one from the end if we've reached the limit.
 	int numUndoSteps = UndoSteps.Count();
 	if (numUndoSteps > Viewer::Config.MaxUndoSteps)
 		delete UndoSteps.Drop();
+
+	EnforceBudget();
 }
 
 
-void Undo::Stack::Undo(tList<tImage::tPicture>& currPics, bool& dirty)
+void Undo::Stack::PushPixel(const tList<tImage::tPicture>& preOpState, int x, int y, const tString& desc, bool dirty)
 {
-	if (UndoSteps.IsEmpty())
+	// The dirty state stays that of the first edit in the step.
+	Step_Pixels* step = RedoSteps.IsEmpty() ? dynamic_cast<Step_Pixels*>(UndoSteps.Head()) : nullptr;
+	if (!step)
+	{
+		step = new Step_Pixels(desc, dirty);
+		step->Add(preOpState, x, y);
+		Push(step);
 		return;
+	}
 
-	Step* undoStep = UndoSteps.Remove();
-
-	// We're going to need a redo step to get to current state. Prepare it first.
-	Step* redoStep = new Step_PictureList(undoStep->Description, dirty, currPics);
+	step->Add(preOpState, x, y);
+	int numPixels = step->GetNumPixels();
+	if (numPixels > 1)
+		tsPrintf(step->Description, "Pixel Colour x%d", numPixels);
+}
 
-	((Step_PictureList*)undoStep)->Restore(currPics);
-	dirty = undoStep->Dirty;
-	delete undoStep;
 
-	RedoSteps.Insert(redoStep);
+int64 Undo::Stack::GetMemSizeBytes() const
+{
+	int64 numBytes = 0;
+	for (Step* step = UndoSteps.First(); step; step = step->Next())
+		numBytes += step->GetMemSizeBytes();
+	for (Step* step = RedoSteps.First(); step; step = step->Next())
+		numBytes += step->GetMemSizeBytes();
+	return numBytes;
 }
 
 
-void Undo::Stack::Redo(tList<tImage::tPicture>& currPics, bool& dirty)
+void Undo::Stack::Undo(tList<tImage::tPicture>& currPics, bool& dirty, const Step::ForEachFn& forEach)
 {
-	if (RedoSteps.IsEmpty())
+	if (UndoSteps.IsEmpty())
 		return;
 
-	Step* redoStep = RedoSteps.Remove();
+	// The step becomes the redo step once applied.
+	Step* step = UndoSteps.Remove();
+	if (step->CanApplyEach())
+		step->ApplyEach(forEach);
+	else
+		step->Apply(currPics);
+	tSwap(dirty, step->Dirty);
+	RedoSteps.Insert(step);
+	EnforceBudget();
+}
 
-	// We're going to need an undo step to get to current state. Prepare it first.
-	Step* undoStep = new Step_PictureList(redoStep->Description, dirty, currPics);
 
-	((Step_PictureList*)redoStep)->Restore(currPics);
-	dirty = redoStep->Dirty;
-	delete redoStep;
+void Undo::Stack::Redo(tList<tImage::tPicture>& currPics, bool& dirty, const Step::ForEachFn& forEach)
+{
+	if (RedoSteps.IsEmpty())
+		return;
 
-	UndoSteps.Insert(undoStep);
+	Step* step = RedoSteps.Remove();
+	if (step->CanApplyEach())
+		step->ApplyEach(forEach);
+	else
+		step->Apply(currPics);
+	tSwap(dirty, step->Dirty);
+	UndoSteps.Insert(step);
+	EnforceBudget();
 }
@@ -14,6 +14,8 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #pragma once
+#include <vector>
+#include <functional>
 #include <Foundation/tList.h>
 #include <Foundation/tString.h>
 #include <Image/tPicture.h>
@@ -21,44 +23,174 @@ namespace Undo
 {
 
 
-// An Step is is capable of undoing (or redoing) an operation.
+// An Step is is capable of undoing (or redoing) an operation. Steps are their own inverse. Apply takes the pictures
+// to the other side of the operation and leaves the step holding what it needs to go back again, so the same object
+// moves between the undo and redo lists without copying anything.
 class Step : public tLink<Step>
 {
 public:
 	Step(const tString& desc, bool dirty)																				: Description(desc), Dirty(dirty) { }
 	virtual ~Step()																										{ }
+	virtual void Apply(tList<tImage::tPicture>& pics) = 0;
+	virtual int64 GetMemSizeBytes() const = 0;
+
+	// Steps that change each picture on its own, like flips, may instead be applied through a function that calls the
+	// one given on every picture and its index. Images that keep their frames compressed use this to decode only one
+	// at a time. Pixels is false if only the durations change. Steps that can't do this leave ApplyEach alone.
+	typedef std::function<void(tImage::tPicture&, int index)> PictureFn;
+	typedef std::function<void(const PictureFn&, bool pixels)> ForEachFn;
+	virtual bool CanApplyEach() const																					{ return false; }
+	virtual void ApplyEach(const ForEachFn&)																			{ }
 
 	tString Description;					// A biref description of the operation that this step undoes.
 	bool Dirty;								// The dirty state prior to the operation.
 };
 
 
-// A particular type of restore step. This one is simple but takes quite a lot of memory. Good one to use while trying
-// to get this running.
+// A snapshot of every picture. Takes a lot of memory so it is only for operations that lose information, like
+// resampling, cropping and non-orthogonal rotation. Applying it exchanges the snapshot with the current pictures.
+// Snapshots of all images share a memory budget. See the namespace functions below.
 class Step_PictureList : public Step
 {
 public:
-	Step_PictureList(const tString& desc, bool dirty, const tList<tImage::tPicture>& pics);
-	virtual ~Step_PictureList()																							{ Pictures.Empty(); }
-	void Restore(tList<tImage::tPicture>& pics);
+	// With take the pictures are moved into the step, leaving the list empty. This is for operations that write their
+	// results to new pictures anyway, so the originals become the snapshot without being copied.
+	Step_PictureList(const tString& desc, bool dirty, tList<tImage::tPicture>& pics, bool take = false);
+	virtual ~Step_PictureList();
+	void Apply(tList<tImage::tPicture>& pics) override;
+	int64 GetMemSizeBytes() const override;				// No pixels are counted while spilled.
+
+	// Spill compresses the pictures into the spill file and frees them. It returns false, leaving the step as it was,
+	// if there is no spill file or it couldn't grow. Unspill reads them back. Apply does this itself.
+	bool Spill();
+	void Unspill();
+	bool IsSpilled() const																								{ return Spilled; }
 
 	tList<tImage::tPicture> Pictures;
+
+	// Links snapshots of all images from least to most recently used.
+	Step_PictureList* Older					= nullptr;
+	Step_PictureList* Newer					= nullptr;
+
+private:
+	int64 GetPixelBytes() const;
+	void FreeSpilled();
+
+	// Stands in for each picture while spilled. Only the size and duration are kept, as for compressed frames.
+	struct SpilledPicture
+	{
+		int Width;
+		int Height;
+		float Duration;
+		int64 Offset;							// Into the spill file.
+		int64 NumBytes;
+	};
+	std::vector<SpilledPicture> SpilledPictures;
+	bool Spilled							= false;
 };
 
 
+// Flips are undone by flipping again. Only the direction is stored.
+class Step_Flip : public Step
+{
+public:
+	Step_Flip(const tString& desc, bool dirty, bool horizontal)															: Step(desc, dirty), Horizontal(horizontal) { }
+	void Apply(tList<tImage::tPicture>& pics) override;
+	bool CanApplyEach() const override																					{ return true; }
+	void ApplyEach(const ForEachFn&) override;
+	int64 GetMemSizeBytes() const override																				{ return sizeof(*this); }
+
+	bool Horizontal;
+};
+
+
+// Rotates the other way. Applying it reverses the direction so redo turns the pictures back.
+class Step_Rotate90 : public Step
+{
+public:
+	Step_Rotate90(const tString& desc, bool dirty, bool antiClockWise)													: Step(desc, dirty), AntiClockWise(antiClockWise) { }
+	void Apply(tList<tImage::tPicture>& pics) override;
+	bool CanApplyEach() const override																					{ return true; }
+	void ApplyEach(const ForEachFn&) override;
+	int64 GetMemSizeBytes() const override																				{ return sizeof(*this); }
+
+	bool AntiClockWise;						// The direction of the operation this step undoes.
+};
+
+
+// The frame durations before the operation. Applying swaps them with the current ones.
+class Step_Durations : public Step
+{
+public:
+	Step_Durations(const tString& desc, bool dirty, const tList<tImage::tPicture>& pics);
+	void Apply(tList<tImage::tPicture>& pics) override;
+	bool CanApplyEach() const override																					{ return true; }
+	void ApplyEach(const ForEachFn&) override;
+	int64 GetMemSizeBytes() const override																				{ return sizeof(*this) + Durations.size()*sizeof(float); }
+
+	std::vector<float> Durations;
+};
+
+
+// Sparse pixel edits. Each entry holds the colour a pixel of one picture had before the edit. Consecutive pixel edits
+// are added to the same step, with only the first colour of any pixel kept, so a run of them undoes in one go.
+class Step_Pixels : public Step
+{
+public:
+	Step_Pixels(const tString& desc, bool dirty)																		: Step(desc, dirty) { }
+
+	// Records the colour at x,y in every picture it is inside of. Does nothing for pixels already recorded.
+	void Add(const tList<tImage::tPicture>& pics, int x, int y);
+	int GetNumPixels() const																							{ return NumPixels; }
+	void Apply(tList<tImage::tPicture>& pics) override;
+	int64 GetMemSizeBytes() const override																				{ return sizeof(*this) + Deltas.size()*sizeof(Delta); }
+
+private:
+	struct Delta
+	{
+		int Picture;						// Index into the picture list.
+		int X, Y;
+		tPixel Colour;
+	};
+	std::vector<Delta> Deltas;
+	int NumPixels							= 0;		// Distinct positions. Each has a delta per picture it is inside of.
+};
+
+
+// Snapshot steps of all images share a budget of Config.MaxUndoMemMB. When their pixels take more than that, the
+// least recently used ones are compressed and written to a spill file. They are read back when they are applied. The
+// most recent snapshot always stays in memory. Only the main thread may push, undo or redo.
+bool OpenSpillFile(const tString& dir);			// Without a spill file snapshots stay in memory whatever the budget.
+void CloseSpillFile();							// Deletes the file. Call after all the stacks are gone.
+int64 GetResidentBytes();						// Pixels of snapshots in memory.
+int64 GetSpilledBytes();						// Compressed size of the spilled snapshots.
+int GetNumSpilled();
+
+
 class Stack
 {
 public:
-	// Call push before doing whatever op you are doing.
+	// Call push before doing whatever op you are doing. The first takes a snapshot of all the pictures. The second
+	// takes ownership of a step made by the caller.
 	void Push(tList<tImage::tPicture>& preOpState, const tString& desc, bool dirty);
+	void Push(Step*);
+
+	// Call before setting a pixel. If the last step was also a pixel edit and nothing was undone since, the pixel is
+	// added to it instead of pushing a new step.
+	void PushPixel(const tList<tImage::tPicture>& preOpState, int x, int y, const tString& desc, bool dirty);
 
-	void Undo(tList<tImage::tPicture>& currPics, bool& dirty);
-	void Redo(tList<tImage::tPicture>& currPics, bool& dirty);
+	// Steps that can are applied through forEach, the rest to the current pictures. Callers that need to get the
+	// pictures ready for the rest can check CanUndoEach or CanRedoEach first.
+	void Undo(tList<tImage::tPicture>& currPics, bool& dirty, const Step::ForEachFn& forEach);
+	void Redo(tList<tImage::tPicture>& currPics, bool& dirty, const Step::ForEachFn& forEach);
+	bool CanUndoEach() const { return !UndoSteps.IsEmpty() && UndoSteps.Head()->CanApplyEach(); }
+	bool CanRedoEach() const { return !RedoSteps.IsEmpty() && RedoSteps.Head()->CanApplyEach(); }
 
 	bool UndoAvailable() const { return !UndoSteps.IsEmpty(); }
 	bool RedoAvailable() const { return !RedoSteps.IsEmpty(); }
 	tString GetUndoDesc() const;
 	tString GetRedoDesc() const;
+	int64 GetMemSizeBytes() const;					// Of all undo and redo steps.
 
 private:
 	tList<Step> UndoSteps;
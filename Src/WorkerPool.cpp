@@ -0,0 +1,331 @@
+// WorkerPool.cpp
+//
+// A fixed-size pool of persistent worker threads with priority lanes. Jobs are submitted from the main thread, run on
+// a worker, and are handed back to the main thread through a completion queue. Each worker owns a queue and steals
+// from the others when its own is empty. Jobs that have not started may be re-prioritized or cancelled.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <System/tMachine.h>
+#include <Foundation/tFundamentals.h>
+#include "WorkerPool.h"
+using namespace tMath;
+
+
+namespace Viewer
+{
+	WorkerPool Workers;
+
+	// The job the calling worker is running. Null on other threads.
+	thread_local WorkerPool::Job* CurrentJob = nullptr;
+}
+
+
+void Viewer::WorkerPool::Startup(int numThreads)
+{
+	if (IsRunning())
+		return;
+
+	if (numThreads <= 0)
+		numThreads = tClampMin(tSystem::tGetNumCores() - 1, 2);
+
+	ShuttingDown = false;
+	for (int q = 0; q < numThreads; q++)
+		Queues.push_back(std::make_unique<Queue>());
+
+	for (int w = 0; w < numThreads; w++)
+		Threads.push_back(std::thread(&WorkerPool::WorkerMain, this, w));
+}
+
+
+void Viewer::WorkerPool::Shutdown()
+{
+	if (!IsRunning())
+		return;
+
+	// Cancel everything still queued so the workers exit as soon as their current job is done.
+	for (auto& queue : Queues)
+	{
+		std::lock_guard<std::mutex> lock(queue->Mutex);
+		for (int lane = 0; lane < int(Priority::NumPriorities); lane++)
+		{
+			for (Entry& entry : queue->Lanes[lane])
+			{
+				int expected = int(Job::State::Queued);
+				if (entry.Item->JobState.compare_exchange_strong(expected, int(Job::State::Cancelled)))
+					NumPending--;
+			}
+			NumEntries -= int(queue->Lanes[lane].size());
+			queue->Lanes[lane].clear();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(WakeMutex);
+		ShuttingDown = true;
+	}
+	WakeCondition.notify_all();
+
+	for (std::thread& worker : Threads)
+		worker.join();
+
+	Threads.clear();
+	Queues.clear();
+
+	std::lock_guard<std::mutex> lock(DoneMutex);
+	Completed.clear();
+}
+
+
+Viewer::WorkerPool::JobRef Viewer::WorkerPool::Submit(Priority priority, std::function<void()> work, std::function<void()> onComplete)
+{
+	JobRef job = std::make_shared<Job>();
+	job->Work = std::move(work);
+	job->OnComplete = std::move(onComplete);
+	job->Lane = int(priority);
+
+	// With no workers we run synchronously. The completion is still deferred to ProcessCompletions.
+	if (!IsRunning())
+	{
+		job->JobState = int(Job::State::Running);
+		job->Work();
+		job->JobState = int(Job::State::Complete);
+		std::lock_guard<std::mutex> lock(DoneMutex);
+		if (job->OnComplete)
+			Completed.push_back(job);
+		return job;
+	}
+
+	NumPending++;
+	Push(job, int(priority));
+	return job;
+}
+
+
+void Viewer::WorkerPool::Push(const JobRef& job, int lane)
+{
+	// Round-robin the owning queue. Idle workers will steal if the distribution ends up uneven.
+	Queue& queue = *Queues[NextQueue++ % uint32(Queues.size())];
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.Lanes[lane].push_back({ job, lane });
+	}
+
+	// Incrementing before taking the wake mutex means a worker checking the predicate can't miss the new entry.
+	NumEntries++;
+	{
+		std::lock_guard<std::mutex> lock(WakeMutex);
+	}
+	WakeCondition.notify_one();
+}
+
+
+bool Viewer::WorkerPool::Reprioritize(const JobRef& job, Priority priority)
+{
+	if (!job || !IsRunning() || (job->JobState != int(Job::State::Queued)))
+		return false;
+
+	int lane = int(priority);
+	if (job->Lane.exchange(lane) == lane)
+		return true;
+
+	// The old entry is now stale and will be discarded by whichever worker pops it. If a worker claimed the job
+	// between the state check and the lane exchange, the new entry is discarded too. That's fine.
+	Push(job, lane);
+	return true;
+}
+
+
+bool Viewer::WorkerPool::Cancel(const JobRef& job)
+{
+	if (!job)
+		return false;
+
+	int expected = int(Job::State::Queued);
+	if (!job->JobState.compare_exchange_strong(expected, int(Job::State::Cancelled)))
+		return (expected == int(Job::State::Cancelled));
+
+	NumPending--;
+	return true;
+}
+
+
+void Viewer::WorkerPool::Wait(const JobRef& job)
+{
+	if (!job)
+		return;
+
+	std::unique_lock<std::mutex> lock(DoneMutex);
+	DoneCondition.wait(lock, [&job] { return job->JobState != int(Job::State::Running); });
+}
+
+
+void Viewer::WorkerPool::Abandon(JobRef& job)
+{
+	if (!job)
+		return;
+
+	if (!Cancel(job))
+		Wait(job);
+
+	// Completions are only ever run on the main thread, so clearing this here is safe. The job object itself may
+	// still be referenced by a stale queue entry or the completion queue for a little while.
+	job->OnComplete = nullptr;
+	job.reset();
+}
+
+
+int Viewer::WorkerPool::ProcessCompletions(int maxCompletions)
+{
+	std::deque<JobRef> completed;
+	{
+		std::lock_guard<std::mutex> lock(DoneMutex);
+		if (maxCompletions < 0)
+		{
+			completed.swap(Completed);
+		}
+		else
+		{
+			while (!Completed.empty() && (int(completed.size()) < maxCompletions))
+			{
+				completed.push_back(Completed.front());
+				Completed.pop_front();
+			}
+		}
+	}
+
+	// Callbacks may submit new jobs, which is why we don't hold the lock while calling them.
+	for (JobRef& job : completed)
+	{
+		std::function<void()> onComplete = std::move(job->OnComplete);
+		job->OnComplete = nullptr;
+		if (onComplete)
+			onComplete();
+	}
+
+	return int(completed.size());
+}
+
+
+bool Viewer::WorkerPool::PopFrom(Queue& queue, int lane, bool fromFront, JobRef& claimed)
+{
+	std::lock_guard<std::mutex> lock(queue.Mutex);
+	std::deque<Entry>& entries = queue.Lanes[lane];
+	while (!entries.empty())
+	{
+		Entry entry = fromFront ? entries.front() : entries.back();
+		if (fromFront)
+			entries.pop_front();
+		else
+			entries.pop_back();
+		NumEntries--;
+
+		// Skip entries left behind by a re-prioritize and jobs that were cancelled.
+		if (entry.Item->Lane != entry.Lane)
+			continue;
+
+		int expected = int(Job::State::Queued);
+		if (entry.Item->JobState.compare_exchange_strong(expected, int(Job::State::Running)))
+		{
+			NumPending--;
+			claimed = entry.Item;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+Viewer::WorkerPool::JobRef Viewer::WorkerPool::FindJob(int workerIndex)
+{
+	// Higher priority lanes in other queues win over lower priority lanes in our own. The owner takes from the front
+	// so requests are serviced in the order they were made. Thieves take from the back.
+	int numQueues = int(Queues.size());
+	JobRef claimed;
+	for (int lane = 0; lane < int(Priority::NumPriorities); lane++)
+	{
+		for (int q = 0; q < numQueues; q++)
+		{
+			int index = (workerIndex + q) % numQueues;
+			if (PopFrom(*Queues[index], lane, (q == 0), claimed))
+				return claimed;
+		}
+	}
+
+	return nullptr;
+}
+
+
+void Viewer::WorkerPool::WorkerMain(int workerIndex)
+{
+	while (true)
+	{
+		JobRef job = FindJob(workerIndex);
+		if (job)
+		{
+			NumRunning++;
+			CurrentJob = job.get();
+			job->Work();
+			CurrentJob = nullptr;
+			NumRunning--;
+
+			// Abandon only clears OnComplete once the job isn't running, so it is safe to look at under the lock.
+			std::lock_guard<std::mutex> lock(DoneMutex);
+			job->JobState = int(Job::State::Complete);
+			if (job->OnComplete)
+				Completed.push_back(job);
+			DoneCondition.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(WakeMutex);
+		WakeCondition.wait(lock, [this] { return ShuttingDown || (NumEntries > 0); });
+		if (ShuttingDown)
+			break;
+	}
+}
+
+
+Viewer::WorkerPool::Priority Viewer::WorkerPool::GetCurrentPriority()
+{
+	return CurrentJob ? Priority(CurrentJob->Lane.load()) : Priority::Foreground;
+}
+
+
+void Viewer::ParallelFor(int count, const std::function<void(int)>& work)
+{
+	if (count <= 0)
+		return;
+
+	std::atomic<int> next(0);
+	auto takeItems = [&work, &next, count]
+	{
+		for (int i = next++; i < count; i = next++)
+			work(i);
+	};
+
+	// The helpers queue behind work of the same priority. Any that haven't started by the time the caller runs out of
+	// items are cancelled, and any that have only finish the items they took.
+	std::vector<WorkerPool::JobRef> helpers;
+	if (Workers.IsRunning())
+	{
+		int numHelpers = tMin(count-1, Workers.GetNumWorkers() - (CurrentJob ? 1 : 0));
+		WorkerPool::Priority lane = WorkerPool::GetCurrentPriority();
+		for (int h = 0; h < numHelpers; h++)
+			helpers.push_back(Workers.Submit(lane, takeItems));
+	}
+	takeItems();
+
+	for (WorkerPool::JobRef& helper : helpers)
+		if (!Workers.Cancel(helper))
+			Workers.Wait(helper);
+}
@@ -0,0 +1,150 @@
+// WorkerPool.h
+//
+// A fixed-size pool of persistent worker threads with priority lanes. Jobs are submitted from the main thread, run on
+// a worker, and are handed back to the main thread through a completion queue. Each worker owns a queue and steals
+// from the others when its own is empty. Jobs that have not started may be re-prioritized or cancelled.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <Foundation/tStandard.h>
+namespace Viewer
+{
+
+
+class WorkerPool
+{
+public:
+	// Lanes are serviced in order. A worker always takes a job from the highest priority lane that has one, first
+	// looking in its own queue and then stealing from the other workers.
+	enum class Priority
+	{
+		Foreground,							// The image being viewed. The user is waiting on it.
+		Visible,							// Thumbnails currently on screen.
+		Prefetch,							// Images next to the one being viewed. Likely to be wanted soon.
+		Offscreen,							// Thumbnails that exist but are scrolled out of view.
+		Prewarm,							// Speculative work nobody is waiting for yet.
+		NumPriorities
+	};
+
+	struct Job
+	{
+		enum class State
+		{
+			Queued,							// Waiting in a lane. May still be re-prioritized or cancelled.
+			Running,						// A worker is executing Work.
+			Complete,						// Work is done. Waiting for the main thread to call OnComplete.
+			Cancelled						// Will never run.
+		};
+
+		std::function<void()> Work;			// Runs on a worker thread.
+		std::function<void()> OnComplete;	// Runs on the main thread from ProcessCompletions. May be empty.
+		std::atomic<int> JobState			= int(State::Queued);
+		std::atomic<int> Lane				= int(Priority::Visible);
+	};
+	typedef std::shared_ptr<Job> JobRef;
+
+	WorkerPool()																										{ }
+	~WorkerPool()																										{ Shutdown(); }
+
+	// Starts the worker threads. If numThreads is <= 0, one core is left free for the main thread unless we are on a
+	// two core or lower machine, in which case we use a minimum of 2 workers.
+	void Startup(int numThreads = 0);
+
+	// Cancels all queued jobs and waits for any running ones to finish. Completions are discarded.
+	void Shutdown();
+	bool IsRunning() const																								{ return !Threads.empty(); }
+	int GetNumWorkers() const																							{ return int(Threads.size()); }
+
+	// Submit may be called from any thread, including from inside a job. The returned reference may be used to
+	// re-prioritize or cancel. Jobs without an OnComplete are not handed back to ProcessCompletions.
+	JobRef Submit(Priority, std::function<void()> work, std::function<void()> onComplete = nullptr);
+
+	// Moves a job to another lane. Returns false if the job is no longer queued (it already started or was cancelled).
+	bool Reprioritize(const JobRef&, Priority);
+	Priority GetPriority(const JobRef& job) const																		{ return Priority(job->Lane.load()); }
+
+	// Returns true if the job will never run. Returns false if it is already running or done.
+	bool Cancel(const JobRef&);
+
+	// Blocks until the job is not running. Returns immediately for queued, cancelled, or complete jobs.
+	void Wait(const JobRef&);
+
+	// Use when the owner of a job is going away. Cancels it if possible, otherwise waits for it to finish, and then
+	// makes sure its OnComplete will never be called. Resets the supplied reference. Main thread only.
+	void Abandon(JobRef&);
+
+	// Call once per frame from the main thread. Runs the OnComplete function of finished jobs. If maxCompletions is
+	// >= 0 at most that many are processed and the rest remain for the next call. Returns the number processed.
+	int ProcessCompletions(int maxCompletions = -1);
+
+	int GetNumPending() const																							{ return NumPending; }
+	int GetNumRunning() const																							{ return NumRunning; }
+
+	// The lane of the job running on the calling thread. Foreground if the caller isn't a worker.
+	static Priority GetCurrentPriority();
+
+private:
+	struct Entry
+	{
+		JobRef Item;
+		int Lane;							// The lane the job was in when the entry was pushed. Stale if it differs.
+	};
+
+	struct Queue
+	{
+		std::mutex Mutex;
+		std::deque<Entry> Lanes[int(Priority::NumPriorities)];
+	};
+
+	void Push(const JobRef&, int lane);
+	JobRef FindJob(int workerIndex);
+	bool PopFrom(Queue&, int lane, bool fromFront, JobRef& claimed);
+	void WorkerMain(int workerIndex);
+
+	std::vector<std::thread> Threads;
+	std::vector<std::unique_ptr<Queue>> Queues;
+
+	std::mutex WakeMutex;
+	std::condition_variable WakeCondition;
+	std::atomic<int> NumEntries				= 0;		// Entries in all queues. Includes stale entries.
+	std::atomic<bool> ShuttingDown			= false;
+
+	std::mutex DoneMutex;
+	std::condition_variable DoneCondition;
+	std::deque<JobRef> Completed;
+
+	std::atomic<uint32> NextQueue			= 0;
+	std::atomic<int> NumPending				= 0;		// Queued and not cancelled.
+	std::atomic<int> NumRunning				= 0;
+};
+
+
+// The pool shared by thumbnail generation and other background work.
+extern WorkerPool Workers;
+
+
+// Calls work(i) for every i from 0 to count-1 and returns when they are all done. The calling thread takes items too,
+// helped by jobs submitted to the pool on the caller's lane. No threads are created, so it may be called from inside
+// a pool job. When the pool is busy the caller does every item itself and the helpers are cancelled before they
+// start. Items may run in any order and on any thread.
+void ParallelFor(int count, const std::function<void(int)>& work);
+
+
+}